@@ -1,4 +1,13 @@
 #include "Commands.h"
+#include "dirscan.h"
+#include "timers.h"
+#include "stats.h"
+#include "trace.h"
+#include "reaper.h"
+#include "joblog.h"
+#include "dirwatch.h"
+#include "wordcount.h"
+#include "strsearch.h"
 
 #include <string.h>
 #include <iostream>
@@ -12,22 +21,20 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <poll.h>
 
 #include <limits.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <algorithm>
 #include <stdexcept>
 #include <net/if.h>
 #include <arpa/inet.h>
 
 
-struct linux_dirent64 {
-  ino64_t        d_ino;    // 64-bit inode number
-  off64_t        d_off;    // 64-bit offset to next dirent
-  unsigned short d_reclen; // Length of this dirent
-  unsigned char  d_type;   // File type
-  char           d_name[]; // Filename (null-terminated)
-};
-
 using namespace std;
 
 const std::string WHITESPACE = " \n\r\t\f\v";
@@ -57,21 +64,174 @@ string _trim(const std::string &s) {
     return _rtrim(_ltrim(s));
 }
 
+// The path a directory fd refers to, as getcwd() would give it, or "".
+static string _fdPath(int fd) {
+    char link[32];
+    char path[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t len = readlink(link, path, sizeof(path));
+    if (len <= 0 || len == sizeof(path)) {
+        return "";
+    }
+    return string(path, len);
+}
+
+// p follows a '$'. Appends the value of the variable it names ("NAME",
+// "{NAME}", or "$" for the shell's pid) to word and returns how many
+// characters the reference took, or 0 if p does not start one.
+size_t _expandVariable(const char *p, std::string &word) {
+    if (*p == '$') {
+        word += std::to_string(SmallShell::m_shellPid);
+        return 1;
+    }
+    const char *name = p;
+    size_t length = 0;
+    size_t used;
+    if (*p == '{') {
+        const char *close = strchr(p, '}');
+        if (close == nullptr) {
+            return 0;
+        }
+        name = p + 1;
+        length = close - name;
+        used = length + 2;
+    } else {
+        while (isalnum(static_cast<unsigned char>(p[length])) || p[length] == '_') {
+            ++length;
+        }
+        used = length;
+    }
+    if (!VariableStore::isValidName(name, length)) {
+        return 0;
+    }
+    const std::string *value = SmallShell::getInstance().getVariables().find(std::string(name, length));
+    if (value) {
+        word += *value;
+    }
+    return used;
+}
+
 int _parseCommandLine(const char *cmd_line, char **args) {
     FUNC_ENTRY()
+    // Words are split on whitespace; quotes keep a word together and are removed.
+    // $NAME and ${NAME} expand outside single quotes, without word splitting;
+    // an unquoted one that expands to nothing is no word at all.
+    // At most COMMAND_MAX_ARGS words, args must hold one more for the NULL.
     int i = 0;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;) {
-        args[i] = (char *) malloc(s.length() + 1);
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
-        args[++i] = NULL;
+    args[0] = NULL;
+    std::string word;
+    bool inWord = false;
+    char quote = 0;
+    for (const char *p = cmd_line; ; ++p) {
+        char c = *p;
+        if (c == '\0' || (!quote && strchr(WHITESPACE.c_str(), c) != nullptr)) {
+            if (inWord && i < COMMAND_MAX_ARGS) {
+                args[i] = (char *) malloc(word.length() + 1);
+                memcpy(args[i], word.c_str(), word.length() + 1);
+                args[++i] = NULL;
+            }
+            inWord = false;
+            word.clear();
+            if (c == '\0') {
+                break;
+            }
+            continue;
+        }
+        if (c == '$' && quote != '\'') {
+            size_t before = word.size();
+            size_t used = _expandVariable(p + 1, word);
+            if (used > 0) {
+                p += used;
+                inWord = inWord || quote || word.size() > before;
+                continue;
+            }
+        }
+        inWord = true;
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            } else {
+                word += c;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else {
+            word += c;
+        }
     }
     return i;
 
     FUNC_EXIT()
 }
 
+// Position of the first token outside quotes, or npos.
+size_t _findUnquoted(const std::string &s, const char *token, size_t from = 0) {
+    size_t len = strlen(token);
+    char quote = 0;
+    for (size_t i = from; i < s.size(); ++i) {
+        if (quote) {
+            if (s[i] == quote) {
+                quote = 0;
+            }
+        } else if (s[i] == '\'' || s[i] == '"') {
+            quote = s[i];
+        } else if (s.compare(i, len, token) == 0) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+// s[pos] starts "$(": index of its closing ')', or npos if it is not closed.
+size_t _substitutionEnd(const std::string &s, size_t pos) {
+    int depth = 0;
+    char quote = 0;
+    for (size_t i = pos + 1; i < s.size(); ++i) {
+        char c = s[i];
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')' && --depth == 0) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+// Single-quotes a word so it is taken literally: no operators, no globbing.
+string _quoteWord(const std::string &word) {
+    string quoted = "'";
+    for (char c : word) {
+        if (c == '\'') {
+            quoted += "'\"'\"'";
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+}
+
+// Returns what is left of s after its first n whitespace separated words.
+string _skipWords(const std::string &s, int n) {
+    size_t pos = 0;
+    for (int i = 0; i < n; ++i) {
+        pos = s.find_first_not_of(WHITESPACE, pos);
+        if (pos == std::string::npos) {
+            return "";
+        }
+        pos = s.find_first_of(WHITESPACE, pos);
+        if (pos == std::string::npos) {
+            return "";
+        }
+    }
+    return _trim(s.substr(pos));
+}
+
 bool _isBackgroundComamnd(const char *cmd_line) {
     const string str(cmd_line);
     return str[str.find_last_not_of(WHITESPACE)] == '&';
@@ -100,9 +260,8 @@ void _removeBackgroundSign(char *cmd_line) {
 
 char **extractArguments(const char *cmd_line, int *argc) {
     // Create a copy of the command line to safely modify it
-    char cmd[COMMAND_MAX_LENGTH];
-    strncpy(cmd, cmd_line, COMMAND_MAX_LENGTH);
-    cmd[COMMAND_MAX_LENGTH - 1] = '\0'; // Ensure null termination
+    std::vector<char> copy(cmd_line, cmd_line + strlen(cmd_line) + 1);
+    char *cmd = copy.data();
 
     // Remove the background sign if it exists
     _removeBackgroundSign(cmd);
@@ -138,7 +297,8 @@ void deleteArguments(char **args)
 
 //-----------------------------------------------Command-----------------------------------------------
 
-Command::Command(const char *cmd_line) {
+Command::Command(const char *cmd_line) :
+  m_out(&cout), m_err(&cerr), m_cancel(nullptr), m_status(0), m_inFd(STDIN_FILENO) {
   m_cmd_line = (char*)malloc(strlen(cmd_line) + 1);
   if (m_cmd_line != nullptr) {
     strcpy(m_cmd_line, cmd_line);
@@ -149,76 +309,298 @@ Command::~Command() {
   free(m_cmd_line);
 }
 
-void Command::initialCurrDir()
+void Command::setOutput(std::ostream *out, std::ostream *err)
 {
-  SmallShell &smash = SmallShell::getInstance();
-  char *buffer = (char *)malloc((PATH_MAX + 1) * sizeof(char));
-  if (!buffer)
+  m_out = out;
+  m_err = err;
+}
+
+void Command::setInput(int fd)
+{
+  m_inFd = fd;
+}
+
+int Command::getStatus() const
+{
+  return m_status;
+}
+
+void Command::setCancelToken(const std::atomic<bool> *cancel)
+{
+  m_cancel = cancel;
+}
+
+void Command::sleepUnlessCancelled(unsigned int seconds) const
+{
+  const useconds_t SLICE_US = 50000;
+  unsigned long total = seconds * 1000000UL;
+  for (unsigned long slept = 0; slept < total && !isCancelled(); slept += SLICE_US)
   {
-    free(buffer);
-    cerr << "smash error: malloc failed" << endl;
-    return;
+    usleep(SLICE_US);
   }
-  buffer = getcwd(buffer, PATH_MAX);
-  if (!buffer)
+}
+
+ssize_t Command::readUnlessCancelled(int fd, char *buf, size_t length) const
+{
+  struct pollfd pfd = {fd, POLLIN, 0};
+  while (!isCancelled())
   {
-    free(buffer);
-    perror("smash error: getcwd failed");
-    return;
+    // Regular files are always readable, so this costs nothing for them
+    int ready = poll(&pfd, 1, 100);
+    if (ready == -1 && errno != EINTR)
+    {
+      return -1;
+    }
+    if (ready > 0)
+    {
+      ssize_t len = read(fd, buf, length);
+      if (len != -1 || errno != EINTR)
+      {
+        return len;
+      }
+    }
+  }
+  errno = ECANCELED;
+  return -1;
+}
+
+int Command::dupCwdFd()
+{
+  return fcntl(SmallShell::getInstance().getCwdFd(), F_DUPFD_CLOEXEC, 0);
+}
+
+//-----------------------------------------------BackgroundTask-----------------------------------------------
+
+BackgroundTask::BackgroundTask(Command *cmd, int outFd, int errFd, int inFd) :
+  m_cmd(cmd),
+  m_shell(&SmallShell::getInstance()),
+  m_outFd(fcntl(outFd, F_DUPFD_CLOEXEC, 0)),
+  m_errFd(fcntl(errFd, F_DUPFD_CLOEXEC, 0)),
+  m_inFd(inFd == STDIN_FILENO ? open("/dev/null", O_RDONLY | O_CLOEXEC) : fcntl(inFd, F_DUPFD_CLOEXEC, 0)),
+  m_outBuf(m_outFd),
+  m_errBuf(m_errFd),
+  m_outStream(&m_outBuf),
+  m_errStream(&m_errBuf),
+  m_cancelled(false),
+  m_done(false)
+{
+  if (m_outFd == -1 || m_errFd == -1 || m_inFd == -1)
+  {
+    perror("smash error: dup failed");
+  }
+  m_cmd->setOutput(&m_outStream, &m_errStream);
+  m_cmd->setInput(m_inFd);
+  m_cmd->setCancelToken(&m_cancelled);
+}
+
+BackgroundTask::~BackgroundTask()
+{
+  m_outStream.flush();
+  m_errStream.flush();
+  delete m_cmd;
+  if (m_outFd != -1)
+  {
+    close(m_outFd);
+  }
+  if (m_errFd != -1)
+  {
+    close(m_errFd);
+  }
+  if (m_inFd != -1)
+  {
+    close(m_inFd);
+  }
+}
+
+void BackgroundTask::run()
+{
+  TraceSpan span("background job", "command");
+  SmallShell *previous = SmallShell::makeCurrent(m_shell);
+  if (!m_cancelled.load())
+  {
+    m_cmd->execute();
+  }
+  SmallShell::makeCurrent(previous);
+  m_outStream.flush();
+  m_errStream.flush();
+  // Done writing: a captured job's log ends now, not when the job is reaped
+  for (int *fd : {&m_outFd, &m_errFd, &m_inFd})
+  {
+    if (*fd != -1)
+    {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_done = true;
   }
-  smash.setCurrDir(buffer);
-  free(buffer);
+  m_doneCond.notify_all();
 }
 
+void BackgroundTask::cancel()
+{
+  m_cancelled = true;
+}
+
+std::atomic<bool> *BackgroundTask::cancelFlag()
+{
+  return &m_cancelled;
+}
+
+bool BackgroundTask::isDone() const
+{
+  return m_done.load();
+}
+
+void BackgroundTask::wait()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_doneCond.wait(lock, [this] { return m_done.load(); });
+}
+
+//-----------------------------------------------WorkerPool-----------------------------------------------
+
+WorkerPool &WorkerPool::getInstance()
+{
+  static WorkerPool *instance = new WorkerPool(std::max(2u, std::thread::hardware_concurrency()));
+  return *instance;
+}
+
+WorkerPool::WorkerPool(unsigned int threads)
+{
+  // Workers inherit a fully blocked mask so ctrl-C is always handled by the main thread.
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (unsigned int i = 0; i < threads; ++i)
+  {
+    m_threads.emplace_back(&WorkerPool::workerLoop, this);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+void WorkerPool::submit(const std::shared_ptr<BackgroundTask> &task)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(task);
+  }
+  m_queueCond.notify_one();
+}
+
+void WorkerPool::workerLoop()
+{
+  while (true)
+  {
+    std::shared_ptr<BackgroundTask> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_queueCond.wait(lock, [this] { return !m_queue.empty(); });
+      task = m_queue.front();
+      m_queue.pop_front();
+    }
+    task->run();
+  }
+}
 
 //-----------------------------------------------Jobs-----------------------------------------------
 
 JobsList::JobEntry::JobEntry(int jobId, pid_t pid, const char *cmd, bool isStopped) :
   m_jobId(jobId),
   m_pid(pid),
-  m_isStopped(isStopped)
+  m_isStopped(isStopped),
+  m_timerId(0),
+  m_watched(false)
 {
-  strcpy(m_commandLine, cmd);
+  strncpy(m_commandLine, cmd, COMMAND_MAX_LENGTH);
+  m_commandLine[COMMAND_MAX_LENGTH] = '\0';
 }
 
-void JobsList::addJob(const char *cmd, pid_t pid, bool isStopped)
+void JobsList::addJob(const char *cmd, pid_t pid, bool isStopped, unsigned long timerId,
+                      const std::shared_ptr<JobLog> &log)
 {
   removeFinishedJobs();
   int jobId = m_jobIdCounter + 1;
   m_jobIdCounter++;
   JobEntry newJob(jobId, pid, cmd, isStopped);
+  newJob.m_timerId = timerId;
+  newJob.m_watched = ChildReaper::getInstance().watch(pid);
+  newJob.m_log = log;
   m_list.push_back(newJob);
 }
 
-void JobsList::printJobsList(){
+JobsList::~JobsList()
+{
+  // A session going away: its jobs run on, but nobody will ask about them
+  for (const JobEntry &job : m_list)
+  {
+    if (job.m_watched)
+    {
+      ChildReaper::getInstance().forget(job.m_pid);
+    }
+  }
+}
+
+void JobsList::addJob(const char *cmd, const std::shared_ptr<BackgroundTask> &task, unsigned long timerId,
+                      const std::shared_ptr<JobLog> &log)
+{
+  removeFinishedJobs();
+  m_jobIdCounter++;
+  JobEntry newJob(m_jobIdCounter, SmallShell::m_shellPid, cmd);
+  newJob.m_task = task;
+  newJob.m_timerId = timerId;
+  newJob.m_log = log;
+  m_list.push_back(newJob);
+}
+
+void JobsList::printJobsList(std::ostream &out){
   removeFinishedJobs();
   for(const auto& job : m_list)
   {
-    std::cout << "[" << job.m_jobId << "] " << job.m_commandLine << std::endl;
+    out << "[" << job.m_jobId << "] " << job.m_commandLine << '\n';
   }
 }
 
 void JobsList::removeFinishedJobs(){
+  StatTimer timer(STAT_REAP);
   if (m_list.empty())
   {
     m_jobIdCounter = 0;
     return;
   }
   int maxActiveJobId = 0;
-  for (auto it = m_list.begin(); it != m_list.end(); ++it)
+  for (auto it = m_list.begin(); it != m_list.end();)
   {
-    auto job = *it;
-    int exitStatus;
-    int waitResult = waitpid(job.m_pid, &exitStatus, WNOHANG);
-    if (waitResult == job.m_pid || waitResult == -1)
+    bool finished;
+    if (it->m_task)
     {
-      m_list.erase(it);
-      --it;
+      finished = it->m_task->isDone();
+    }
+    else if (it->m_watched)
+    {
+      finished = ChildReaper::getInstance().reaped(it->m_pid);
+    }
+    else
+    {
+      int exitStatus;
+      int waitResult = waitpid(it->m_pid, &exitStatus, WNOHANG);
+      finished = (waitResult == it->m_pid || waitResult == -1);
+    }
+    if (finished)
+    {
+      ShellStats::getInstance().count(STAT_JOBS_REAPED);
+      TimerWheel::getInstance().cancel(it->m_timerId);
+      keepLog(*it);
+      it = m_list.erase(it);
+      continue;
     }
-    else if (job.m_jobId > maxActiveJobId)
+    if (it->m_jobId > maxActiveJobId)
     {
-      maxActiveJobId = job.m_jobId;
+      maxActiveJobId = it->m_jobId;
     }
+    ++it;
   }
   m_jobIdCounter = maxActiveJobId;
 }
@@ -248,20 +630,56 @@ void JobsList::removeJobById(int jobId){
     auto job = *it;
     if (job.m_jobId == jobId)
     {
+      keepLog(job);
       m_list.erase(it);
       return;
     }
   }
 }
 
-void JobsList::killAllJobs(){
+std::shared_ptr<JobLog> JobsList::getJobLog(int jobId)
+{
+  removeFinishedJobs();
+  JobEntry *job = getJobById(jobId);
+  if (job)
+  {
+    return job->m_log;
+  }
+  for (auto it = m_finishedLogs.rbegin(); it != m_finishedLogs.rend(); ++it)
+  {
+    if (it->first == jobId)
+    {
+      return it->second;
+    }
+  }
+  return nullptr;
+}
+
+void JobsList::keepLog(const JobEntry &job)
+{
+  // Bounded like each log is: only the last few finished jobs are kept
+  const size_t MAX_FINISHED_LOGS = 8;
+  // Kept even without a log, so it still hides an older job with its id
+  m_finishedLogs.emplace_back(job.m_jobId, job.m_log);
+  if (m_finishedLogs.size() > MAX_FINISHED_LOGS)
+  {
+    m_finishedLogs.pop_front();
+  }
+}
+
+void JobsList::killAllJobs(std::ostream &out){
   removeFinishedJobs();
-  cout << "smash: sending SIGKILL signal to " << m_list.size() <<" jobs:" << endl;
+  out << "smash: sending SIGKILL signal to " << m_list.size() <<" jobs:" << '\n';
 
   for (auto it = m_list.begin(); it != m_list.end(); ++it)
   {
     auto job = *it;
-    cout << job.m_jobId << ": " << job.m_commandLine << endl;
+    out << job.m_jobId << ": " << job.m_commandLine << '\n';
+    if (job.m_task)
+    {
+      job.m_task->cancel();
+      continue;
+    }
     if (kill(job.m_pid, SIGKILL) == -1)
     {
       perror("smash error: kill failed");
@@ -300,7 +718,7 @@ ShowPidCommand::ShowPidCommand(const char* cmd_line) : BuiltInCommand(cmd_line)
 
 void ShowPidCommand::execute() {
   SmallShell &smash = SmallShell::getInstance();
-  cout << "smash pid is " << smash.m_shellPid << endl;
+  out() << "smash pid is " << smash.m_shellPid << '\n';
 }
 
 //-------------------------------------GetCurrDirCommand-------------------------------------
@@ -309,72 +727,42 @@ GetCurrDirCommand::GetCurrDirCommand(const char *cmd_line) : BuiltInCommand(cmd_
 
 void GetCurrDirCommand::execute()
 {
-  SmallShell &smash = SmallShell::getInstance();
-  if (!strcmp(smash.getCurrDir(), ""))
-  {
-    initialCurrDir();
-  }
-  cout << string(smash.getCurrDir()) << endl;
+  out() << SmallShell::getInstance().getCurrDir() << '\n';
 }
 
 //-------------------------------------ChangeDirCommand-------------------------------------
 
-ChangeDirCommand::ChangeDirCommand(const char *cmd_line, char **plastPwd) : BuiltInCommand(cmd_line), m_prevDirectory(plastPwd) {}
+ChangeDirCommand::ChangeDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
 
 void ChangeDirCommand::execute() {
     SmallShell &smash = SmallShell::getInstance();
 
-    // Initialize current directory if not set
-    if (!strcmp(smash.getCurrDir(), "")) {
-        initialCurrDir();
-    }
-
     int argc = 0;
     char **argv = extractArguments(this->m_cmd_line, &argc);
 
     // Handle too many arguments
     if (argc > 2) {
-        cerr << "smash error: cd: too many arguments" << endl;
+        m_status = 1;
+        err() << "smash error: cd: too many arguments" << endl;
         deleteArguments(argv);
         return;
     }
 
     // Handle "cd -" when OLDPWD is not set
-    if (argc == 2 && string(argv[1]) == "-" && !strcmp(*m_prevDirectory, "")) {
-        cerr << "smash error: cd: OLDPWD not set" << endl;
+    if (argc == 2 && string(argv[1]) == "-" && smash.getPrevDir().empty()) {
+        m_status = 1;
+        err() << "smash error: cd: OLDPWD not set" << endl;
         deleteArguments(argv);
         return;
     }
 
-    // Handle "cd -" to switch to the previous directory
-    if (argc == 2 && string(argv[1]) == "-") {
-        if (chdir(*m_prevDirectory) == -1) {
-            perror("smash error: chdir failed");
-            deleteArguments(argv);
-            return;
+    // "cd -" switches to the previous directory; either way the one we leave
+    // becomes the previous one
+    if (argc == 2) {
+        string target = string(argv[1]) == "-" ? smash.getPrevDir() : string(argv[1]);
+        if (!smash.changeDir(target)) {
+            m_status = 1;
         }
-        // Update directories
-        char temp[PATH_MAX + 1];
-        strcpy(temp, smash.getPrevDir());
-        smash.setPrevDir();
-        if (getcwd(smash.getCurrDir(), PATH_MAX) == nullptr) {
-            perror("smash error: getcwd failed");
-        }
-        deleteArguments(argv);
-        return;
-    }
-
-    // Change directory to the given path
-    if (chdir(argv[1]) == -1) {
-        perror("smash error: chdir failed");
-        deleteArguments(argv);
-        return;
-    }
-
-    // Update current and previous directories
-    smash.setPrevDir();
-    if (getcwd(smash.getCurrDir(), PATH_MAX) == nullptr) {
-        perror("smash error: getcwd failed");
     }
 
     deleteArguments(argv);
@@ -389,7 +777,7 @@ JobsCommand::JobsCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
 void JobsCommand::execute()
 {
   SmallShell &smash = SmallShell::getInstance();
-  smash.getAllJobs()->printJobsList();
+  smash.getAllJobs()->printJobsList(out());
 }
 
 //-------------------------------------Foreground-------------------------------------
@@ -419,7 +807,8 @@ void ForegroundCommand::execute(){
 
   if (argc > 2 || (argc > 1 && !isNumber(argv[1])))
   {
-    cerr << "smash error: fg: invalid arguments" << endl;
+    m_status = 1;
+    err() << "smash error: fg: invalid arguments" << endl;
     deleteArguments(argv);
     return;
   }
@@ -428,7 +817,8 @@ void ForegroundCommand::execute(){
   {
     if (m_jobs->isEmpty())
     {
-      cerr << "smash error: fg: jobs list is empty" << endl;
+      m_status = 1;
+      err() << "smash error: fg: jobs list is empty" << endl;
       deleteArguments(argv);
       return;
     }
@@ -442,13 +832,29 @@ void ForegroundCommand::execute(){
   JobsList::JobEntry *job = m_jobs->getJobById(jobId);
   if (!job)
   {
-    cerr << "smash error: fg: job-id " << jobId << " does not exist" << endl;
+    m_status = 1;
+    err() << "smash error: fg: job-id " << jobId << " does not exist" << endl;
     deleteArguments(argv);
     return;
   }
 
   SmallShell &smash = SmallShell::getInstance();
-  if (job)
+  if (job && job->m_task)
+  {
+    // Built-in on a worker thread: there is nothing to continue, just wait for it.
+    std::shared_ptr<BackgroundTask> task = job->m_task;
+    unsigned long timerId = job->m_timerId;
+    // Its pid is the shell's own: name the job instead, as kill does
+    out() << job->m_commandLine << " job-id " << jobId << '\n';
+    smash.m_foregroundTaskJobId = jobId;
+    smash.m_foregroundTask = task.get();
+    m_jobs->removeJobById(jobId);
+    smash.flushOutput();
+    task->wait();
+    smash.m_foregroundTask = nullptr;
+    TimerWheel::getInstance().cancel(timerId);
+  }
+  else if (job)
   {
     int jobPid = job->m_pid;
     if (job->m_isStopped)
@@ -456,26 +862,94 @@ void ForegroundCommand::execute(){
       if (kill(jobPid, SIGCONT) == -1)
       {
         perror("smash error: kill failed");
+        m_status = 1;
         deleteArguments(argv);
         return;
       }
     }
 
     int exitStatus;
+    unsigned long timerId = job->m_timerId;
+    // From here the shell waits for it, not the reaper
+    bool exited = job->m_watched && ChildReaper::getInstance().release(jobPid, &exitStatus);
     
-    cout << job->m_commandLine << " " << jobPid << endl;
+    out() << job->m_commandLine << " " << jobPid << '\n';
 
     smash.m_foregroundPid = jobPid;
     m_jobs->removeJobById(jobId);
-    if (waitpid(jobPid, &exitStatus, WUNTRACED) == -1)
+    if (exited)
+    {
+      smash.recordWaitStatus(exitStatus);
+    }
+    else if (smash.waitChild(jobPid, &exitStatus, WUNTRACED) == -1)
     {
       perror("smash error: waitpid failed");
+      m_status = 1;
+      TimerWheel::getInstance().cancel(timerId);
       deleteArguments(argv);
       return;
     }
     smash.m_foregroundPid = 0;
+    TimerWheel::getInstance().cancel(timerId);
+  }
+  deleteArguments(argv);
+}
+
+//-------------------------------------JobLogCommand-------------------------------------
+
+JobLogCommand::JobLogCommand(const char* cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), m_jobs(jobs) {}
+
+void JobLogCommand::execute()
+{
+  int argc;
+  char **argv = extractArguments(this->m_cmd_line, &argc);
+  bool follow = argc == 3 && strcmp(argv[2], "-f") == 0;
+  if ((argc != 2 && !follow) || !isNumber(argv[1]))
+  {
+    m_status = 1;
+    err() << "smash error: joblog: invalid arguments" << endl;
+    deleteArguments(argv);
+    return;
   }
+  int jobId = atoi(argv[1]);
   deleteArguments(argv);
+
+  std::shared_ptr<JobLog> log = m_jobs->getJobLog(jobId);
+  if (!log)
+  {
+    if (m_jobs->getJobById(jobId))
+    {
+      m_status = 1;
+      err() << "smash error: joblog: job-id " << jobId << " output is not captured" << endl;
+    }
+    else
+    {
+      m_status = 1;
+      err() << "smash error: joblog: job-id " << jobId << " does not exist" << endl;
+    }
+    return;
+  }
+  // What the ring lost before this point is the tail's business, not news
+  uint64_t offset = 0;
+  std::string text;
+  log->read(&offset, text);
+  out() << text;
+  // Followed until the job and its children close their output, or ctrl-C
+  while (follow && !isCancelled())
+  {
+    out().flush();
+    if (!log->wait(offset, 100))
+    {
+      break;
+    }
+    text.clear();
+    uint64_t dropped = log->read(&offset, text);
+    if (dropped > 0)
+    {
+      err() << "smash: joblog: " << dropped << " bytes dropped" << endl;
+    }
+    out() << text;
+  }
 }
 
 //-------------------------------------QuitCommand-------------------------------------
@@ -488,11 +962,14 @@ QuitCommand::QuitCommand(const char* cmd_line, JobsList *jobs):
   char **args = extractArguments(this->m_cmd_line, &argc);  
 
   if (argc > 1 && strcmp(args[1], "kill") == 0) {
-    m_jobs->killAllJobs();
+    m_jobs->killAllJobs(out());
   }
 
   deleteArguments(args);
-  exit(0);
+  // An embedded session ends; the host process goes on
+  if (!SmallShell::getInstance().isEmbedded()) {
+    exit(0);
+  }
 }
 
 
@@ -507,7 +984,8 @@ void KillCommand::execute() {
 
   // Validate arguments: must be exactly 3, signal prefixed with '-', and both numbers
   if (argc != 3 || args[1][0] != '-' || !isNumber(args[1] + 1) || !isNumber(args[2])) {
-    cerr << "smash error: kill: invalid arguments" << endl;
+    m_status = 1;
+    err() << "smash error: kill: invalid arguments" << endl;
     deleteArguments(args);
     return;
   }
@@ -518,19 +996,40 @@ void KillCommand::execute() {
   // Lookup job
   JobsList::JobEntry *job = m_jobs->getJobById(jobId);
   if (!job) {
-    cerr << "smash error: kill: job-id " << jobId << " does not exist" << endl;
+    m_status = 1;
+    err() << "smash error: kill: job-id " << jobId << " does not exist" << endl;
     deleteArguments(args);
     return;
   }
 
   pid_t pid = job->m_pid;
 
-  // Always report signal sent line first
-  cout << "signal number " << signalNum << " was sent to pid " << pid << endl;
+  // Always report signal sent line first. A pseudo-job runs on a thread of
+  // the shell, whose pid would read as if the shell itself was signalled
+  if (job->m_task) {
+    out() << "signal number " << signalNum << " was sent to job-id " << jobId << '\n';
+  } else {
+    out() << "signal number " << signalNum << " was sent to pid " << pid << '\n';
+  }
+
+  // Pseudo-jobs live inside the shell: terminating signals cancel them, others are ignored
+  if (job->m_task) {
+    if (signalNum >= NSIG) {
+      errno = EINVAL;
+      perror("smash error: kill failed");
+      m_status = 1;
+    } else if (signalNum == SIGKILL || signalNum == SIGTERM || signalNum == SIGINT ||
+               signalNum == SIGHUP || signalNum == SIGQUIT) {
+      job->m_task->cancel();
+    }
+    deleteArguments(args);
+    return;
+  }
 
   // Attempt to send signal and report error if it fails
   if (kill(pid, signalNum) == -1) {
     perror("smash error: kill failed");
+    m_status = 1;
   }
 
   deleteArguments(args);
@@ -540,10 +1039,8 @@ void KillCommand::execute() {
 
 AliasCommand::AliasCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
 
-const std::regex AliasCommand::aliasPattern(R"(^alias [a-zA-Z0-9_]+='[^']*'$)");
-
 void AliasCommand::printAllAliases() {
-  SmallShell::getInstance().printAliases();
+  SmallShell::getInstance().printAliases(out());
 }
 
 bool AliasCommand::checkAliasName(const std::string& aliasName) const {
@@ -554,46 +1051,54 @@ bool AliasCommand::checkAliasName(const std::string& aliasName) const {
   return !SmallShell::getInstance().isAliasNameTaken(aliasName);
 }
 
-void AliasCommand::execute() {
-  int argc = 0;
-  char **args = extractArguments(this->m_cmd_line, &argc);
-
-  if (argc == 1) {
-    printAllAliases();
-    deleteArguments(args);
-    return;
+bool AliasCommand::parseDefinition(const char *line, std::string &name, std::string &command) {
+  // alias [a-zA-Z0-9_]+='[^']*', nothing before or after
+  if (strncmp(line, "alias ", 6) != 0) {
+    return false;
+  }
+  const char *nameStart = line + 6;
+  const char *p = nameStart;
+  while (isalnum(static_cast<unsigned char>(*p)) || *p == '_') {
+    ++p;
+  }
+  if (p == nameStart || p[0] != '=' || p[1] != '\'') {
+    return false;
+  }
+  const char *value = p + 2;
+  const char *close = strchr(value, '\'');
+  if (close == nullptr || close[1] != '\0') {
+    return false;
   }
+  name.assign(nameStart, p - nameStart);
+  command.assign(value, close - value);
+  return true;
+}
 
-  if (!std::regex_match(this->m_cmd_line, aliasPattern)) {
-    cerr << "smash error: alias: invalid alias format" << endl;
+void AliasCommand::execute() {
+  std::string alias_name;
+  std::string command;
+  if (!parseDefinition(this->m_cmd_line, alias_name, command)) {
+    int argc = 0;
+    char **args = extractArguments(this->m_cmd_line, &argc);
+    if (argc == 1) {
+      printAllAliases();
+    } else {
+      m_status = 1;
+      err() << "smash error: alias: invalid alias format" << endl;
+    }
     deleteArguments(args);
     return;
   }
 
-  std::string input = _trim(std::string(this->m_cmd_line));
-  size_t alias_start = input.find(' ') + 1; // Skip "alias "
-  size_t equal_pos = input.find('=');
-  
-  // Extract alias name
-  std::string alias_name = input.substr(alias_start, equal_pos - alias_start);
-  
-  // Extract command (with quotes)
-  std::string commandWithQuotes = input.substr(equal_pos + 1);
-  
-  // Remove surrounding single quotes
-  std::string command = commandWithQuotes.substr(1, commandWithQuotes.length() - 2);
-
   // Check if alias name is valid and not taken
   if (!checkAliasName(alias_name)) {
-    cerr << "smash error: alias " << alias_name << " already exists or is a reserved command" << endl;
-    deleteArguments(args);
+    m_status = 1;
+    err() << "smash error: alias " << alias_name << " already exists or is a reserved command" << endl;
     return;
   }
 
   // Add alias to the list in SmallShell
   SmallShell::getInstance().addAlias(alias_name, command);
-  deleteArguments(args);
-  return;
 }
 
 
@@ -606,14 +1111,16 @@ void UnAliasCommand::execute() {
   SmallShell &smash = SmallShell::getInstance();
   
   if (argc == 1) {
-    cerr << "smash error: unalias: not enough arguments" << endl;
+    m_status = 1;
+    err() << "smash error: unalias: not enough arguments" << endl;
     deleteArguments(args);
     return;
   }
 
   for (int i = 1; i < argc; ++i) {
     if (!smash.isAliasNameTaken(args[i])) {
-      cerr << "smash error: unalias: " << args[i] << " alias does not exist" << endl;
+      m_status = 1;
+      err() << "smash error: unalias: " << args[i] << " alias does not exist" << endl;
       deleteArguments(args);
       return;
     }
@@ -625,41 +1132,370 @@ void UnAliasCommand::execute() {
 //-------------------------------------UnSetEnvCommand-------------------------------------
 UnSetEnvCommand::UnSetEnvCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
 
-extern char **environ;
-
 void UnSetEnvCommand::execute() {
   int argc = 0;
   char **args = extractArguments(this->m_cmd_line, &argc);
 
   if (argc == 1) {
-    cerr << "smash error: unsetenv: not enough arguments" << endl;
+    m_status = 1;
+    err() << "smash error: unsetenv: not enough arguments" << endl;
     deleteArguments(args);
     return;
   }
 
+  VariableStore &variables = SmallShell::getInstance().getVariables();
   for (int i = 1; i < argc; ++i) {
-    const char* var_name = args[i];
-    size_t name_len = strlen(var_name);
-
-    bool found = false;
-    for (int j = 0; environ[j]; ++j) {
-      if (strncmp(environ[j], var_name, name_len) == 0 && environ[j][name_len] == '=') {
-        // Shift the remaining pointers left
-        while (environ[j]) {
-          environ[j] = environ[j + 1];
-          ++j;
-        }
-        found = true;
-        break;
-      }
+    if (!variables.unset(args[i])) {
+      m_status = 1;
+      err() << "smash error: unsetenv: " << args[i] << " does not exist" << endl;
+    }
+  }
+  deleteArguments(args);
+}
+
+//-------------------------------------SetEnvCommand-------------------------------------
+SetEnvCommand::SetEnvCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void SetEnvCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+  VariableStore &variables = SmallShell::getInstance().getVariables();
+
+  if (argc == 1) {
+    variables.print(out(), true);
+  } else if (argc > 3) {
+    m_status = 1;
+    err() << "smash error: setenv: too many arguments" << endl;
+  } else if (!VariableStore::isValidName(args[1])) {
+    m_status = 1;
+    err() << "smash error: setenv: " << args[1] << " is not a valid name" << endl;
+  } else {
+    variables.set(args[1], argc == 3 ? args[2] : "", true);
+  }
+  deleteArguments(args);
+}
+
+//-------------------------------------ExportCommand-------------------------------------
+ExportCommand::ExportCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void ExportCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+  VariableStore &variables = SmallShell::getInstance().getVariables();
+
+  if (argc == 1) {
+    variables.print(out(), true);
+  }
+  // export NAME=VALUE ... or export NAME ...
+  for (int i = 1; i < argc; ++i) {
+    const char *eq = strchr(args[i], '=');
+    size_t length = eq ? static_cast<size_t>(eq - args[i]) : strlen(args[i]);
+    if (!VariableStore::isValidName(args[i], length)) {
+      m_status = 1;
+      err() << "smash error: export: " << args[i] << " is not a valid name" << endl;
+      continue;
+    }
+    if (eq) {
+      variables.set(std::string(args[i], length), eq + 1, true);
+    } else {
+      variables.exportName(args[i]);
+    }
+  }
+  deleteArguments(args);
+}
+
+//-------------------------------------SetCommand-------------------------------------
+SetCommand::SetCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void SetCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+  VariableStore &variables = SmallShell::getInstance().getVariables();
+
+  if (argc == 1) {
+    variables.print(out(), false);
+  }
+  // set NAME=VALUE ...: shell variables, exported only if they already were
+  for (int i = 1; i < argc; ++i) {
+    const char *eq = strchr(args[i], '=');
+    if (eq == nullptr || !VariableStore::isValidName(args[i], eq - args[i])) {
+      m_status = 1;
+      err() << "smash error: set: invalid arguments" << endl;
+      break;
+    }
+    variables.set(std::string(args[i], eq - args[i]), eq + 1);
+  }
+  deleteArguments(args);
+}
+
+//-------------------------------------HistoryCommand-------------------------------------
+HistoryCommand::HistoryCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void HistoryCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+  History &history = SmallShell::getInstance().getHistory();
+
+  // history, history N (the last N), history -s TEXT (entries containing it)
+  if (argc == 1) {
+    history.print(out(), 0);
+  } else if (argc == 2 && args[1][strspn(args[1], "0123456789")] == '\0' && atoi(args[1]) > 0) {
+    history.print(out(), atoi(args[1]));
+  } else if (argc == 3 && strcmp(args[1], "-s") == 0) {
+    history.printMatches(out(), args[2]);
+  } else {
+    m_status = 1;
+    err() << "smash error: history: invalid arguments" << endl;
+  }
+  deleteArguments(args);
+}
+
+//-------------------------------------TimeoutCommand-------------------------------------
+TimeoutCommand::TimeoutCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+// Accepts a signal number or a name with or without the SIG prefix. Returns -1 if unknown.
+static int _parseSignal(const char *str) {
+  if (isNumber(str) && *str) {
+    int sig = atoi(str);
+    return (sig > 0 && sig < NSIG) ? sig : -1;
+  }
+  static const struct { const char *name; int sig; } SIGNALS[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"ALRM", SIGALRM},
+    {"CONT", SIGCONT}, {"STOP", SIGSTOP}
+  };
+  if (strncmp(str, "SIG", 3) == 0) {
+    str += 3;
+  }
+  for (const auto& entry : SIGNALS) {
+    if (strcmp(str, entry.name) == 0) {
+      return entry.sig;
+    }
+  }
+  return -1;
+}
+
+void TimeoutCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+
+  // timeout [-s <signal>] <seconds> <command>
+  int signalNum = SIGKILL;
+  int durationIdx = 1;
+  if (argc > 1 && strcmp(args[1], "-s") == 0) {
+    signalNum = argc > 2 ? _parseSignal(args[2]) : -1;
+    durationIdx = 3;
+  }
+
+  char *end = nullptr;
+  double seconds = argc > durationIdx + 1 ? strtod(args[durationIdx], &end) : 0;
+  if (signalNum == -1 || argc <= durationIdx + 1 || *end != '\0' || !(seconds > 0)) {
+    m_status = 1;
+    err() << "smash error: timeout: invalid arguments" << endl;
+    deleteArguments(args);
+    return;
+  }
+  deleteArguments(args);
+
+  SmallShell &smash = SmallShell::getInstance();
+  std::string cmdLine = _trim(string(this->m_cmd_line));
+  std::string inner = _skipWords(cmdLine, durationIdx + 1);
+  smash.setPendingTimeout(seconds, signalNum, cmdLine);
+  smash.executeCommand(inner.c_str());
+  smash.clearPendingTimeout();
+}
+
+//-------------------------------------TimeCommand-------------------------------------
+TimeCommand::TimeCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+static void _addTimeval(struct timeval &into, const struct timeval &from) {
+  into.tv_sec += from.tv_sec;
+  into.tv_usec += from.tv_usec;
+  if (into.tv_usec >= 1000000) {
+    into.tv_sec++;
+    into.tv_usec -= 1000000;
+  }
+}
+
+static void _subTimeval(struct timeval &into, const struct timeval &from) {
+  into.tv_sec -= from.tv_sec;
+  into.tv_usec -= from.tv_usec;
+  if (into.tv_usec < 0) {
+    into.tv_sec--;
+    into.tv_usec += 1000000;
+  }
+}
+
+static void _addUsage(struct rusage &into, const struct rusage &from) {
+  _addTimeval(into.ru_utime, from.ru_utime);
+  _addTimeval(into.ru_stime, from.ru_stime);
+  into.ru_maxrss = std::max(into.ru_maxrss, from.ru_maxrss);
+  into.ru_minflt += from.ru_minflt;
+  into.ru_majflt += from.ru_majflt;
+}
+
+static double _seconds(const struct timeval &tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void TimeCommand::printReport(double wallSeconds, const struct rusage& usage, bool asJson) {
+  char line[256];
+  if (asJson) {
+    snprintf(line, sizeof(line),
+             "{\"real\": %.6f, \"user\": %.6f, \"sys\": %.6f, \"maxrss_kb\": %ld, "
+             "\"minor_faults\": %ld, \"major_faults\": %ld}",
+             wallSeconds, _seconds(usage.ru_utime), _seconds(usage.ru_stime),
+             usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt);
+    err() << line << endl;
+    return;
+  }
+  snprintf(line, sizeof(line), "real\t%.3fs\nuser\t%.3fs\nsys\t%.3fs\nmaxrss\t%ld KB\nfaults\t%ld minor, %ld major",
+           wallSeconds, _seconds(usage.ru_utime), _seconds(usage.ru_stime),
+           usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt);
+  err() << line << endl;
+}
+
+void TimeCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+
+  // time [-f json] <command>
+  bool asJson = false;
+  int skip = 1;
+  if (argc > 1 && strcmp(args[1], "-f") == 0) {
+    asJson = argc > 2 && strcmp(args[2], "json") == 0;
+    if (!asJson) {
+      m_status = 1;
+      err() << "smash error: time: invalid arguments" << endl;
+      deleteArguments(args);
+      return;
+    }
+    skip = 3;
+  }
+  if (argc <= skip) {
+    m_status = 1;
+    err() << "smash error: time: invalid arguments" << endl;
+    deleteArguments(args);
+    return;
+  }
+  deleteArguments(args);
+
+  SmallShell &smash = SmallShell::getInstance();
+  std::string inner = _skipWords(_trim(string(this->m_cmd_line)), skip);
+
+  // Children are charged through wait4(); work done inside the shell (built-ins,
+  // fork) through this thread's own usage.
+  struct rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  struct rusage selfBefore, selfAfter;
+  getrusage(RUSAGE_THREAD, &selfBefore);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct rusage *previous = smash.beginTiming(&usage);
+  smash.executeCommand(inner.c_str());
+  smash.endTiming(previous);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  getrusage(RUSAGE_THREAD, &selfAfter);
+
+  _subTimeval(selfAfter.ru_utime, selfBefore.ru_utime);
+  _subTimeval(selfAfter.ru_stime, selfBefore.ru_stime);
+  _addTimeval(usage.ru_utime, selfAfter.ru_utime);
+  _addTimeval(usage.ru_stime, selfAfter.ru_stime);
+  usage.ru_minflt += selfAfter.ru_minflt - selfBefore.ru_minflt;
+  usage.ru_majflt += selfAfter.ru_majflt - selfBefore.ru_majflt;
+  if (previous) {
+    _addUsage(*previous, usage);
+  }
+
+  double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printReport(wall, usage, asJson);
+}
+
+//-------------------------------------StatsCommand-------------------------------------
+StatsCommand::StatsCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void StatsCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+
+  if (argc > 2 || (argc == 2 && strcmp(args[1], "-r") != 0)) {
+    m_status = 1;
+    err() << "smash error: stats: invalid arguments" << endl;
+  } else if (argc == 2) {
+    ShellStats::getInstance().reset();
+  } else {
+    ShellStats::getInstance().print(out());
+  }
+  deleteArguments(args);
+}
+
+//-------------------------------------TraceCommand-------------------------------------
+TraceCommand::TraceCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void TraceCommand::execute() {
+  int argc = 0;
+  char **args = extractArguments(this->m_cmd_line, &argc);
+  Tracer &tracer = Tracer::getInstance();
+
+  // trace on <file> | trace off
+  if (argc == 3 && strcmp(args[1], "on") == 0) {
+    if (tracer.enabled() && !tracer.stop()) {
+      perror("smash error: trace: write failed");
+      m_status = 1;
     }
-    if (!found) {
-      cerr << "smash error: unsetenv: " << var_name << " does not exist" << endl;
+    // Written by "trace off" or at exit, when the session may be elsewhere
+    string path = args[2][0] == '/' ? args[2] : SmallShell::getInstance().getCurrDir() + "/" + args[2];
+    tracer.start(path);
+  } else if (argc == 2 && strcmp(args[1], "off") == 0) {
+    if (!tracer.stop()) {
+      perror("smash error: trace: write failed");
+      m_status = 1;
     }
+  } else {
+    m_status = 1;
+    err() << "smash error: trace: invalid arguments" << endl;
   }
   deleteArguments(args);
 }
 
+//-------------------------------------PerfStatCommand-------------------------------------
+PerfStatCommand::PerfStatCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void PerfStatCommand::execute() {
+  std::string inner = _skipWords(_trim(string(this->m_cmd_line)), 1);
+  if (inner.empty()) {
+    m_status = 1;
+    err() << "smash error: perfstat: invalid arguments" << endl;
+    return;
+  }
+  // Each stage of a pipe is a process of its own: one set of counters
+  // cannot follow them all
+  if (!ListCommand::isList(inner) && _findUnquoted(inner, "|") != std::string::npos) {
+    m_status = 1;
+    err() << "smash error: perfstat: pipelines are not supported" << endl;
+    return;
+  }
+
+  // The counters are attached by whichever path ends up running the command:
+  // the external fork in CreateCommand or the built-in path of executeCommand.
+  SmallShell &smash = SmallShell::getInstance();
+  PerfCounters counters;
+  uint64_t start = statsNow();
+  smash.setPendingPerf(&counters);
+  smash.executeCommand(inner.c_str());
+  smash.setPendingPerf(nullptr);
+  uint64_t elapsed = statsNow() - start;
+
+  if (!counters.attached()) {
+    m_status = 1;
+    err() << "smash error: perfstat: no foreground command was measured" << endl;
+    return;
+  }
+  counters.print(err(), inner.c_str(), elapsed);
+}
+
 //-------------------------------------WatchProcCommand-------------------------------------
 WatchProcCommand::WatchProcCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
 
@@ -733,7 +1569,8 @@ void WatchProcCommand::execute() {
     int argc = 0;
     char **args = extractArguments(this->m_cmd_line, &argc);
     if (argc != 2 || !isNumber(args[1])) {
-        cerr << "smash error: watchproc: invalid arguments" << endl;
+        m_status = 1;
+        err() << "smash error: watchproc: invalid arguments" << endl;
         deleteArguments(args);
         return;
     }
@@ -760,7 +1597,10 @@ void WatchProcCommand::execute() {
             sys0 = buf;
         }
 
-        sleep(1);
+        sleepUnlessCancelled(1);
+        if (isCancelled()) {
+            return;
+        }
 
         // Second CPU measurement
         std::string stat1 = readProcFile(pid, "stat");
@@ -810,9 +1650,12 @@ void WatchProcCommand::execute() {
             cpuPct = 100.0 * deltaProc / deltaTotal;
         }
 
-        printf("PID: %d | CPU Usage: %.1f%% | Memory Usage: %.1f MB\n", pid, cpuPct, memMb);
+        char line[128];
+        snprintf(line, sizeof(line), "PID: %d | CPU Usage: %.1f%% | Memory Usage: %.1f MB", pid, cpuPct, memMb);
+        out() << line << endl;
     } catch (const std::exception&) {
-        cerr << "smash error: watchproc: pid " << pid << " does not exist" << endl;
+        m_status = 1;
+        err() << "smash error: watchproc: pid " << pid << " does not exist" << endl;
     }
 }
 
@@ -835,16 +1678,16 @@ void ExternalCommand::execute() {
     bool isComplex = trimmedCmd.find("*") != string::npos || trimmedCmd.find("?") != string::npos;
 
     if (isComplex) {
-        char trimmedCommand[COMMAND_MAX_ARGS];
-        strcpy(trimmedCommand, trimmedCmd.c_str());
+        std::vector<char> trimmedCommand(trimmedCmd.begin(), trimmedCmd.end());
+        trimmedCommand.push_back('\0');
 
         char bashOption[] = "-c";
         char bashPath[] = "/bin/bash";
-        char *bashArgs[] = {bashPath, bashOption, trimmedCommand, nullptr};
+        char *bashArgs[] = {bashPath, bashOption, trimmedCommand.data(), nullptr};
 
         if (execv(bashPath, bashArgs) == -1) {
             perror("smash error: execv failed");
-            exit(0);
+            _exit(0);
         }
     } else {
         int argc = 0;
@@ -878,132 +1721,434 @@ void RedirectionCommand::execute() {
     SmallShell &smash = SmallShell::getInstance();
 
     // Copy the command line to safely modify it
-    char cmd[COMMAND_MAX_LENGTH + 1];
-    strcpy(cmd, this->m_cmd_line);
-
-    // Check for redirection operators
-    char *overwrite = strstr(cmd, ">");
-    char *append = strstr(cmd, ">>");
-
-    if (overwrite != nullptr || append != nullptr) {
-        // Determine the type of redirection
-        bool isAppend = (append != nullptr);
-        char *redirectOperator = isAppend ? append : overwrite;
-
-        // Split the command and file path
-        *redirectOperator = '\0'; // Terminate the command before the operator
-        redirectOperator += isAppend ? 2 : 1; // Move past the operator
-        std::string trimmedFilePath = _trim(std::string(redirectOperator));
-        const char *filePath = trimmedFilePath.c_str();
-
-        // Save the original STDOUT
-        int originalStdout = dup(STDOUT_FILENO);
-        if (originalStdout == -1) {
-            perror("smash error: dup failed");
-            return;
+    std::vector<char> copy(m_cmd_line, m_cmd_line + strlen(m_cmd_line) + 1);
+    char *cmd = copy.data();
+
+    // "cmd > file &" backgrounds cmd: keep the & off the file name and pass it on
+    bool isBackground = _isBackgroundComamnd(cmd);
+    _removeBackgroundSign(cmd);
+
+    uint64_t parseStart = statsNow();
+    RedirectionList redirections;
+    std::string command;
+    std::string error;
+    if (!redirections.parse(cmd, command, error)) {
+        m_status = 1;
+        err() << "smash error: " << error << endl;
+        return;
+    }
+    Tracer::getInstance().complete("redirect", "io", parseStart, statsNow(), cmd);
+
+    // Those already pending (a session's pipes, a substitution's capture)
+    // go first, as for a pipe, then the command's own
+    const RedirectionList *outer = smash.takePendingRedirections();
+    RedirectionList merged;
+    if (outer) {
+        merged = *outer;
+    }
+    merged.append(redirections);
+
+    // The shell's own fds are left alone: whatever runs picks the list up
+    std::string innerCmd = _trim(command) + (isBackground ? " &" : "");
+    smash.setPendingRedirections(&merged);
+    smash.executeCommand(innerCmd.c_str());
+    smash.setPendingRedirections(nullptr);
+}
+
+//-------------------------------------ListCommand-------------------------------------
+
+ListCommand::ListCommand(const char *cmd_line) : Command(cmd_line) {}
+
+bool ListCommand::parse(const std::string &cmdLine, std::vector<Element> &elements, bool &background,
+                        std::string &error)
+{
+    elements.clear();
+    std::string line = _trim(cmdLine);
+    background = false;
+    // A single trailing '&' backgrounds the whole list ("&&" does not)
+    if (line.size() >= 1 && line[line.size() - 1] == '&' && (line.size() < 2 || line[line.size() - 2] != '&')) {
+        background = true;
+        line = _trim(line.substr(0, line.size() - 1));
+    }
+
+    Connector connector = SEQUENCE;
+    std::string current;
+    char quote = 0;
+    for (size_t i = 0; i <= line.size(); ++i) {
+        char c = i < line.size() ? line[i] : '\0';
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+            current += c;
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            quote = c;
+            current += c;
+            continue;
+        }
+        if (c == '$' && i + 1 < line.size() && line[i + 1] == '(') {
+            // "$(a; b)" is one command: its list is split when it runs
+            size_t end = _substitutionEnd(line, i);
+            if (end == std::string::npos) {
+                end = line.size() - 1;
+            }
+            current += line.substr(i, end - i + 1);
+            i = end;
+            continue;
+        }
+        Connector next;
+        if (c == ';') {
+            next = SEQUENCE;
+        } else if (c == '&' && i + 1 < line.size() && line[i + 1] == '&') {
+            next = AND;
+        } else if (c == '|' && i + 1 < line.size() && line[i + 1] == '|') {
+            next = OR;
+        } else if (c != '\0') {
+            current += c;
+            continue;
+        } else {
+            next = SEQUENCE;
         }
 
-        // Redirect output to the specified file
-        int fd = open(filePath, O_WRONLY | O_CREAT | (isAppend ? O_APPEND : O_TRUNC), 0666);
-        if (fd == -1) {
-            perror("smash error: open failed");
-            return;
+        std::string cmd = _trim(current);
+        if (cmd.empty()) {
+            // "a;" is fine, "a &&", "; a" and "a && ; b" are not
+            bool trailingSequence = c == '\0' && !elements.empty() && connector == SEQUENCE;
+            if (!trailingSequence) {
+                error = c == '\0' ? "syntax error near end of line" :
+                        string("syntax error near '") + (next == SEQUENCE ? ";" : next == AND ? "&&" : "||") + "'";
+                return false;
+            }
+        } else {
+            Element element = {connector, cmd};
+            elements.push_back(element);
+        }
+        connector = next;
+        current.clear();
+        if (next != SEQUENCE) {
+            ++i;
         }
+    }
+    return true;
+}
 
-        if (dup2(fd, STDOUT_FILENO) == -1) {
-            perror("smash error: dup2 failed");
-            close(fd);
-            return;
+bool ListCommand::isList(const std::string &cmdLine)
+{
+    char quote = 0;
+    for (size_t i = 0; i < cmdLine.size(); ++i) {
+        char c = cmdLine[i];
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '$' && i + 1 < cmdLine.size() && cmdLine[i + 1] == '(') {
+            size_t end = _substitutionEnd(cmdLine, i);
+            if (end == std::string::npos) {
+                return false;
+            }
+            i = end;
+        } else if (c == ';' || ((c == '&' || c == '|') && i + 1 < cmdLine.size() && cmdLine[i + 1] == c)) {
+            return true;
         }
+    }
+    return false;
+}
 
-        close(fd);
+void ListCommand::runElements(const std::vector<Element> &elements, const RedirectionList *redirections)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    bool ran = false;
+    for (const Element &element : elements) {
+        int status = smash.getLastStatus();
+        // A skipped command leaves the status alone: "false && a || b" runs b
+        if (ran && element.connector == AND && status != 0) {
+            continue;
+        }
+        if (ran && element.connector == OR && status == 0) {
+            continue;
+        }
+        ran = true;
+        // Expanded only now, so "a && echo $(b)" does not run b when a fails
+        std::string cmdLine;
+        if (!smash.expandSubstitutions(element.cmdLine, cmdLine)) {
+            continue;
+        }
+        smash.setPendingRedirections(redirections);
+        smash.executeCommand(cmdLine.c_str());
+        smash.setPendingRedirections(nullptr);
+    }
+}
 
-        // Execute the command
-        smash.executeCommand(_trim(std::string(cmd)).c_str());
+void ListCommand::execute()
+{
+    // Redirections of a whole list (from "$(a; b)") apply to each command
+    SmallShell &smash = SmallShell::getInstance();
+    const RedirectionList *redirections = smash.takePendingRedirections();
+    std::vector<Element> elements;
+    bool background;
+    std::string error;
+    if (!parse(m_cmd_line, elements, background, error)) {
+        m_status = 1;
+        err() << "smash error: " << error << endl;
+        return;
+    }
+    if (!background) {
+        runElements(elements, redirections);
+        return;
+    }
 
-        // Restore the original STDOUT
-        if (dup2(originalStdout, STDOUT_FILENO) == -1) {
-            perror("smash error: dup2 restore failed");
+    // "a && b &": a copy of the shell runs the list as one job
+    int logPipe[2];
+    std::shared_ptr<JobLog> log = smash.openJobLog(logPipe);
+    smash.flushOutput();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("smash error: fork failed");
+        if (log) {
+            close(logPipe[0]);
+            close(logPipe[1]);
+        }
+        m_status = 1;
+        return;
+    }
+    if (pid == 0) {
+        if (setpgrp() == -1) {
+            perror("smash error: setpgrp failed");
+        }
+        // The copy is a job kill and timeout must reach, whatever thread forked it
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+        if (log) {
+            dup2(logPipe[1], STDOUT_FILENO);
+            dup2(logPipe[1], STDERR_FILENO);
+            close(logPipe[0]);
+            close(logPipe[1]);
         }
-        close(originalStdout);
+        signal(SIGINT, SIG_DFL);
+        runElements(elements, redirections);
+        smash.flushOutput();
+        // _exit: atexit handlers (the trace file) belong to the real shell
+        _exit(smash.getLastStatus());
     }
+    ShellStats::getInstance().count(STAT_BACKGROUND);
+    if (log) {
+        close(logPipe[1]);
+        JobLogDrainer::getInstance().attach(logPipe[0], log);
+    }
+    smash.getAllJobs()->addJob(_trim(string(m_cmd_line)).c_str(), pid, false, 0, log);
 }
 
 //--------------------------------------------------------Pipe----------------------------------------------------------
 
+// A pipe stage that can run inside the shell, or nullptr. Only commands
+// that do nothing but read input and write output qualify.
+static Command *_streamCommand(const string &cmdLine) {
+    string trimmed = _trim(cmdLine);
+    string first = trimmed.substr(0, trimmed.find_first_of(WHITESPACE));
+    if (first == "wc" && WordCountCommand::handles(trimmed)) {
+        return new WordCountCommand(trimmed.c_str());
+    }
+    if ((first == "grep" || first == "fgrep") && FixedGrepCommand::handles(trimmed)) {
+        return new FixedGrepCommand(trimmed.c_str());
+    }
+    return nullptr;
+}
+
 PipeCommand::PipeCommand(const char *cmd_line) : Command(cmd_line) {}
 
 void PipeCommand::execute() {
     // Enhanced parsing for | and |& pipe types
     string fullCmd = this->m_cmd_line;
     bool stderrPipe = false;
-    size_t pipeIndex = fullCmd.find("|&");
+    size_t pipeIndex = _findUnquoted(fullCmd, "|&");
     if (pipeIndex != string::npos) {
         stderrPipe = true;
     } else {
-        pipeIndex = fullCmd.find('|');
+        pipeIndex = _findUnquoted(fullCmd, "|");
     }
     string first = fullCmd.substr(0, pipeIndex);
     string sec   = fullCmd.substr(pipeIndex + (stderrPipe ? 2 : 1));
 
+    // Redirections of the whole pipe (from "$(a | b)") go first, then the
+    // pipe itself, then those of the stage
+    const RedirectionList *outer = SmallShell::getInstance().takePendingRedirections();
+    RedirectionList firstRedirections;
+    RedirectionList secRedirections;
+    string firstCmd;
+    string secCmd;
+    string error;
+    if (!firstRedirections.parse(first, firstCmd, error) || !secRedirections.parse(sec, secCmd, error)) {
+        m_status = 1;
+        err() << "smash error: " << error << endl;
+        return;
+    }
+
+    // wc and grep run as a stage in the shell itself: the first stage on a
+    // thread of its own, the second on this one. Other stages fork as before.
+    SmallShell &smash = SmallShell::getInstance();
+    std::unique_ptr<Command> firstBuiltin(stderrPipe || !firstRedirections.empty() ? nullptr : _streamCommand(firstCmd));
+    std::unique_ptr<Command> secBuiltin(secRedirections.empty() ? _streamCommand(secCmd) : nullptr);
+    std::unique_ptr<BuiltinRedirection> outerStreams;
+    if (outer && (firstBuiltin || secBuiltin)) {
+        outerStreams.reset(new BuiltinRedirection(*outer, smash.getCwdFd()));
+        if (!outerStreams->ok()) {
+            m_status = 1;
+            return;
+        }
+    }
+
     int my_pipe[2];
-    if (pipe(my_pipe) == -1) {
+    if (pipe2(my_pipe, O_CLOEXEC) == -1) {
         perror("smash error: pipe failed");
+        m_status = 1;
         return;
     }
 
-    pid_t pid1 = fork();
-    if (pid1 == 0) { // First child process
+    ShellStats &stats = ShellStats::getInstance();
+    Tracer &tracer = Tracer::getInstance();
+    smash.flushOutput();
+    smash.prepareChild();
+    uint64_t forkStart = statsNow();
+    uint64_t firstStart = forkStart;
+    pid_t pid1 = firstBuiltin ? 0 : fork();
+    if (pid1 > 0) {
+        stats.record(STAT_FORK, statsNow() - forkStart);
+        tracer.complete("fork", "process", forkStart, statsNow(), first.c_str());
+    }
+    if (pid1 == 0 && !firstBuiltin) { // First child process
+        smash.enterChild();
         if (setpgrp() == -1) {
             perror("smash error: setpgrp failed");
-            exit(1);
+            _exit(1);
+        }
+        if (outer && !outer->apply()) {
+            _exit(1);
         }
         if (dup2(my_pipe[1], stderrPipe ? STDERR_FILENO : STDOUT_FILENO) == -1) {
             perror("smash error: dup2 failed");
-            exit(1);
+            _exit(1);
         }
         close(my_pipe[0]);
         close(my_pipe[1]);
+        if (!firstRedirections.apply()) {
+            _exit(1);
+        }
 
-        char *args1[COMMAND_MAX_ARGS];
-        _parseCommandLine(first.c_str(), args1); // Parse arguments
+        char *args1[COMMAND_MAX_ARGS + 1];
+        _parseCommandLine(firstCmd.c_str(), args1); // Parse arguments
         if (execvp(args1[0], args1) == -1) {
             perror("smash error: execvp failed");
-            exit(1);
+            _exit(1);
         }
     }
 
-    pid_t pid2 = fork();
-    if (pid2 == 0) { // Second child process
+    forkStart = statsNow();
+    uint64_t secStart = forkStart;
+    pid_t pid2 = secBuiltin ? 0 : fork();
+    if (pid2 > 0) {
+        stats.record(STAT_FORK, statsNow() - forkStart);
+        tracer.complete("fork", "process", forkStart, statsNow(), sec.c_str());
+    }
+    if (pid2 == 0 && !secBuiltin) { // Second child process
+        smash.enterChild();
         if (setpgrp() == -1) {
             perror("smash error: setpgrp failed");
-            exit(1);
+            _exit(1);
+        }
+        if (outer && !outer->apply()) {
+            _exit(1);
         }
         if (dup2(my_pipe[0], STDIN_FILENO) == -1) {
             perror("smash error: dup2 failed");
-            exit(1);
+            _exit(1);
         }
         close(my_pipe[0]);
         close(my_pipe[1]);
+        if (!secRedirections.apply()) {
+            _exit(1);
+        }
 
-        char *args2[COMMAND_MAX_ARGS];
-        _parseCommandLine(sec.c_str(), args2); // Parse arguments
+        char *args2[COMMAND_MAX_ARGS + 1];
+        _parseCommandLine(secCmd.c_str(), args2); // Parse arguments
         if (execvp(args2[0], args2) == -1) {
             perror("smash error: execvp failed");
-            exit(1);
+            _exit(1);
         }
     }
 
-    // Parent process
+    // Parent process. Built-in stages stop on ctrl-C like any built-in.
+    std::atomic<bool> cancelled(false);
+    std::atomic<bool> *outerCancel = nullptr;
+    if (firstBuiltin || secBuiltin) {
+        outerCancel = smash.m_foregroundCancel.exchange(&cancelled);
+    }
+    std::thread firstThread;
+    if (firstBuiltin) {
+        firstBuiltin->setCancelToken(&cancelled);
+        firstBuiltin->setInput(outerStreams ? outerStreams->inFd() : STDIN_FILENO);
+        int errFd = outerStreams ? outerStreams->errFd() : STDERR_FILENO;
+        Command *cmd = firstBuiltin.get();
+        int outFd = my_pipe[1];
+        // No signals on this thread: a reader that went away is EPIPE, not
+        // SIGPIPE for the whole shell
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        firstThread = std::thread([cmd, outFd, errFd, &smash] {
+            SmallShell *previous = SmallShell::makeCurrent(&smash);
+            {
+                FdStreamBuf outBuf(outFd, 1 << 16);
+                FdStreamBuf errBuf(errFd);
+                std::ostream outStream(&outBuf);
+                std::ostream errStream(&errBuf);
+                cmd->setOutput(&outStream, &errStream);
+                cmd->execute();
+            }
+            // End of input for the second stage
+            close(outFd);
+            SmallShell::makeCurrent(previous);
+        });
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    } else {
+        close(my_pipe[1]);
+    }
+    if (secBuiltin) {
+        secBuiltin->setCancelToken(&cancelled);
+        secBuiltin->setInput(my_pipe[0]);
+        if (outerStreams) {
+            secBuiltin->setOutput(outerStreams->out(), outerStreams->err());
+        } else {
+            secBuiltin->setOutput(m_out, m_err);
+        }
+        secBuiltin->execute();
+    }
+    // A first stage still writing gets EPIPE (or SIGPIPE) from here on
     close(my_pipe[0]);
-    close(my_pipe[1]);
 
     int status;
-    if (waitpid(pid1, &status, 0) == -1) {
+    if (firstBuiltin) {
+        firstThread.join();
+    } else if (smash.waitChild(pid1, &status, 0) == -1) {
         perror("smash error: waitpid failed");
+        m_status = 1;
     }
-    if (waitpid(pid2, &status, 0) == -1) {
+    tracer.complete("pipe stage", "pipe", firstStart, statsNow(), first.c_str());
+    if (secBuiltin) {
+        // The pipe's status is its last stage's
+        smash.recordWaitStatus(0);
+        m_status = secBuiltin->getStatus();
+    } else if (smash.waitChild(pid2, &status, 0) == -1) {
         perror("smash error: waitpid failed");
+        m_status = 1;
+    }
+    tracer.complete("pipe stage", "pipe", secStart, statsNow(), sec.c_str());
+    if (firstBuiltin || secBuiltin) {
+        smash.m_foregroundCancel = outerCancel;
     }
 }
 
@@ -1011,35 +2156,34 @@ void PipeCommand::execute() {
 
 //-------------------------------------DiskUsageCommand-------------------------------------
 
-DiskUsageCommand::DiskUsageCommand(const char* cmd_line) : Command(cmd_line) {}
+DiskUsageCommand::DiskUsageCommand(const char* cmd_line) : Command(cmd_line),
+  m_dirFd(dupCwdFd()) {}
+
+DiskUsageCommand::~DiskUsageCommand() {
+    if (m_dirFd != -1) {
+        close(m_dirFd);
+    }
+}
 
 void DiskUsageCommand::execute() {
     int argc = 0;
     char **args = extractArguments(this->m_cmd_line, &argc);
 
     if (argc > 2) {
-        cerr << "smash error: du: too many arguments" << endl;
+        m_status = 1;
+        err() << "smash error: du: too many arguments" << endl;
         deleteArguments(args);
         return;
     }
 
-    string dirPath;
-    if (argc == 1) {
-        char cwd[PATH_MAX];
-        if (!getcwd(cwd, sizeof(cwd))) {
-            perror("smash error: getcwd failed");
-            deleteArguments(args);
-            return;
-        }
-        dirPath = cwd;
-    } else {
-        dirPath = args[1];
-    }
+    // Relative paths are the session's, not the process's
+    string dirPath = argc == 1 ? "." : args[1];
     deleteArguments(args);
 
     struct stat sb;
-    if (stat(dirPath.c_str(), &sb) == -1 || !S_ISDIR(sb.st_mode)) {
-        cerr << "smash error: du: directory " << dirPath << " does not exist" << endl;
+    if (fstatat(m_dirFd, dirPath.c_str(), &sb, 0) == -1 || !S_ISDIR(sb.st_mode)) {
+        m_status = 1;
+        err() << "smash error: du: directory " << dirPath << " does not exist" << endl;
         return;
     }
 
@@ -1047,65 +2191,931 @@ void DiskUsageCommand::execute() {
     vector<string> stack;
     stack.push_back(dirPath);
 
-    while (!stack.empty()) {
+    while (!stack.empty() && !isCancelled()) {
         string current = stack.back();
         stack.pop_back();
 
-        int dirfd = open(current.c_str(), O_RDONLY | O_DIRECTORY);
+        int dirfd = openat(m_dirFd, current.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
         if (dirfd < 0) {
             perror("smash error: open directory failed");
+            m_status = 1;
             continue;
         }
 
-        const int BUF_SIZE = 8192;
-        vector<char> buf(BUF_SIZE);
-
-        while (true) {
-            int nread = syscall(SYS_getdents64, dirfd, buf.data(), BUF_SIZE);
-            if (nread == 0) break; // סוף תיקייה
-            if (nread < 0) {
-                perror("smash error: getdents64 failed");
-                break;
-            }
-
-            int bpos = 0;
-            while (bpos < nread) {
-                auto *d = reinterpret_cast<struct linux_dirent64 *>(buf.data() + bpos);
-                string name(d->d_name);
-                bpos += d->d_reclen;
-
-                if (name == "." || name == "..")
-                    continue;
-
-                string path = current + "/" + name;
-                struct stat st;
-                if (stat(path.c_str(), &st) == -1)
-                    continue;
-
-                totalBytes += st.st_blocks * 512;
-                if (S_ISDIR(st.st_mode))
-                    stack.push_back(path);
-            }
+        bool scanned = scanDirectory(dirfd, [&](const char *name, size_t, unsigned char) {
+            string path = current + "/" + name;
+            struct stat st;
+            if (fstatat(m_dirFd, path.c_str(), &st, 0) == -1)
+                return true;
+
+            totalBytes += st.st_blocks * 512;
+            if (S_ISDIR(st.st_mode))
+                stack.push_back(path);
+            return true;
+        });
+        if (!scanned) {
+            perror("smash error: getdents64 failed");
+            m_status = 1;
         }
 
         close(dirfd);
     }
 
+    if (isCancelled()) {
+        return;
+    }
+
     uint64_t totalKB = (totalBytes + 1023) / 1024;
-    cout << "Total disk usage: " << totalKB << " KB" << endl;
+    out() << "Total disk usage: " << totalKB << " KB" << '\n';
 }
 
 
+//-------------------------------------FollowCommand-------------------------------------
 
-//-------------------------------------WhoAmICommand-------------------------------------
+// Offset where the last `lines` lines of the file start, found by reading
+// it backwards a block at a time: only the tail is ever read.
+static off_t _tailStart(int fd, off_t size, unsigned long lines) {
+    const size_t BLOCK = 64 * 1024;
+    if (lines == 0) {
+        return size;
+    }
+    vector<char> buf(BLOCK);
+    unsigned long found = 0;
+    off_t end = size;
+    while (end > 0) {
+        off_t start = end > static_cast<off_t>(BLOCK) ? end - BLOCK : 0;
+        ssize_t len = pread(fd, buf.data(), end - start, start);
+        if (len <= 0) {
+            return start;
+        }
+        size_t n = len;
+        // The newline that ends the file ends its last line, it does not start one
+        if (end == size && buf[n - 1] == '\n') {
+            --n;
+        }
+        while (n > 0) {
+            const char *newline = static_cast<const char *>(memrchr(buf.data(), '\n', n));
+            if (!newline) {
+                break;
+            }
+            n = newline - buf.data();
+            if (++found == lines) {
+                return start + n + 1;
+            }
+        }
+        end = start;
+    }
+    return 0;
+}
 
-WhoAmICommand::WhoAmICommand(const char* cmd_line) : Command(cmd_line) {}
+FollowCommand::FollowCommand(const char* cmd_line) : Command(cmd_line),
+  m_dirFd(dupCwdFd()), m_lastPrinted(-1) {}
 
-void WhoAmICommand::execute() {
-    uid_t uid = getuid();
-    int fd = open("/etc/passwd", O_RDONLY);
+FollowCommand::~FollowCommand() {
+    for (const Followed &file : m_files) {
+        if (file.fd != -1) {
+            close(file.fd);
+        }
+    }
+    if (m_dirFd != -1) {
+        close(m_dirFd);
+    }
+}
+
+bool FollowCommand::open(Followed &file) {
+    file.fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file.fd == -1 || fstat(file.fd, &st) == -1) {
+        if (file.fd != -1) {
+            close(file.fd);
+            file.fd = -1;
+        }
+        return false;
+    }
+    file.dev = st.st_dev;
+    file.ino = st.st_ino;
+    file.offset = 0;
+    return true;
+}
+
+void FollowCommand::header(size_t index) {
+    if (m_files.size() < 2 || m_lastPrinted == static_cast<int>(index)) {
+        return;
+    }
+    out() << (m_lastPrinted == -1 ? "" : "\n") << "==> " << m_files[index].name << " <==\n";
+    m_lastPrinted = index;
+}
+
+void FollowCommand::readNew(size_t index) {
+    Followed &file = m_files[index];
+    char buf[65536];
+    ssize_t len;
+    while ((len = pread(file.fd, buf, sizeof(buf), file.offset)) > 0) {
+        header(index);
+        out().write(buf, len);
+        file.offset += len;
+    }
+}
+
+void FollowCommand::check(size_t index) {
+    Followed &file = m_files[index];
+    struct stat st;
+    bool exists = stat(file.path.c_str(), &st) == 0;
+    if (file.fd != -1) {
+        struct stat opened;
+        if (fstat(file.fd, &opened) == 0 && S_ISREG(opened.st_mode) && opened.st_size < file.offset) {
+            err() << "smash: follow: " << file.name << ": file truncated" << endl;
+            file.offset = 0;
+        }
+        // Whatever was written to the old file before it was replaced comes first
+        readNew(index);
+        // Renamed or deleted, it is still read: the writer may not have noticed yet
+        if (exists && (st.st_dev != file.dev || st.st_ino != file.ino)) {
+            err() << "smash: follow: " << file.name << " has been replaced; following new file" << endl;
+            close(file.fd);
+            file.fd = -1;
+        }
+    }
+    if (file.fd == -1 && exists && open(file)) {
+        readNew(index);
+    }
+}
+
+void FollowCommand::execute() {
+    int argc = 0;
+    char **args = extractArguments(this->m_cmd_line, &argc);
+    unsigned long lines = 10;
+    int first = 1;
+    bool valid = true;
+    if (argc > 1 && strcmp(args[1], "-n") == 0) {
+        valid = argc > 2 && isNumber(args[2]);
+        lines = valid ? strtoul(args[2], nullptr, 10) : 0;
+        first = 3;
+    }
+    if (!valid || first >= argc) {
+        m_status = 1;
+        err() << "smash error: follow: invalid arguments" << endl;
+        deleteArguments(args);
+        return;
+    }
+    // Relative names are the session's; inotify takes paths, so they are made absolute
+    string base = _fdPath(m_dirFd);
+    for (int i = first; i < argc; ++i) {
+        Followed file;
+        file.name = args[i];
+        file.path = args[i][0] == '/' ? file.name : base + "/" + file.name;
+        file.fd = -1;
+        file.wd = -1;
+        m_files.push_back(file);
+    }
+    deleteArguments(args);
+
+    int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd == -1) {
+        perror("smash error: follow: inotify_init1 failed");
+        m_status = 1;
+        return;
+    }
+    bool watching = false;
+    for (size_t i = 0; i < m_files.size(); ++i) {
+        Followed &file = m_files[i];
+        // The directory is watched, not the file, so a file created or
+        // renamed under the name is seen as well as writes to it
+        string dir = file.path.substr(0, file.path.rfind('/'));
+        file.wd = inotify_add_watch(inotifyFd, dir.empty() ? "/" : dir.c_str(),
+                                    IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB);
+        if (file.wd == -1) {
+            m_status = 1;
+            err() << "smash error: follow: cannot watch " << file.name << ": " << strerror(errno) << endl;
+            continue;
+        }
+        watching = true;
+        if (!open(file)) {
+            m_status = 1;
+            err() << "smash error: follow: cannot open " << file.name << ": " << strerror(errno) << endl;
+            continue;
+        }
+        header(i);
+        struct stat st;
+        if (fstat(file.fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            file.offset = _tailStart(file.fd, st.st_size, lines);
+        }
+        readNew(i);
+    }
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    vector<bool> changed(m_files.size());
+    while (watching && !isCancelled()) {
+        out().flush();
+        // Woken every so often only to notice cancellation
+        struct pollfd pfd = {inotifyFd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        fill(changed.begin(), changed.end(), false);
+        ssize_t len;
+        while ((len = read(inotifyFd, events, sizeof(events))) > 0) {
+            for (char *p = events; p < events + len;) {
+                const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+                // Anything in a file's directory may be its rotation, so each
+                // of them is looked at; a burst of events costs one look
+                for (size_t i = 0; i < m_files.size(); ++i) {
+                    if (m_files[i].wd == event->wd || (event->mask & IN_Q_OVERFLOW)) {
+                        changed[i] = true;
+                    }
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        for (size_t i = 0; i < m_files.size(); ++i) {
+            if (changed[i]) {
+                check(i);
+            }
+        }
+    }
+    out().flush();
+    close(inotifyFd);
+}
+
+
+//-------------------------------------WatchDirCommand-------------------------------------
+
+// The fd behind a built-in's stream, for a child that has to write where it does.
+static int _streamFd(std::ostream &stream, int fallback) {
+    FdStreamBuf *buf = dynamic_cast<FdStreamBuf *>(stream.rdbuf());
+    return buf ? buf->fd() : fallback;
+}
+
+WatchDirCommand::WatchDirCommand(const char* cmd_line) : Command(cmd_line),
+  m_dirFd(dupCwdFd()) {}
+
+WatchDirCommand::~WatchDirCommand() {
+    if (m_dirFd != -1) {
+        close(m_dirFd);
+    }
+}
+
+void WatchDirCommand::run(const std::string &command, const std::string &path) {
+    string line;
+    size_t pos = 0;
+    size_t brace;
+    while ((brace = command.find("{}", pos)) != string::npos) {
+        line += command.substr(pos, brace - pos) + _quoteWord(path);
+        pos = brace + 2;
+    }
+    line += command.substr(pos);
+
+    SmallShell &smash = SmallShell::getInstance();
+    out().flush();
+    m_err->flush();
+    int outFd = _streamFd(out(), STDOUT_FILENO);
+    int errFd = _streamFd(err(), STDERR_FILENO);
+    smash.prepareChild();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("smash error: fork failed");
+        m_status = 1;
+        return;
+    }
+    if (pid == 0) {
+        if (setpgrp() == -1) {
+            perror("smash error: setpgrp failed");
+        }
+        signal(SIGINT, SIG_DFL);
+        if ((outFd != STDOUT_FILENO && dup2(outFd, STDOUT_FILENO) == -1) ||
+            (errFd != STDERR_FILENO && dup2(errFd, STDERR_FILENO) == -1)) {
+            perror("smash error: dup2 failed");
+            _exit(1);
+        }
+        smash.enterChild();
+        smash.executeCommand(line.c_str());
+        smash.flushOutput();
+        cout.flush();
+        // _exit: atexit handlers (the trace file) belong to the real shell
+        _exit(smash.getLastStatus());
+    }
+    while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR) {
+    }
+}
+
+void WatchDirCommand::execute() {
+    // Quotes and all, what follows "--" is run as it was typed
+    string line = _trim(string(m_cmd_line));
+    if (_isBackgroundComamnd(line.c_str())) {
+        line = _trim(line.substr(0, line.find_last_not_of(WHITESPACE)));
+    }
+    string command;
+    size_t dashes = _findUnquoted(line, " -- ");
+    if (dashes != string::npos) {
+        command = _trim(line.substr(dashes + 4));
+        line = line.substr(0, dashes);
+    }
+    int argc = 0;
+    char **args = extractArguments(line.c_str(), &argc);
+    bool recursive = argc > 1 && strcmp(args[1], "-r") == 0;
+    int first = recursive ? 2 : 1;
+    if (argc != first + 1 || (dashes != string::npos && command.empty())) {
+        m_status = 1;
+        err() << "smash error: watchdir: invalid arguments" << endl;
+        deleteArguments(args);
+        return;
+    }
+    string dir = args[first];
+    deleteArguments(args);
+
+    // inotify takes paths, so a relative dir is made absolute
+    string path = dir[0] == '/' ? dir : _fdPath(m_dirFd) + "/" + dir;
+    DirectoryWatcher watcher;
+    if (!watcher.start(path, recursive)) {
+        m_status = 1;
+        err() << "smash error: watchdir: cannot watch " << dir << ": " << strerror(errno) << endl;
+        return;
+    }
+    size_t reported = 0;
+    string prefix = dir.back() == '/' ? dir : dir + "/";
+    vector<DirectoryWatcher::Change> changes;
+    while (!isCancelled()) {
+        if (watcher.failures() > reported) {
+            reported = watcher.failures();
+            m_status = 1;
+            err() << "smash error: watchdir: " << reported << " directories not watched: "
+                  << strerror(watcher.lastError()) << endl;
+        }
+        out().flush();
+        // Woken every so often only to notice cancellation
+        struct pollfd pfd = {watcher.fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0 || !watcher.readEvents()) {
+            continue;
+        }
+        // A burst is over once it has been quiet for a moment, or has gone on for a second
+        const int QUIET_MS = 50;
+        const uint64_t MAX_BURST_NS = 1000000000ULL;
+        uint64_t burstStart = statsNow();
+        while (statsNow() - burstStart < MAX_BURST_NS && poll(&pfd, 1, QUIET_MS) > 0) {
+            watcher.readEvents();
+        }
+        watcher.takeChanges(changes);
+        for (const DirectoryWatcher::Change &change : changes) {
+            string changed = change.path.empty() ? dir : prefix + change.path;
+            if (command.empty()) {
+                out() << DirectoryWatcher::maskNames(change.mask) << ' ' << changed << '\n';
+            } else if (!isCancelled()) {
+                run(command, changed);
+            }
+        }
+    }
+    out().flush();
+}
+
+
+
+//-------------------------------------WordCountCommand-------------------------------------
+
+WordCountCommand::WordCountCommand(const char* cmd_line) : Command(cmd_line),
+  m_dirFd(dupCwdFd()) {}
+
+WordCountCommand::~WordCountCommand() {
+    if (m_dirFd != -1) {
+        close(m_dirFd);
+    }
+}
+
+bool WordCountCommand::count(int fd, unsigned what, Counts &counts) {
+    // A mapping is counted in slices, so a killed job stops soon
+    const size_t SLICE = 64 << 20;
+    const size_t READ_SIZE = 1 << 20;
+    WordCounter counter(what);
+    uint64_t unread = 0;
+    bool done = false;
+    struct stat st;
+    off_t start = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+    // Files that report no size (/proc and co.) are read like a pipe
+    if (start >= 0 && start < st.st_size) {
+        size_t length = st.st_size - start;
+        if (what == 0) {
+            unread = length;
+            done = true;
+        } else {
+            off_t pageStart = start & ~static_cast<off_t>(sysconf(_SC_PAGESIZE) - 1);
+            size_t skip = start - pageStart;
+            void *map = mmap(nullptr, length + skip, PROT_READ, MAP_PRIVATE, fd, pageStart);
+            if (map != MAP_FAILED) {
+                madvise(map, length + skip, MADV_SEQUENTIAL);
+                const char *data = static_cast<const char *>(map) + skip;
+                for (size_t at = 0; at < length && !isCancelled(); at += SLICE) {
+                    counter.add(data + at, std::min(SLICE, length - at));
+                }
+                munmap(map, length + skip);
+                done = true;
+            }
+        }
+        // As if it had been read: a second "-" finds nothing left
+        if (done) {
+            lseek(fd, st.st_size, SEEK_SET);
+        }
+    }
+    ssize_t len = 0;
+    if (!done) {
+        if (m_buffer.empty()) {
+            m_buffer.resize(READ_SIZE);
+        }
+        while ((len = readUnlessCancelled(fd, m_buffer.data(), m_buffer.size())) > 0) {
+            counter.add(m_buffer.data(), len);
+        }
+    }
+    counts.lines = counter.lines();
+    counts.words = counter.words();
+    counts.bytes = counter.bytes() + unread;
+    counts.longest = counter.maxLineLength();
+    return len != -1;
+}
+
+bool WordCountCommand::parse(const char *cmdLine, Options &options) {
+    int argc = 0;
+    char **args = extractArguments(cmdLine, &argc);
+    options.lines = options.words = options.chars = options.bytes = options.longest = false;
+    options.files.clear();
+    bool valid = true;
+    bool optionsEnd = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!optionsEnd && strcmp(args[i], "--") == 0) {
+            optionsEnd = true;
+        } else if (!optionsEnd && strncmp(args[i], "--", 2) == 0) {
+            const char *option = args[i] + 2;
+            if (strcmp(option, "lines") == 0) {
+                options.lines = true;
+            } else if (strcmp(option, "words") == 0) {
+                options.words = true;
+            } else if (strcmp(option, "chars") == 0) {
+                options.chars = true;
+            } else if (strcmp(option, "bytes") == 0) {
+                options.bytes = true;
+            } else if (strcmp(option, "max-line-length") == 0) {
+                options.longest = true;
+            } else {
+                valid = false;
+            }
+        } else if (!optionsEnd && args[i][0] == '-' && args[i][1] != '\0') {
+            for (const char *option = args[i] + 1; *option != '\0'; ++option) {
+                switch (*option) {
+                case 'l': options.lines = true; break;
+                case 'w': options.words = true; break;
+                case 'm': options.chars = true; break;
+                case 'c': options.bytes = true; break;
+                case 'L': options.longest = true; break;
+                default: valid = false;
+                }
+            }
+        } else {
+            options.files.push_back(args[i]);
+        }
+    }
+    deleteArguments(args);
+    return valid;
+}
+
+bool WordCountCommand::handles(const std::string &cmdLine) {
+    Options options;
+    return parse(cmdLine.c_str(), options);
+}
+
+void WordCountCommand::execute() {
+    Options options;
+    if (!parse(this->m_cmd_line, options)) {
+        m_status = 1;
+        err() << "smash error: wc: invalid arguments" << endl;
+        return;
+    }
+    bool lines = options.lines;
+    bool words = options.words;
+    bool chars = options.chars;
+    bool bytes = options.bytes;
+    bool longest = options.longest;
+    vector<string> &files = options.files;
+    if (!lines && !words && !chars && !bytes && !longest) {
+        lines = words = bytes = true;
+    }
+    unsigned what = (lines ? WordCounter::LINES : 0) | (words ? WordCounter::WORDS : 0) |
+                    (longest ? WordCounter::LINE_LENGTH : 0);
+    bool named = !files.empty();
+    if (!named) {
+        files.push_back("-");
+    }
+
+    // Column width as coreutils picks it: wide enough for the total size of
+    // the regular files, at least 7 if any input is not one, and no padding
+    // at all for a single count of a single input
+    int width = 1;
+    if (files.size() > 1 || lines + words + chars + bytes + longest > 1) {
+        uint64_t regular = 0;
+        int minimum = 1;
+        for (const string &file : files) {
+            struct stat st;
+            if ((file == "-" ? fstat(in(), &st) : fstatat(m_dirFd, file.c_str(), &st, 0)) != 0) {
+                continue;
+            }
+            if (S_ISREG(st.st_mode)) {
+                regular += st.st_size;
+            } else {
+                minimum = 7;
+            }
+        }
+        for (; regular >= 10; regular /= 10) {
+            ++width;
+        }
+        width = std::max(width, minimum);
+    }
+    auto print = [&](const Counts &counts, const char *name) {
+        const bool shown[] = {lines, words, chars, bytes, longest};
+        // In the C locale a character is a byte
+        const uint64_t values[] = {counts.lines, counts.words, counts.bytes, counts.bytes, counts.longest};
+        string line;
+        char field[32];
+        for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+            if (shown[i]) {
+                snprintf(field, sizeof(field), "%*llu", width, static_cast<unsigned long long>(values[i]));
+                line += (line.empty() ? "" : " ") + string(field);
+            }
+        }
+        if (name) {
+            line += string(" ") + name;
+        }
+        out() << line << '\n';
+    };
+
+    Counts total = {0, 0, 0, 0};
+    for (const string &file : files) {
+        int fd = file == "-" ? in() : openat(m_dirFd, file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            m_status = 1;
+            err() << "smash error: wc: " << file << ": " << strerror(errno) << endl;
+            continue;
+        }
+        Counts counts;
+        bool ok = count(fd, what, counts);
+        int error = errno;
+        if (fd != in()) {
+            close(fd);
+        }
+        if (isCancelled()) {
+            return;
+        }
+        // A directory still gets its line of zeros, as with coreutils
+        if (!ok) {
+            m_status = 1;
+            err() << "smash error: wc: " << file << ": " << strerror(error) << endl;
+        }
+        print(counts, named ? file.c_str() : nullptr);
+        total.lines += counts.lines;
+        total.words += counts.words;
+        total.bytes += counts.bytes;
+        total.longest = std::max(total.longest, counts.longest);
+    }
+    if (files.size() > 1) {
+        print(total, "total");
+    }
+    out().flush();
+}
+
+
+
+//-------------------------------------FixedGrepCommand-------------------------------------
+
+static uint64_t _countNewlines(const char *begin, const char *end) {
+    WordCounter counter(WordCounter::LINES);
+    counter.add(begin, end - begin);
+    return counter.lines();
+}
+
+FixedGrepCommand::FixedGrepCommand(const char* cmd_line) : Command(cmd_line),
+  m_dirFd(dupCwdFd()), m_names(false), m_lineBase(0),
+  m_selected(0), m_binaryFrom(UINT64_MAX), m_stopped(false) {}
+
+FixedGrepCommand::~FixedGrepCommand() {
+    if (m_dirFd != -1) {
+        close(m_dirFd);
+    }
+}
+
+bool FixedGrepCommand::parse(const char *cmdLine, Options &options) {
+    int argc = 0;
+    char **args = extractArguments(cmdLine, &argc);
+    options.count = options.ignoreCase = options.numbers = options.invert = false;
+    options.fixed = argc > 0 && strcmp(args[0], "fgrep") == 0;
+    options.pattern.clear();
+    options.files.clear();
+    bool valid = true;
+    bool havePattern = false;
+    bool optionsEnd = false;
+    // Options may follow the pattern and files, as GNU grep allows
+    for (int i = 1; i < argc; ++i) {
+        if (!optionsEnd && strcmp(args[i], "--") == 0) {
+            optionsEnd = true;
+        } else if (!optionsEnd && args[i][0] == '-' && args[i][1] != '\0') {
+            for (const char *option = args[i] + 1; *option != '\0'; ++option) {
+                switch (*option) {
+                case 'c': options.count = true; break;
+                case 'i': options.ignoreCase = true; break;
+                case 'n': options.numbers = true; break;
+                case 'v': options.invert = true; break;
+                case 'F': options.fixed = true; break;
+                default: valid = false;
+                }
+            }
+        } else if (!havePattern) {
+            options.pattern = args[i];
+            havePattern = true;
+        } else {
+            options.files.push_back(args[i]);
+        }
+    }
+    deleteArguments(args);
+    return valid && havePattern;
+}
+
+bool FixedGrepCommand::handles(const std::string &cmdLine) {
+    Options options;
+    return parse(cmdLine.c_str(), options) &&
+           (options.fixed || options.pattern.find_first_of("\\.[]*^$") == std::string::npos);
+}
+
+void FixedGrepCommand::scan(Chunk &chunk) const {
+    const char *p = chunk.begin;
+    const char *end = chunk.end;
+    // -c keeps no lines
+    bool keep = !m_options.count;
+    chunk.selected = 0;
+    chunk.newlines = keep && m_options.numbers ? _countNewlines(p, end) : 0;
+    chunk.firstNul = static_cast<const char *>(memchr(p, '\0', end - p));
+    // As GNU grep does in a binary file, NUL bytes end lines as well; the
+    // string holds neither, so a match never spans two lines
+    bool nulLines = chunk.firstNul != nullptr;
+    if (!m_options.invert) {
+        // From match to match: the lines in between are never looked at
+        uint64_t number = 1;
+        const char *counted = p;
+        while (p < end) {
+            const char *match = m_searcher->find(p, end);
+            if (match == end) {
+                break;
+            }
+            const char *before = static_cast<const char *>(memrchr(p, '\n', match - p));
+            const char *after = static_cast<const char *>(memchr(match, '\n', end - match));
+            if (nulLines) {
+                before = std::max(before, static_cast<const char *>(memrchr(p, '\0', match - p)));
+                const char *nul = static_cast<const char *>(memchr(match, '\0', (after ? after : end) - match));
+                after = nul ? nul : after;
+            }
+            const char *start = before ? before + 1 : p;
+            const char *stop = after ? after : end;
+            ++chunk.selected;
+            if (keep) {
+                if (m_options.numbers) {
+                    number += _countNewlines(counted, start);
+                    counted = start;
+                }
+                Line line = {start, static_cast<size_t>(stop - start), number};
+                chunk.lines.push_back(line);
+            }
+            p = stop == end ? end : stop + 1;
+        }
+        return;
+    }
+    // -v: a line is selected unless the next match starts inside it
+    const char *match = nullptr;
+    for (uint64_t number = 1; p < end; ++number) {
+        if (!match || match < p) {
+            match = m_searcher->find(p, end);
+        }
+        if (match == end && !keep && (!nulLines || !memchr(p, '\0', end - p))) {
+            // No match left: every line to the end is selected
+            chunk.selected += _countNewlines(p, end) + (end[-1] != '\n');
+            return;
+        }
+        const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+        const char *stop = newline ? newline : end;
+        if (nulLines) {
+            const char *nul = static_cast<const char *>(memchr(p, '\0', stop - p));
+            stop = nul ? nul : stop;
+        }
+        // An empty string matches at the end of an empty line
+        if (match == end || match > stop) {
+            ++chunk.selected;
+            if (keep) {
+                Line line = {p, static_cast<size_t>(stop - p), number};
+                chunk.lines.push_back(line);
+            }
+        }
+        p = stop == end ? end : stop + 1;
+    }
+}
+
+void FixedGrepCommand::print(const Chunk &chunk, uint64_t offset, const std::string &name) {
+    const size_t FLUSH_SIZE = 1 << 16;
+    // GNU grep reads 96 KiB at a time and prints nothing of a read that
+    // holds a NUL byte
+    const uint64_t BINARY_BLOCK = 96 * 1024;
+    m_selected += chunk.selected;
+    if (m_options.count || m_stopped) {
+        return;
+    }
+    if (chunk.firstNul && m_binaryFrom == UINT64_MAX) {
+        uint64_t nul = offset + (chunk.firstNul - chunk.begin);
+        m_binaryFrom = nul - nul % BINARY_BLOCK;
+    }
+    char number[32];
+    for (const Line &line : chunk.lines) {
+        if (offset + (line.start - chunk.begin) + line.length >= m_binaryFrom) {
+            flushPending();
+            out().flush();
+            err() << "smash: grep: " << name << ": binary file matches" << endl;
+            m_stopped = true;
+            return;
+        }
+        if (m_names) {
+            m_pending += name;
+            m_pending += ':';
+        }
+        if (m_options.numbers) {
+            snprintf(number, sizeof(number), "%llu:", static_cast<unsigned long long>(m_lineBase + line.number));
+            m_pending += number;
+        }
+        m_pending.append(line.start, line.length);
+        m_pending += '\n';
+        if (m_pending.size() >= FLUSH_SIZE) {
+            flushPending();
+        }
+    }
+    m_lineBase += chunk.newlines;
+}
+
+void FixedGrepCommand::flushPending() {
+    out().write(m_pending.data(), m_pending.size());
+    m_pending.clear();
+    // Whoever reads the output is gone: stop searching for them
+    if (!out()) {
+        m_stopped = true;
+    }
+}
+
+void FixedGrepCommand::searchMapped(const char *data, size_t length, const std::string &name) {
+    const size_t CHUNK_SIZE = 16 << 20;
+    const unsigned MAX_THREADS = 8;
+    unsigned threads = std::max(1u, std::min(MAX_THREADS, std::thread::hardware_concurrency()));
+    const char *end = data + length;
+    const char *p = data;
+    while (p < end && !m_stopped && !isCancelled()) {
+        // A round: one chunk per thread, each ending after a newline
+        std::vector<Chunk> chunks;
+        while (chunks.size() < threads && p < end) {
+            const char *stop = p + std::min(CHUNK_SIZE, static_cast<size_t>(end - p));
+            const char *newline = stop < end ? static_cast<const char *>(memchr(stop, '\n', end - stop)) : nullptr;
+            stop = stop == end || !newline ? end : newline + 1;
+            Chunk chunk;
+            chunk.begin = p;
+            chunk.end = stop;
+            chunks.push_back(chunk);
+            p = stop;
+        }
+        // Workers take no signals; the first chunk is this thread's
+        std::vector<std::thread> workers;
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        for (size_t i = 1; i < chunks.size(); ++i) {
+            workers.push_back(std::thread(&FixedGrepCommand::scan, this, std::ref(chunks[i])));
+        }
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        scan(chunks[0]);
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        for (const Chunk &chunk : chunks) {
+            print(chunk, chunk.begin - data, name);
+        }
+    }
+}
+
+bool FixedGrepCommand::searchStream(int fd, const std::string &name) {
+    const size_t READ_SIZE = 1 << 20;
+    if (m_buffer.size() < READ_SIZE) {
+        m_buffer.resize(READ_SIZE);
+    }
+    size_t filled = 0;
+    uint64_t offset = 0;
+    while (!m_stopped) {
+        // A line longer than the buffer makes it grow
+        if (filled == m_buffer.size()) {
+            m_buffer.resize(m_buffer.size() * 2);
+        }
+        ssize_t len = readUnlessCancelled(fd, m_buffer.data() + filled, m_buffer.size() - filled);
+        if (len == -1) {
+            return false;
+        }
+        char *data = m_buffer.data();
+        // Whole lines are searched now, the rest once it is complete
+        size_t complete = filled + len;
+        if (len > 0) {
+            const char *newline = static_cast<const char *>(memrchr(data + filled, '\n', len));
+            complete = newline ? newline + 1 - data : 0;
+        }
+        filled += len;
+        if (complete > 0) {
+            Chunk chunk;
+            chunk.begin = data;
+            chunk.end = data + complete;
+            scan(chunk);
+            print(chunk, offset, name);
+            offset += complete;
+            memmove(data, data + complete, filled - complete);
+            filled -= complete;
+        }
+        if (len == 0) {
+            break;
+        }
+    }
+    return true;
+}
+
+void FixedGrepCommand::execute() {
+    if (!parse(m_cmd_line, m_options)) {
+        err() << "smash error: grep: invalid arguments" << endl;
+        m_status = 2;
+        return;
+    }
+    m_searcher.reset(new StringSearcher(m_options.pattern, m_options.ignoreCase));
+    m_names = m_options.files.size() > 1;
+    if (m_options.files.empty()) {
+        m_options.files.push_back("-");
+    }
+    bool errors = false;
+    bool selected = false;
+    for (const string &file : m_options.files) {
+        bool input = file == "-";
+        string name = input ? "(standard input)" : file;
+        int fd = input ? in() : openat(m_dirFd, file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            err() << "smash error: grep: " << file << ": " << strerror(errno) << endl;
+            errors = true;
+            continue;
+        }
+        m_lineBase = 0;
+        m_selected = 0;
+        m_binaryFrom = UINT64_MAX;
+        m_stopped = false;
+        bool ok = true;
+        bool mapped = false;
+        struct stat st;
+        off_t start = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+        if (start >= 0 && start < st.st_size) {
+            off_t pageStart = start & ~static_cast<off_t>(sysconf(_SC_PAGESIZE) - 1);
+            size_t length = st.st_size - pageStart;
+            void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, pageStart);
+            if (map != MAP_FAILED) {
+                madvise(map, length, MADV_SEQUENTIAL);
+                searchMapped(static_cast<const char *>(map) + (start - pageStart), st.st_size - start, name);
+                munmap(map, length);
+                lseek(fd, st.st_size, SEEK_SET);
+                mapped = true;
+            }
+        }
+        if (!mapped) {
+            ok = searchStream(fd, name);
+        }
+        int error = errno;
+        if (!input) {
+            close(fd);
+        }
+        if (isCancelled()) {
+            return;
+        }
+        if (!ok) {
+            err() << "smash error: grep: " << name << ": " << strerror(error) << endl;
+            errors = true;
+        }
+        if (m_options.count) {
+            m_pending += m_names ? name + ":" : string();
+            m_pending += std::to_string(m_selected) + "\n";
+        }
+        flushPending();
+        selected = selected || m_selected > 0;
+    }
+    out().flush();
+    m_status = errors ? 2 : (selected ? 0 : 1);
+}
+
+
+
+//-------------------------------------WhoAmICommand-------------------------------------
+
+WhoAmICommand::WhoAmICommand(const char* cmd_line) : Command(cmd_line) {}
+
+void WhoAmICommand::execute() {
+    uid_t uid = getuid();
+    int fd = open("/etc/passwd", O_RDONLY);
     if (fd == -1) {
         perror("smash error: whoami: open failed");
+        m_status = 1;
         return;
     }
     const size_t BUF_SIZE = 1024;
@@ -1125,14 +3135,15 @@ void WhoAmICommand::execute() {
                 fields.push_back(field);
             }
             if (fields.size() >= 6 && static_cast<uid_t>(std::stoi(fields[2])) == uid) {
-                std::cout << fields[0] << " " << fields[5] << std::endl;
+                out() << fields[0] << " " << fields[5] << '\n';
                 close(fd);
                 return;
             }
         }
     }
     close(fd);
-    std::cerr << "smash error: whoami: user id " << uid << " not found" << std::endl;
+    m_status = 1;
+    err() << "smash error: whoami: user id " << uid << " not found" << std::endl;
 }
 
 //-------------------------------------NetInfo-------------------------------------
@@ -1143,7 +3154,8 @@ void NetInfo::execute() {
     int argc = 0;
     char **args = extractArguments(this->m_cmd_line, &argc);
     if (argc < 2) {
-        std::cerr << "smash error: netinfo: interface not specified" << std::endl;
+        m_status = 1;
+        err() << "smash error: netinfo: interface not specified" << std::endl;
         deleteArguments(args);
         return;
     }
@@ -1154,13 +3166,15 @@ void NetInfo::execute() {
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock == -1) {
         perror("smash error: netinfo: socket failed");
+        m_status = 1;
         return;
     }
     struct ifreq ifr;
     memset(&ifr, 0, sizeof(ifr));
     strncpy(ifr.ifr_name, iface.c_str(), IFNAMSIZ - 1);
     if (ioctl(sock, SIOCGIFFLAGS, &ifr) == -1) {
-        std::cerr << "smash error: netinfo: interface " << iface << " does not exist" << std::endl;
+        m_status = 1;
+        err() << "smash error: netinfo: interface " << iface << " does not exist" << std::endl;
         close(sock);
         return;
     }
@@ -1168,24 +3182,26 @@ void NetInfo::execute() {
     // IP Address
     if (ioctl(sock, SIOCGIFADDR, &ifr) == -1) {
         perror("smash error: netinfo: SIOCGIFADDR failed");
+        m_status = 1;
         close(sock);
         return;
     }
     char ip[INET_ADDRSTRLEN];
     struct sockaddr_in *sin = (struct sockaddr_in *)&ifr.ifr_addr;
     inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
-    std::cout << "IP Address: " << ip << std::endl;
+    out() << "IP Address: " << ip << '\n';
 
     // Subnet Mask
     if (ioctl(sock, SIOCGIFNETMASK, &ifr) == -1) {
         perror("smash error: netinfo: SIOCGIFNETMASK failed");
+        m_status = 1;
         close(sock);
         return;
     }
     char mask[INET_ADDRSTRLEN];
     struct sockaddr_in *nm = (struct sockaddr_in *)&ifr.ifr_netmask;
     inet_ntop(AF_INET, &nm->sin_addr, mask, sizeof(mask));
-    std::cout << "Subnet Mask: " << mask << std::endl;
+    out() << "Subnet Mask: " << mask << '\n';
 
     close(sock);
 
@@ -1193,6 +3209,7 @@ void NetInfo::execute() {
     int fd = open("/proc/net/route", O_RDONLY);
     if (fd == -1) {
         perror("smash error: netinfo: open route failed");
+        m_status = 1;
         return;
     }
     std::string content;
@@ -1219,12 +3236,13 @@ void NetInfo::execute() {
             break;
         }
     }
-    std::cout << "Default Gateway: " << gateway << std::endl;
+    out() << "Default Gateway: " << gateway << '\n';
 
     // DNS Servers from /etc/resolv.conf
     fd = open("/etc/resolv.conf", O_RDONLY);
     if (fd == -1) {
         perror("smash error: netinfo: open resolv failed");
+        m_status = 1;
         return;
     }
     content.clear();
@@ -1242,54 +3260,126 @@ void NetInfo::execute() {
             dns.push_back(val);
         }
     }
-    std::cout << "DNS Servers: ";
+    out() << "DNS Servers: ";
     for (size_t i = 0; i < dns.size(); ++i) {
-        std::cout << dns[i] << (i + 1 < dns.size() ? ", " : "");
+        out() << dns[i] << (i + 1 < dns.size() ? ", " : "");
     }
-    std::cout << std::endl;
+    out() << std::endl;
 }
 
 //-------------------------------------SmallShell-------------------------------------
 
-SmallShell::SmallShell(): m_prompt("smash") {
-  m_prevDir = (char *)malloc((PATH_MAX + 1) * sizeof(char));
-  if (m_prevDir == nullptr)
-  {
-    free(m_prevDir);
-    cerr << "smash error: malloc failed" << endl;
-    return;
-  }
-  m_currDir = (char *)malloc((PATH_MAX + 1) * sizeof(char));
-  strcpy(m_currDir, "");
-  if (m_currDir == nullptr)
+SmallShell::SmallShell(): SmallShell(false) {}
+
+SmallShell::SmallShell(bool embedded): m_prompt("smash"), m_cwdFd(-1), m_timeoutSeconds(0), m_timeoutSignal(SIGKILL),
+  m_timedUsage(nullptr), m_spawnNs(0), m_pendingPerf(nullptr), m_lastStatus(0),
+  m_pendingRedirections(nullptr), m_executeDepth(0), m_childEnv(nullptr), m_embedded(embedded), m_quit(false), m_outBuf(STDOUT_FILENO, 1 << 16),
+  m_stdoutBuf(embedded ? nullptr : cout.rdbuf(&m_outBuf)), m_foregroundPid(0), m_foregroundTask(nullptr),
+  m_foregroundTaskJobId(0), m_foregroundCancel(nullptr) {
+  // A new session starts where the process is
+  m_cwdFd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (m_cwdFd == -1)
   {
-    free(m_currDir);
-    cerr << "smash error: malloc failed" << endl;
-    return;
+    perror("smash error: open failed");
   }
-  strcpy(m_currDir, "");
 }
 
 SmallShell::~SmallShell() {
-// TODO: add your implementation
+  if (!m_embedded) {
+    flushOutput();
+    cout.rdbuf(m_stdoutBuf);
+  }
+  if (m_cwdFd != -1) {
+    close(m_cwdFd);
+  }
 }
 
 pid_t SmallShell::m_shellPid = getpid();
 
+thread_local SmallShell *SmallShell::m_current = nullptr;
+
+SmallShell *SmallShell::makeCurrent(SmallShell *shell) {
+  SmallShell *previous = m_current;
+  m_current = shell;
+  return previous;
+}
+
+bool SmallShell::isEmbedded() const {
+  return m_embedded;
+}
+
+bool SmallShell::hasQuit() const {
+  return m_quit;
+}
+
+void SmallShell::executeLines(const std::string &lines, const RedirectionList *redirections) {
+  size_t start = 0;
+  while (start <= lines.size() && !m_quit) {
+    size_t end = lines.find('\n', start);
+    if (end == std::string::npos) {
+      end = lines.size();
+    }
+    // Re-armed per line: a blank line or a parse error leaves it unconsumed
+    setPendingRedirections(redirections);
+    executeCommand(lines.substr(start, end - start).c_str());
+    setPendingRedirections(nullptr);
+    start = end + 1;
+  }
+}
+
+extern char **environ;
+
+VariableStore &SmallShell::getVariables() {
+  return m_variables;
+}
+
+History &SmallShell::getHistory() {
+  return m_history;
+}
+
+void SmallShell::prepareChild() {
+  m_childEnv = m_variables.envp();
+}
+
+void SmallShell::enterChild() {
+  // Forked from a thread that blocks every signal (the --listen executor)
+  // the mask would carry through exec: commands must get signals again
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, nullptr);
+  environ = m_childEnv;
+  if (m_cwdFd != -1 && fchdir(m_cwdFd) == -1) {
+    perror("smash error: chdir failed");
+  }
+}
+
 const std::unordered_set<std::string> SmallShell::RESERVED_COMMANDS = {
   "chprompt",
   "showpid",
   "pwd",
   "cd",
   "jobs",
+  "joblog",
   "fg",
   "kill",
   "quit",
   "alias",
   "unalias",
   "unsetenv",
+  "history",
+  "setenv",
+  "export",
+  "set",
   "watchproc",
-  "du"
+  "du",
+  "follow",
+  "watchdir",
+  "wc",
+  "timeout",
+  "time",
+  "stats",
+  "trace",
+  "perfstat"
 };
 
 std::string SmallShell::getPrompt() const
@@ -1302,20 +3392,13 @@ void SmallShell::changePrompt(const std::string& new_prompt) {
 }
 
 Command *SmallShell::CreateCommand(const char *cmd_line) {
-    // Track original user input for alias-background jobs
-    static int __aliasDepth = 0;
-    static std::string __originalCmd;
-    __aliasDepth++;
-    // On the first call, store the raw trimmed command
-    if (__aliasDepth == 1) {
-        __originalCmd = _trim(std::string(cmd_line));
-    }
+    return createCommand(cmd_line, nullptr);
+}
 
+Command *SmallShell::createCommand(const char *cmd_line, const std::string *aliasSource) {
     // Ignore empty input
     std::string raw(cmd_line);
     if (raw.find_first_not_of(WHITESPACE) == std::string::npos) {
-        __aliasDepth = 0;
-        __originalCmd.clear();
         return nullptr;
     }
 
@@ -1331,169 +3414,688 @@ Command *SmallShell::CreateCommand(const char *cmd_line) {
         }
     }
 
-    // Alias expansion: first word lookup, recursive re-dispatch
+    // Command lists split before anything else; each part is dispatched again
+    if (ListCommand::isList(raw)) {
+        return new ListCommand(raw.c_str());
+    }
+
+    // Alias expansion: the first word is replaced by its fully expanded form
+    // in one lookup, then the result is dispatched once more, unexpanded
     size_t split = noBg.find_first_of(" \n");
     std::string first = (split == std::string::npos ? noBg : noBg.substr(0, split));
-    std::string aliased;
-    if (getAliasCommand(first, aliased)) {
-        std::string newCmd = aliased + (isBackground ? " &" : "");
-        Command* result = CreateCommand(newCmd.c_str());
-        // __aliasDepth and __originalCmd managed by the deepest call
-        return result;
+    const std::string *aliased = aliasSource ? nullptr : m_aliases.resolve(first);
+    if (aliased) {
+        std::string newCmd = *aliased + (split == std::string::npos ? "" : noBg.substr(split)) +
+                             (isBackground ? " &" : "");
+        return createCommand(newCmd.c_str(), &cmdTrim);
     }
 
+    // Prefix commands wrap whatever follows them, redirections and pipes included
+    if (first == "timeout")  { return new TimeoutCommand(raw.c_str()); }
+    if (first == "time")     { return new TimeCommand(raw.c_str()); }
+    if (first == "perfstat") { return new PerfStatCommand(raw.c_str()); }
+
+    // Pipe; each stage handles its own redirections
+    if (_findUnquoted(noBg, "|") != std::string::npos) {
+        return new PipeCommand(raw.c_str());
+    }
     // I/O Redirection
-    if (noBg.find(">") != std::string::npos) {
-        __aliasDepth = 0;
-        __originalCmd.clear();
+    if (RedirectionList::contains(noBg)) {
         return new RedirectionCommand(raw.c_str());
     }
-    // Pipe
-    if (noBg.find("|") != std::string::npos) {
-        __aliasDepth = 0;
-        __originalCmd.clear();
-        return new PipeCommand(raw.c_str());
-    }
 
     // Built-in commands
-    if (first == "pwd")       { __aliasDepth = 0; __originalCmd.clear(); return new GetCurrDirCommand(raw.c_str()); }
-    else if (first == "showpid")  { __aliasDepth = 0; __originalCmd.clear(); return new ShowPidCommand(raw.c_str()); }
-    else if (first == "chprompt") { __aliasDepth = 0; __originalCmd.clear(); return new ChangePromptCommand(raw.c_str()); }
-    else if (first == "cd")       { __aliasDepth = 0; __originalCmd.clear(); return new ChangeDirCommand(raw.c_str(), &m_prevDir); }
-    else if (first == "jobs")     { __aliasDepth = 0; __originalCmd.clear(); return new JobsCommand(raw.c_str()); }
-    else if (first == "fg")       { __aliasDepth = 0; __originalCmd.clear(); return new ForegroundCommand(raw.c_str(), &jobs); }
-    else if (first == "kill")     { __aliasDepth = 0; __originalCmd.clear(); return new KillCommand(raw.c_str(), &jobs); }
-    else if (first == "quit")     { __aliasDepth = 0; __originalCmd.clear(); return new QuitCommand(raw.c_str(), &jobs); }
-    else if (first == "alias")    { __aliasDepth = 0; __originalCmd.clear(); return new AliasCommand(raw.c_str()); }
-    else if (first == "unalias")  { __aliasDepth = 0; __originalCmd.clear(); return new UnAliasCommand(raw.c_str()); }
-    else if (first == "unsetenv") { __aliasDepth = 0; __originalCmd.clear(); return new UnSetEnvCommand(raw.c_str()); }
-    else if (first == "watchproc"){ __aliasDepth = 0; __originalCmd.clear(); return new WatchProcCommand(raw.c_str()); }
-    else if (first == "du")       { __aliasDepth = 0; __originalCmd.clear(); return new DiskUsageCommand(raw.c_str()); }
-    else if (first == "whoami")   { __aliasDepth = 0; __originalCmd.clear(); return new WhoAmICommand(raw.c_str()); }
-    else if (first == "netinfo")  { __aliasDepth = 0; __originalCmd.clear(); return new NetInfo(raw.c_str()); }
+    if (first == "pwd")       { return new GetCurrDirCommand(raw.c_str()); }
+    else if (first == "showpid")  { return new ShowPidCommand(raw.c_str()); }
+    else if (first == "chprompt") { return new ChangePromptCommand(raw.c_str()); }
+    else if (first == "cd")       { return new ChangeDirCommand(raw.c_str()); }
+    else if (first == "jobs")     { return new JobsCommand(raw.c_str()); }
+    else if (first == "joblog")   { return new JobLogCommand(raw.c_str(), &jobs); }
+    else if (first == "fg")       { return new ForegroundCommand(raw.c_str(), &jobs); }
+    else if (first == "kill")     { return new KillCommand(raw.c_str(), &jobs); }
+    else if (first == "quit")     { return new QuitCommand(raw.c_str(), &jobs); }
+    else if (first == "alias")    { return new AliasCommand(raw.c_str()); }
+    else if (first == "unalias")  { return new UnAliasCommand(raw.c_str()); }
+    else if (first == "unsetenv") { return new UnSetEnvCommand(raw.c_str()); }
+    else if (first == "history")  { return new HistoryCommand(raw.c_str()); }
+    else if (first == "setenv")   { return new SetEnvCommand(raw.c_str()); }
+    else if (first == "export")   { return new ExportCommand(raw.c_str()); }
+    else if (first == "set")      { return new SetCommand(raw.c_str()); }
+    else if (first == "watchproc"){ return new WatchProcCommand(raw.c_str()); }
+    else if (first == "du")       { return new DiskUsageCommand(raw.c_str()); }
+    else if (first == "follow")   { return new FollowCommand(raw.c_str()); }
+    else if (first == "watchdir") { return new WatchDirCommand(raw.c_str()); }
+    else if (first == "wc" && WordCountCommand::handles(noBg)) {
+        return new WordCountCommand(raw.c_str());
+    }
+    else if ((first == "grep" || first == "fgrep") && FixedGrepCommand::handles(noBg)) {
+        return new FixedGrepCommand(raw.c_str());
+    }
+    else if (first == "whoami")   { return new WhoAmICommand(raw.c_str()); }
+    else if (first == "netinfo")  { return new NetInfo(raw.c_str()); }
+    else if (first == "stats")    { return new StatsCommand(raw.c_str()); }
+    else if (first == "trace")    { return new TraceCommand(raw.c_str()); }
 
     // External command: spawn child, set process group, exec
+    ShellStats &stats = ShellStats::getInstance();
+    stats.count(STAT_EXTERNALS);
+    // perfstat: the child waits on syncPipe until its counters are attached
+    PerfCounters *perf = isBackground ? nullptr : m_pendingPerf;
+    m_pendingPerf = nullptr;
+    const RedirectionList *redirections = takePendingRedirections();
+    int syncPipe[2] = {-1, -1};
+    if (perf && pipe(syncPipe) == -1) {
+        perror("smash error: pipe failed");
+        perf = nullptr;
+    }
+    int logPipe[2];
+    std::shared_ptr<JobLog> log = isBackground ? openJobLog(logPipe) : nullptr;
+    // The child would otherwise inherit (and later repeat) buffered output
+    flushOutput();
+    prepareChild();
+    uint64_t forkStart = statsNow();
     pid_t pid = fork();
+    uint64_t forkEnd = statsNow();
     if (pid < 0) {
+        stats.count(STAT_FORK_FAILURES);
         perror("smash error: fork failed");
-        __aliasDepth = 0;
-        __originalCmd.clear();
+        if (perf) {
+            close(syncPipe[0]);
+            close(syncPipe[1]);
+        }
+        if (log) {
+            close(logPipe[0]);
+            close(logPipe[1]);
+        }
         return nullptr;
     }
     if (pid == 0) {
         // Child
+        enterChild();
         if (setpgrp() == -1) {
             perror("smash error: setpgrp failed");
         }
+        // Its own redirections still win over the capture
+        if (log && (dup2(logPipe[1], STDOUT_FILENO) == -1 || dup2(logPipe[1], STDERR_FILENO) == -1)) {
+            perror("smash error: dup2 failed");
+            _exit(1);
+        }
+        if (redirections && !redirections->apply()) {
+            _exit(1);
+        }
+        if (perf) {
+            char ready;
+            close(syncPipe[1]);
+            while (read(syncPipe[0], &ready, 1) == -1 && errno == EINTR) {
+            }
+            close(syncPipe[0]);
+        }
         // exec in-place
         ExternalCommand ext(raw.c_str());
         ext.execute();
-        exit(1);
+        _exit(1);
     } else {
         // Parent
+        Tracer &tracer = Tracer::getInstance();
+        stats.record(STAT_FORK, forkEnd - forkStart);
+        tracer.complete("fork", "process", forkStart, forkEnd, cmdTrim.c_str());
+        if (perf) {
+            close(syncPipe[0]);
+            if (!perf->attachBeforeExec(pid)) {
+                perror("smash error: perfstat: perf_event_open failed");
+            }
+            close(syncPipe[1]); // lets the child exec
+        }
+        std::string timeoutCmd = m_timeoutCmdLine;
+        unsigned long timerId = armPendingTimeout(pid);
         if (!isBackground) {
           m_foregroundPid = pid;
           int status;
-          waitpid(pid, &status, WUNTRACED);
+          waitChild(pid, &status, WUNTRACED);
           m_foregroundPid = 0;
+          TimerWheel::getInstance().cancel(timerId);
+          uint64_t reaped = statsNow();
+          stats.record(STAT_EXEC, reaped - forkEnd);
+          tracer.complete("exec", "process", forkEnd, reaped, cmdTrim.c_str());
+          m_spawnNs += reaped - forkStart;
         } else {
+            stats.count(STAT_BACKGROUND);
+            m_spawnNs += forkEnd - forkStart;
             // If alias-expanded background, show the original user input
-            const char* jobCmd = (__aliasDepth > 1 ? __originalCmd.c_str() : cmdTrim.c_str());
-            jobs.addJob(jobCmd, pid);
+            const char* jobCmd = (aliasSource ? aliasSource->c_str() : cmdTrim.c_str());
+            if (timerId) {
+              jobCmd = timeoutCmd.c_str();
+            }
+            if (log) {
+                close(logPipe[1]);
+                JobLogDrainer::getInstance().attach(logPipe[0], log);
+            }
+            jobs.addJob(jobCmd, pid, false, timerId, log);
         }
-        // Reset alias tracking after job registration
-        __aliasDepth = 0;
-        __originalCmd.clear();
         return nullptr;
     }
 }
 
+std::shared_ptr<JobLog> SmallShell::openJobLog(int fds[2]) {
+  const size_t DEFAULT_SIZE = 64 * 1024;
+  const size_t MAX_SIZE = 64 * 1024 * 1024;
+  const std::string *setting = m_variables.find("JOBLOG");
+  if (!setting || setting->empty()) {
+    return nullptr;
+  }
+  char *end;
+  unsigned long size = strtoul(setting->c_str(), &end, 10);
+  if (*end != '\0') {
+    size = DEFAULT_SIZE;
+  }
+  if (size == 0 || !JobLogDrainer::getInstance().usable()) {
+    return nullptr;
+  }
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    perror("smash error: pipe failed");
+    return nullptr;
+  }
+  return std::make_shared<JobLog>(std::min<size_t>(size, MAX_SIZE));
+}
+
 void SmallShell::executeCommand(const char *cmd_line) {
+  // Only text typed by the user is expanded: what wrappers and redirections
+  // pass on was expanded already, and captured output is never re-run.
+  // Lists expand each command just before running it.
+  bool expand = m_executeDepth == 0 && strstr(cmd_line, "$(") != nullptr && !ListCommand::isList(cmd_line);
+  std::string expanded;
+  ++m_executeDepth;
+  if (!expand || expandSubstitutions(cmd_line, expanded))
+  {
+    runCommand(expand ? expanded.c_str() : cmd_line);
+  }
+  --m_executeDepth;
+}
+
+void SmallShell::runCommand(const char *cmd_line) {
+  TraceSpan span("executeCommand", "command", cmd_line);
+  ShellStats &stats = ShellStats::getInstance();
+  stats.count(STAT_COMMANDS);
+  uint64_t parseStart = statsNow();
+  m_spawnNs = 0;
+  if (cmd_line[strspn(cmd_line, WHITESPACE.c_str())] != '\0')
+  {
+    // Blank lines keep the previous status, like sh
+    m_lastStatus = 0;
+  }
   Command *cmd = CreateCommand(cmd_line);
+  uint64_t parseEnd = statsNow();
+  stats.record(STAT_PARSE, parseEnd - parseStart - m_spawnNs);
+  if (m_spawnNs == 0)
+  {
+    Tracer::getInstance().complete("parse", "command", parseStart, parseEnd, cmd_line);
+  }
   if (cmd == nullptr)
   {
     delete cmd;
     return;
   }
+  bool isBuiltIn = dynamic_cast<BuiltInCommand*>(cmd) != nullptr || cmd->canRunInBackground();
+  // "builtin > file": the built-in writes to streams on the redirected fds
+  std::unique_ptr<BuiltinRedirection> redirection;
+  const RedirectionList *redirections = isBuiltIn ? takePendingRedirections() : nullptr;
+  if (redirections)
+  {
+    redirection.reset(new BuiltinRedirection(*redirections, m_cwdFd));
+    if (!redirection->ok())
+    {
+      m_lastStatus = 1;
+      delete cmd;
+      return;
+    }
+    cmd->setOutput(redirection->out(), redirection->err());
+    cmd->setInput(redirection->inFd());
+  }
+  if (cmd->canRunInBackground() && _isBackgroundComamnd(cmd_line))
+  {
+    stats.count(STAT_BACKGROUND);
+    // Long built-ins (du, watchproc, ...) run on a worker thread so the prompt comes back
+    int logPipe[2];
+    std::shared_ptr<JobLog> log = redirection ? nullptr : openJobLog(logPipe);
+    std::shared_ptr<BackgroundTask> task;
+    if (redirection)
+    {
+      task = std::make_shared<BackgroundTask>(cmd, redirection->outFd(), redirection->errFd(), redirection->inFd());
+    }
+    else if (log)
+    {
+      task = std::make_shared<BackgroundTask>(cmd, logPipe[1], logPipe[1]);
+      close(logPipe[1]);
+      JobLogDrainer::getInstance().attach(logPipe[0], log);
+    }
+    else
+    {
+      task = std::make_shared<BackgroundTask>(cmd);
+    }
+    std::string jobCmd = m_timeoutSeconds > 0 ? m_timeoutCmdLine : _trim(string(cmd_line));
+    unsigned long timerId = armPendingTimeout(task->cancelFlag(), task);
+    jobs.addJob(jobCmd.c_str(), task, timerId, log);
+    WorkerPool::getInstance().submit(task);
+    return;
+  }
+  // Built-ins are stopped through their cancellation flag, by "timeout" or ctrl-C
+  std::atomic<bool> cancelled(false);
+  std::atomic<bool> *outerCancel = nullptr;
+  unsigned long timerId = 0;
+  PerfCounters *perf = nullptr;
+  if (isBuiltIn)
+  {
+    stats.count(STAT_BUILTINS);
+    // perfstat on a built-in counts the shell's own thread while it runs
+    perf = m_pendingPerf;
+    m_pendingPerf = nullptr;
+    if (perf && !perf->attachSelf())
+    {
+      perror("smash error: perfstat: perf_event_open failed");
+    }
+    timerId = armPendingTimeout(&cancelled, nullptr);
+    cmd->setCancelToken(&cancelled);
+    outerCancel = m_foregroundCancel.exchange(&cancelled);
+  }
   cmd->execute();
+  if (isBuiltIn)
+  {
+    m_foregroundCancel = outerCancel;
+  }
+  if (perf)
+  {
+    perf->stop();
+  }
+  if (isBuiltIn)
+  {
+    uint64_t executeEnd = statsNow();
+    stats.record(STAT_BUILTIN, executeEnd - parseEnd);
+    Tracer::getInstance().complete("builtin", "command", parseEnd, executeEnd, cmd_line);
+  }
+  TimerWheel::getInstance().cancel(timerId);
+  // Wrappers (time, timeout, redirections, lists) succeed without hiding
+  // the status of what they ran
+  if (cmd->getStatus() != 0)
+  {
+    m_lastStatus = cmd->getStatus();
+  }
   if (dynamic_cast<QuitCommand*>(cmd) != nullptr)
   {
-    delete cmd;
-    exit(0);
+    if (!m_embedded)
+    {
+      delete cmd;
+      exit(0);
+    }
+    m_quit = true;
   }
   delete cmd;
 }
 
-char *SmallShell::getCurrDir() const {
-return m_currDir;
+const std::string &SmallShell::getCurrDir() {
+  if (m_currDir.empty()) {
+    m_currDir = _fdPath(m_cwdFd);
+  }
+  return m_currDir;
 }
 
-void SmallShell::setCurrDir(const char *newDir)
+const std::string &SmallShell::getPrevDir() const {
+  return m_prevDir;
+}
+
+int SmallShell::getCwdFd() const {
+  return m_cwdFd;
+}
+
+bool SmallShell::changeDir(const std::string &path) {
+  int fd = openat(m_cwdFd, path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  // An O_PATH open needs no permission on the directory; entering it needs search
+  if (fd != -1 && faccessat(m_cwdFd, path.c_str(), X_OK, 0) == -1) {
+    int saved = errno;
+    close(fd);
+    fd = -1;
+    errno = saved;
+  }
+  if (fd == -1 || (!m_embedded && fchdir(fd) == -1)) {
+    perror("smash error: chdir failed");
+    if (fd != -1) {
+      close(fd);
+    }
+    return false;
+  }
+  m_prevDir = getCurrDir();
+  close(m_cwdFd);
+  m_cwdFd = fd;
+  m_currDir = _fdPath(fd);
+  if (m_currDir.empty()) {
+    m_currDir = path[0] == '/' ? path : m_prevDir + "/" + path;
+  }
+  return true;
+}
+
+JobsList *SmallShell::getAllJobs()
 {
-strcpy(m_currDir, newDir);
+return &jobs;
 }
 
-char *SmallShell::getPrevDir() const
+void SmallShell::setPendingTimeout(double seconds, int signal, const std::string& cmdLine)
 {
-return m_prevDir;
+  m_timeoutSeconds = seconds;
+  m_timeoutSignal = signal;
+  m_timeoutCmdLine = cmdLine;
 }
 
-void SmallShell::setPrevDir()
+void SmallShell::clearPendingTimeout()
 {
-strcpy(m_prevDir, m_currDir);
+  m_timeoutSeconds = 0;
+  m_timeoutCmdLine.clear();
 }
 
-JobsList *SmallShell::getAllJobs()
+pid_t SmallShell::waitChild(pid_t pid, int *status, int options)
 {
-return &jobs;
+  flushOutput();
+  TraceSpan span("wait", "process");
+  struct rusage usage;
+  pid_t result = wait4(pid, status, options, &usage);
+  if (result > 0 && m_timedUsage != nullptr)
+  {
+    _addUsage(*m_timedUsage, usage);
+  }
+  if (result > 0)
+  {
+    recordWaitStatus(*status);
+  }
+  return result;
 }
 
+void SmallShell::recordWaitStatus(int status)
+{
+  // Same encoding as sh: the exit code, or 128 + the signal that killed/stopped it
+  if (WIFEXITED(status))
+    m_lastStatus = WEXITSTATUS(status);
+  else if (WIFSIGNALED(status))
+    m_lastStatus = 128 + WTERMSIG(status);
+  else if (WIFSTOPPED(status))
+    m_lastStatus = 128 + WSTOPSIG(status);
+}
 
+struct rusage *SmallShell::beginTiming(struct rusage *usage)
+{
+  struct rusage *previous = m_timedUsage;
+  m_timedUsage = usage;
+  return previous;
+}
 
+void SmallShell::endTiming(struct rusage *previous)
+{
+  m_timedUsage = previous;
+}
 
-//-------------------------------------SmallShell Aliases Implementation-------------------------------------
+void SmallShell::setPendingPerf(PerfCounters *counters)
+{
+  m_pendingPerf = counters;
+}
 
-void SmallShell::addAlias(const std::string& name, const std::string& command) {
-  // Overwrite if already exists
-  for (auto& p : m_aliases) {
-    if (p.first == name) {
-      p.second = command;
-      return;
+int SmallShell::getLastStatus() const
+{
+  return m_lastStatus;
+}
+
+void SmallShell::flushOutput()
+{
+  // An embedded shell's output never goes through std::cout, which is the host's
+  if (!m_embedded)
+  {
+    cout.flush();
+  }
+}
+
+void SmallShell::setPendingRedirections(const RedirectionList *redirections)
+{
+  m_pendingRedirections = redirections;
+}
+
+const RedirectionList *SmallShell::takePendingRedirections()
+{
+  const RedirectionList *redirections = m_pendingRedirections;
+  m_pendingRedirections = nullptr;
+  return redirections;
+}
+
+bool SmallShell::expandSubstitutions(const std::string &cmdLine, std::string &expanded)
+{
+  expanded.clear();
+  char quote = 0;
+  for (size_t i = 0; i < cmdLine.size(); ++i)
+  {
+    char c = cmdLine[i];
+    // Single quotes keep "$(" literal; double quotes do not
+    if (quote == '\'')
+    {
+      quote = c == quote ? 0 : quote;
+    }
+    else if (c == '\'' && !quote)
+    {
+      quote = c;
     }
+    else if (c == '"')
+    {
+      quote = quote ? 0 : c;
+    }
+    else if (c == '$' && i + 1 < cmdLine.size() && cmdLine[i + 1] == '(')
+    {
+      size_t end = _substitutionEnd(cmdLine, i);
+      if (end == std::string::npos)
+      {
+        cerr << "smash error: syntax error: unterminated $(" << endl;
+        m_lastStatus = 1;
+        return false;
+      }
+      std::string output;
+      if (!captureOutput(cmdLine.substr(i + 2, end - i - 2), output))
+      {
+        m_lastStatus = 1;
+        return false;
+      }
+      // Trailing newlines go, the rest is split into quoted words
+      size_t pos = 0;
+      bool first = true;
+      while ((pos = output.find_first_not_of(WHITESPACE, pos)) != std::string::npos)
+      {
+        size_t wordEnd = output.find_first_of(WHITESPACE, pos);
+        if (wordEnd == std::string::npos)
+        {
+          wordEnd = output.size();
+        }
+        expanded += (first ? "" : " ") + _quoteWord(output.substr(pos, wordEnd - pos));
+        first = false;
+        pos = wordEnd;
+      }
+      i = end;
+      continue;
+    }
+    expanded += c;
   }
-  m_aliases.push_back(std::make_pair(name, command));
+  return true;
 }
 
-bool SmallShell::getAliasCommand(const std::string& name, std::string& outCommand) const {
-  for (const auto& p : m_aliases) {
-    if (p.first == name) {
-      outCommand = p.second;
-      return true;
+bool SmallShell::captureOutput(const std::string &cmdLine, std::string &output)
+{
+  TraceSpan span("substitution", "command", cmdLine.c_str());
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1)
+  {
+    perror("smash error: pipe failed");
+    return false;
+  }
+
+  // Drain the pipe while the command runs so it never blocks on a full pipe.
+  // The reader must not take the shell's signals.
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  std::thread reader([&output, &fds] {
+    size_t used = output.size();
+    while (true)
+    {
+      output.resize(used + 65536);
+      ssize_t len = read(fds[0], &output[used], 65536);
+      if (len == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (len <= 0)
+      {
+        break;
+      }
+      used += len;
     }
+    output.resize(used);
+  });
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+  // The command's stdout becomes the pipe, through the usual redirection path:
+  // applied in the child for externals, a stream on the fd for built-ins.
+  // Redirections pending for the line (a session's pipes) stay under it, so
+  // its stderr goes where the line's does, and are back for the line after.
+  const RedirectionList *outer = m_pendingRedirections;
+  RedirectionList capture;
+  if (outer)
+  {
+    capture = *outer;
   }
-  return false;
+  capture.addDuplicate(STDOUT_FILENO, fds[1]);
+  std::string inner = _trim(cmdLine);
+  std::string expanded = inner;
+  bool ok = ListCommand::isList(inner) || expandSubstitutions(inner, expanded);
+  if (ok)
+  {
+    setPendingRedirections(&capture);
+    executeCommand(expanded.c_str());
+  }
+  setPendingRedirections(outer);
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+  return ok;
 }
 
-void SmallShell::printAliases() const {
-  for (const auto& p : m_aliases) {
-    std::cout << p.first << "='" << p.second << "'" << std::endl;
+unsigned long SmallShell::armPendingTimeout(pid_t pid)
+{
+  if (m_timeoutSeconds <= 0)
+  {
+    return 0;
   }
+  unsigned long timerId = TimerWheel::getInstance().addProcessTimer(m_timeoutSeconds, pid, m_timeoutSignal,
+                                                                    m_timeoutCmdLine.c_str());
+  clearPendingTimeout();
+  return timerId;
 }
 
-bool SmallShell::isAliasNameTaken(const std::string& name) const {
-  for (const auto& p : m_aliases) {
-    if (p.first == name) {
-      return true;
-    }
+unsigned long SmallShell::armPendingTimeout(std::atomic<bool> *flag, const std::shared_ptr<void> &keepAlive)
+{
+  if (m_timeoutSeconds <= 0)
+  {
+    return 0;
   }
-  return false;
+  unsigned long timerId = TimerWheel::getInstance().addFlagTimer(m_timeoutSeconds, flag, keepAlive,
+                                                                 m_timeoutCmdLine.c_str());
+  clearPendingTimeout();
+  return timerId;
 }
 
-void SmallShell::removeAlias(const std::string& name) {
-  for (auto it = m_aliases.begin(); it != m_aliases.end(); ++it) {
-    if (it->first == name) {
-      m_aliases.erase(it);
-      return;
+
+
+
+//-------------------------------------AliasTable-------------------------------------
+
+void AliasTable::add(const std::string& name, const std::string& command) {
+  m_resolved.clear();
+  auto it = m_index.find(name);
+  if (it != m_index.end()) {
+    it->second->second = command;
+    return;
+  }
+  m_definitions.push_back(std::make_pair(name, command));
+  m_index.emplace(name, std::prev(m_definitions.end()));
+}
+
+bool AliasTable::remove(const std::string& name) {
+  auto it = m_index.find(name);
+  if (it == m_index.end()) {
+    return false;
+  }
+  m_resolved.clear();
+  m_definitions.erase(it->second);
+  m_index.erase(it);
+  return true;
+}
+
+bool AliasTable::contains(const std::string& name) const {
+  return m_index.count(name) != 0;
+}
+
+const std::string *AliasTable::find(const std::string& name) const {
+  auto it = m_index.find(name);
+  return it == m_index.end() ? nullptr : &it->second->second;
+}
+
+const std::string *AliasTable::resolve(const std::string& name) const {
+  auto memo = m_resolved.find(name);
+  if (memo != m_resolved.end()) {
+    return &memo->second;
+  }
+  const std::string *command = find(name);
+  if (command == nullptr) {
+    return nullptr;
+  }
+  std::string text = _trim(*command);
+  std::unordered_set<std::string> expanded = {name};
+  // A list is split first, and each of its commands expands on its own
+  while (!ListCommand::isList(text)) {
+    size_t split = text.find_first_of(" \n");
+    std::string first = text.substr(0, split);
+    const std::string *next = find(first);
+    if (next == nullptr || !expanded.insert(first).second) {
+      break;
     }
+    text = _trim(*next + (split == std::string::npos ? "" : text.substr(split)));
   }
-}
\ No newline at end of file
+  return &m_resolved.emplace(name, text).first->second;
+}
+
+void AliasTable::print(std::ostream &out) const {
+  for (const auto& p : m_definitions) {
+    out << p.first << "='" << p.second << "'" << '\n';
+  }
+}
+
+size_t AliasTable::size() const {
+  return m_definitions.size();
+}
+
+//-------------------------------------SmallShell Aliases Implementation-------------------------------------
+
+void SmallShell::addAlias(const std::string& name, const std::string& command) {
+  m_aliases.add(name, command);
+}
+
+bool SmallShell::getAliasCommand(const std::string& name, std::string& outCommand) const {
+  const std::string *command = m_aliases.find(name);
+  if (command == nullptr) {
+    return false;
+  }
+  outCommand = *command;
+  return true;
+}
+
+void SmallShell::printAliases(std::ostream &out) const {
+  m_aliases.print(out);
+}
+
+bool SmallShell::isAliasNameTaken(const std::string& name) const {
+  return m_aliases.contains(name);
+}
+
+void SmallShell::removeAlias(const std::string& name) {
+  m_aliases.remove(name);
+}
@@ -5,13 +5,31 @@
 #include <vector>
 #include <unordered_set>
 #include <string.h>
-#include <regex>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <ostream>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "output.h"
+#include "perf.h"
+#include "redirect.h"
+#include "vars.h"
+#include "history.h"
 
 
 #define COMMAND_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
 
 class JobsList;
+class SmallShell;
+class JobLog;
+class StringSearcher;
 
 class Command {
 public:
@@ -21,14 +39,66 @@ public:
 
     virtual void execute() = 0;
 
+    // Whether "cmd &" may run this command on a worker thread as a pseudo-job.
+    // Only commands that do not touch the shell's own state opt in.
+    virtual bool canRunInBackground() const {
+        return false;
+    }
+
+    void setOutput(std::ostream *out, std::ostream *err);
+
+    // The fd built-ins that read input (wc) read; STDIN_FILENO unless a
+    // redirection or a pipe says otherwise. It stays the caller's to close.
+    void setInput(int fd);
+
+    void setCancelToken(const std::atomic<bool> *cancel);
+
+    // 0, or 1 once the command reported an error; "&&" and "||" test it.
+    int getStatus() const;
+
     //virtual void prepare();
     //virtual void cleanup();
     // TODO: Add your extra methods if needed
 protected:
     // command line
     char *m_cmd_line;
+    std::ostream *m_out;
+    std::ostream *m_err;
+    const std::atomic<bool> *m_cancel;
+    int m_status;
+    int m_inFd;
+
+    std::ostream &out() const {
+        return *m_out;
+    }
+
+    int in() const {
+        return m_inFd;
+    }
 
-    void initialCurrDir();
+    // Error messages, and reports such as time's that go with stderr. It
+    // does not fail the command: error paths set m_status themselves.
+    std::ostream &err() const {
+        return *m_err;
+    }
+
+    // Long running commands poll this to stop early when their job is killed.
+    bool isCancelled() const {
+        return m_cancel != nullptr && m_cancel->load();
+    }
+
+    // sleep() replacement that wakes up early on cancellation.
+    void sleepUnlessCancelled(unsigned int seconds) const;
+
+    // read(2) replacement that waits in 100 ms slices, so a command reading
+    // a quiet pipe still sees cancellation: -1 with errno ECANCELED.
+    ssize_t readUnlessCancelled(int fd, char *buf, size_t length) const;
+
+    // A copy of the session's directory fd. Built-ins that take relative
+    // names (du, follow, watchdir, wc, grep) get one when they are created
+    // and open the names from it with the *at() calls, so a pseudo-job
+    // keeps the directory it was started in across a later cd.
+    static int dupCwdFd();
 };
 
 class BuiltInCommand : public Command {
@@ -61,6 +131,41 @@ public:
     void execute() override;
 };
 
+// "a; b", "a && b", "a || b": runs each command through the normal dispatch,
+// skipping them by the status of the last one run. "list &" runs the whole
+// list in a forked copy of the shell.
+class ListCommand : public Command {
+public:
+    enum Connector {
+        SEQUENCE,
+        AND,
+        OR
+    };
+
+    struct Element {
+        Connector connector; // joins it to the previous command
+        std::string cmdLine;
+    };
+
+    explicit ListCommand(const char *cmd_line);
+
+    virtual ~ListCommand() {
+    }
+
+    void execute() override;
+
+    // Splits cmdLine at unquoted ";", "&&" and "||"; a trailing "&" sets
+    // background. Returns false and sets error for an empty command.
+    static bool parse(const std::string &cmdLine, std::vector<Element> &elements, bool &background,
+                      std::string &error);
+
+    // Whether cmdLine has an unquoted list operator.
+    static bool isList(const std::string &cmdLine);
+
+private:
+    void runElements(const std::vector<Element> &elements, const RedirectionList *redirections);
+};
+
 class PipeCommand : public Command {
     // TODO: Add your data members
 public:
@@ -76,10 +181,221 @@ class DiskUsageCommand : public Command {
 public:
     DiskUsageCommand(const char *cmd_line);
 
-    virtual ~DiskUsageCommand() {
+    virtual ~DiskUsageCommand();
+
+    bool canRunInBackground() const override {
+        return true;
+    }
+
+    void execute() override;
+
+private:
+    int m_dirFd;
+};
+
+// follow [-n N] <file>...: the last N (10) lines of each file, then what is
+// appended to them as it is written, like "tail -F". inotify on the files'
+// directories wakes it; nothing is polled. A file replaced under its name
+// (log rotation) is read to its end, then the new one from its start; a
+// truncated file is read again from its start. Runs until its job is
+// killed, ctrl-C or timeout.
+class FollowCommand : public Command {
+public:
+    FollowCommand(const char *cmd_line);
+
+    virtual ~FollowCommand();
+
+    bool canRunInBackground() const override {
+        return true;
     }
 
     void execute() override;
+
+private:
+    struct Followed {
+        std::string name;
+        std::string path;
+        // -1 while the file does not exist
+        int fd;
+        dev_t dev;
+        ino_t ino;
+        off_t offset;
+        int wd;
+    };
+
+    bool open(Followed &file);
+
+    // "==> name <==" before output of another file than last time.
+    void header(size_t index);
+
+    // Prints what was appended to file since the last call.
+    void readNew(size_t index);
+
+    // A change in file's directory: truncation, rotation, or more data.
+    void check(size_t index);
+
+    int m_dirFd;
+    std::vector<Followed> m_files;
+    // The file whose "==> name <==" header was printed last, with several
+    int m_lastPrinted;
+};
+
+// watchdir [-r] <dir> [-- <command>]: waits for changes in dir (and, with
+// -r, every directory below it) and prints them as "EVENTS path", or runs
+// command once per changed path with {} replaced by the path. A burst of
+// events is coalesced into one line or run per path. Each run is a forked
+// copy of the shell, so it may be any command line and cannot change the
+// shell's own state. Runs until its job is killed, ctrl-C or timeout.
+class WatchDirCommand : public Command {
+public:
+    WatchDirCommand(const char *cmd_line);
+
+    virtual ~WatchDirCommand();
+
+    bool canRunInBackground() const override {
+        return true;
+    }
+
+    void execute() override;
+
+private:
+    void run(const std::string &command, const std::string &path);
+
+    int m_dirFd;
+};
+
+// wc [-clmwL] [file...]: newlines, words and bytes of each file, or of the
+// input ("-" or no file), and their total if there are several, printed as
+// coreutils wc prints them. Regular files are mapped rather than read; the
+// counting itself is WordCounter's.
+class WordCountCommand : public Command {
+public:
+    WordCountCommand(const char *cmd_line);
+
+    virtual ~WordCountCommand();
+
+    bool canRunInBackground() const override {
+        return true;
+    }
+
+    void execute() override;
+
+    // Whether the built-in does what cmdLine asks: no option but -c, -l,
+    // -m, -w, -L and their long forms. Anything else is left to the real wc.
+    static bool handles(const std::string &cmdLine);
+
+private:
+    struct Options {
+        bool lines;
+        bool words;
+        bool chars;
+        bool bytes;
+        bool longest;
+        std::vector<std::string> files;
+    };
+
+    // Returns false for an option it does not know.
+    static bool parse(const char *cmdLine, Options &options);
+
+    struct Counts {
+        uint64_t lines;
+        uint64_t words;
+        uint64_t bytes;
+        uint64_t longest;
+    };
+
+    // Counts fd from its offset on; what is a set of WordCounter counts, 0
+    // for bytes alone, which a regular file's size gives without reading.
+    // Returns false with errno set if fd cannot be read to its end.
+    bool count(int fd, unsigned what, Counts &counts);
+
+    int m_dirFd;
+    std::vector<char> m_buffer;
+};
+
+// grep/fgrep [-cinvF] <string> [file...]: the lines of each file, or of
+// the input, that hold string (-v: that do not), printed as GNU grep prints
+// them in the C locale: "file:" in front with several inputs, -n numbers
+// the lines, -c counts them instead. The status is 0 if any line was
+// selected, 1 if none was and 2 on an error. Files are mapped and searched
+// in chunks on several threads, printed in order; pipes are read in large
+// blocks. A file counts as binary from around its first NUL byte on: the
+// first line selected there ends its output with a note, as with GNU grep.
+class FixedGrepCommand : public Command {
+public:
+    FixedGrepCommand(const char *cmd_line);
+
+    virtual ~FixedGrepCommand();
+
+    bool canRunInBackground() const override {
+        return true;
+    }
+
+    void execute() override;
+
+    // Whether the built-in does what cmdLine asks: fgrep, or grep with a
+    // pattern free of regular expression characters (or -F), and no option
+    // but -c, -i, -n, -v and -F. Anything else is left to the real grep.
+    static bool handles(const std::string &cmdLine);
+
+private:
+    struct Options {
+        bool count;
+        bool ignoreCase;
+        bool numbers;
+        bool invert;
+        bool fixed;
+        std::string pattern;
+        std::vector<std::string> files;
+    };
+
+    struct Line {
+        const char *start;
+        size_t length;
+        // 1 for the first line of its chunk
+        uint64_t number;
+    };
+
+    // A run of whole lines, searched on its own (possibly on a thread of
+    // its own) and printed after the ones before it.
+    struct Chunk {
+        const char *begin;
+        const char *end;
+        std::vector<Line> lines;
+        uint64_t selected;
+        // Only counted for -n
+        uint64_t newlines;
+        const char *firstNul;
+    };
+
+    // Returns false for an option it does not know or a missing pattern.
+    static bool parse(const char *cmdLine, Options &options);
+
+    void scan(Chunk &chunk) const;
+
+    // Prints the chunk's lines after those of the chunks before it; offset
+    // is where the chunk starts in its file.
+    void print(const Chunk &chunk, uint64_t offset, const std::string &name);
+
+    void searchMapped(const char *data, size_t length, const std::string &name);
+
+    // Returns false with errno set if fd cannot be read to its end.
+    bool searchStream(int fd, const std::string &name);
+
+    void flushPending();
+
+    Options m_options;
+    std::unique_ptr<StringSearcher> m_searcher;
+    int m_dirFd;
+    std::vector<char> m_buffer;
+    std::string m_pending;
+    bool m_names;
+    // Of the file being searched
+    uint64_t m_lineBase;
+    uint64_t m_selected;
+    // Where the file counts as binary, once a NUL byte was seen
+    uint64_t m_binaryFrom;
+    bool m_stopped;
 };
 
 class WhoAmICommand : public Command {
@@ -89,6 +405,10 @@ public:
     virtual ~WhoAmICommand() {
     }
 
+    bool canRunInBackground() const override {
+        return true;
+    }
+
     void execute() override;
 };
 
@@ -100,21 +420,22 @@ public:
     virtual ~NetInfo() {
     }
 
+    bool canRunInBackground() const override {
+        return true;
+    }
+
     void execute() override;
 };
 
 class ChangeDirCommand : public BuiltInCommand {
     // TODO: Add your data members
     public:
-    ChangeDirCommand(const char *cmd_line, char **plastPwd);
+    ChangeDirCommand(const char *cmd_line);
 
     virtual ~ChangeDirCommand() {
     }
 
     void execute() override;
-
-    private:
-    char **m_prevDirectory;
 };
 
 class GetCurrDirCommand : public BuiltInCommand {
@@ -171,6 +492,69 @@ public:
     void execute() override;
 };
 
+// A built-in command running on a worker thread. It owns the command and
+// private duplicates of the shell's stdout/stderr taken when the job was
+// started, so a later redirection or prompt does not change where it writes.
+// Its input is /dev/null unless redirected: the shell keeps its own stdin.
+class BackgroundTask {
+public:
+    // The command uses copies of outFd/errFd/inFd, which may be closed after.
+    explicit BackgroundTask(Command *cmd, int outFd = STDOUT_FILENO, int errFd = STDERR_FILENO,
+                            int inFd = STDIN_FILENO);
+
+    ~BackgroundTask();
+
+    BackgroundTask(BackgroundTask const &) = delete;
+    void operator=(BackgroundTask const &) = delete;
+
+    void run();
+
+    // Only raises a flag the command polls, so it is safe from a signal handler.
+    void cancel();
+
+    std::atomic<bool> *cancelFlag();
+
+    bool isDone() const;
+
+    void wait();
+
+private:
+    Command *m_cmd;
+    // The session that started it; see SmallShell::makeCurrent()
+    SmallShell *m_shell;
+    int m_outFd;
+    int m_errFd;
+    int m_inFd;
+    FdStreamBuf m_outBuf;
+    FdStreamBuf m_errBuf;
+    std::ostream m_outStream;
+    std::ostream m_errStream;
+    std::atomic<bool> m_cancelled;
+    std::atomic<bool> m_done;
+    std::mutex m_mutex;
+    std::condition_variable m_doneCond;
+};
+
+// Fixed set of threads that run background built-ins. Created on first use and
+// deliberately never destroyed: quit calls exit() while workers may still be
+// blocked inside a command.
+class WorkerPool {
+public:
+    static WorkerPool &getInstance();
+
+    void submit(const std::shared_ptr<BackgroundTask> &task);
+
+private:
+    explicit WorkerPool(unsigned int threads);
+
+    void workerLoop();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::shared_ptr<BackgroundTask>> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_queueCond;
+};
+
 class JobsList {
 public:
     class JobEntry {
@@ -181,18 +565,33 @@ public:
         pid_t m_pid;
         char m_commandLine[COMMAND_MAX_LENGTH + 1];
         bool m_isStopped;
+        // Set for built-ins running on a worker thread (m_pid is the shell's).
+        std::shared_ptr<BackgroundTask> m_task;
+        // TimerWheel id of the job's "timeout" deadline, 0 if it has none.
+        unsigned long m_timerId;
+        // ChildReaper reaps it; otherwise removeFinishedJobs() polls waitpid()
+        bool m_watched;
+        // Its output, when captured (see SmallShell::openJobLog())
+        std::shared_ptr<JobLog> m_log;
     };
 
     // TODO: Add your data members
     JobsList() = default;
 
-    ~JobsList() = default;
+    ~JobsList();
+
+    JobsList(JobsList const &) = delete;
+    void operator=(JobsList const &) = delete;
 
-    void addJob(const char *cmd, pid_t pid, bool isStopped = false);
+    void addJob(const char *cmd, pid_t pid, bool isStopped = false, unsigned long timerId = 0,
+                const std::shared_ptr<JobLog> &log = nullptr);
 
-    void printJobsList();
+    void addJob(const char *cmd, const std::shared_ptr<BackgroundTask> &task, unsigned long timerId = 0,
+                const std::shared_ptr<JobLog> &log = nullptr);
 
-    void killAllJobs();
+    void printJobsList(std::ostream &out);
+
+    void killAllJobs(std::ostream &out);
 
     void removeFinishedJobs();
 
@@ -208,11 +607,52 @@ public:
 
     bool isEmpty() const;
 
+    // The captured output of a job, or of one of the last few that finished
+    // (a later job with the same id takes precedence). nullptr if neither.
+    std::shared_ptr<JobLog> getJobLog(int jobId);
+
     // TODO: Add extra methods or modify exisitng ones as needed
 
     private:
+    // A job leaves the list: its log stays readable for a while
+    void keepLog(const JobEntry &job);
+
     std::vector<JobEntry> m_list;
     int m_jobIdCounter = 0;
+    std::deque<std::pair<int, std::shared_ptr<JobLog>>> m_finishedLogs;
+};
+
+// Aliases by name, printed in the order they were defined. The fully
+// expanded form of a name is memoized until the next alias/unalias, so
+// resolving one is a single lookup however many aliases there are.
+class AliasTable {
+public:
+    // Replaces the command of an existing name in place.
+    void add(const std::string &name, const std::string &command);
+
+    // Returns false if name is not an alias.
+    bool remove(const std::string &name);
+
+    bool contains(const std::string &name) const;
+
+    // The command name was defined as, or nullptr.
+    const std::string *find(const std::string &name) const;
+
+    // name with its first word expanded again and again, or nullptr if name
+    // is not an alias. Like bash, a word already expanded on the way is left
+    // alone, so "alias ls='ls -l'" and cycles such as a -> b -> a terminate.
+    const std::string *resolve(const std::string &name) const;
+
+    void print(std::ostream &out) const;
+
+    size_t size() const;
+
+private:
+    typedef std::list<std::pair<std::string, std::string>> Definitions;
+
+    Definitions m_definitions;
+    std::unordered_map<std::string, Definitions::iterator> m_index;
+    mutable std::unordered_map<std::string, std::string> m_resolved;
 };
 
 class JobsCommand : public BuiltInCommand {
@@ -226,6 +666,21 @@ public:
     void execute() override;
 };
 
+// joblog <job-id> [-f]: what a job wrote while JOBLOG was set, as much as
+// its ring still holds; -f then follows it until the job is done.
+class JobLogCommand : public BuiltInCommand {
+public:
+    JobLogCommand(const char *cmd_line, JobsList *jobs);
+
+    virtual ~JobLogCommand() {
+    }
+
+    void execute() override;
+
+private:
+    JobsList *m_jobs;
+};
+
 class ForegroundCommand : public BuiltInCommand {
 private:
     JobsList *m_jobs;
@@ -244,7 +699,9 @@ private:
     void printAllAliases();
 
 public:
-    static const std::regex aliasPattern;
+    // Splits "alias NAME='COMMAND'" into name and command in one pass;
+    // false if line is not exactly in that form.
+    static bool parseDefinition(const char *line, std::string &name, std::string &command);
 
     AliasCommand(const char *cmd_line);
 
@@ -274,8 +731,101 @@ public:
     void execute() override;
 };
 
-class WatchProcCommand : public BuiltInCommand {
+class SetEnvCommand : public BuiltInCommand {
+public:
+    SetEnvCommand(const char *cmd_line);
+
+    virtual ~SetEnvCommand() {
+    }
+
+    void execute() override;
+};
+
+class ExportCommand : public BuiltInCommand {
+public:
+    ExportCommand(const char *cmd_line);
+
+    virtual ~ExportCommand() {
+    }
+
+    void execute() override;
+};
+
+class SetCommand : public BuiltInCommand {
+public:
+    SetCommand(const char *cmd_line);
+
+    virtual ~SetCommand() {
+    }
+
+    void execute() override;
+};
+
+class HistoryCommand : public BuiltInCommand {
+public:
+    HistoryCommand(const char *cmd_line);
+
+    virtual ~HistoryCommand() {
+    }
+
+    void execute() override;
+};
+
+class TimeoutCommand : public BuiltInCommand {
+public:
+    TimeoutCommand(const char *cmd_line);
+
+    virtual ~TimeoutCommand() {
+    }
+
+    void execute() override;
+};
+
+class TimeCommand : public BuiltInCommand {
 private:
+    void printReport(double wallSeconds, const struct rusage& usage, bool asJson);
+
+public:
+    TimeCommand(const char *cmd_line);
+
+    virtual ~TimeCommand() {
+    }
+
+    void execute() override;
+};
+
+class StatsCommand : public BuiltInCommand {
+public:
+    StatsCommand(const char *cmd_line);
+
+    virtual ~StatsCommand() {
+    }
+
+    void execute() override;
+};
+
+class TraceCommand : public BuiltInCommand {
+public:
+    TraceCommand(const char *cmd_line);
+
+    virtual ~TraceCommand() {
+    }
+
+    void execute() override;
+};
+
+class PerfStatCommand : public BuiltInCommand {
+public:
+    PerfStatCommand(const char *cmd_line);
+
+    virtual ~PerfStatCommand() {
+    }
+
+    void execute() override;
+};
+
+class WatchProcCommand : public BuiltInCommand {
+protected:
     double parseCpuPercent(const std::string& statContent);
     std::string readProcFile(pid_t pid, const std::string& fileName);
     double parseMemoryMb(const std::string& statusContent);
@@ -286,6 +836,10 @@ public:
     virtual ~WatchProcCommand() {
     }
 
+    bool canRunInBackground() const override {
+        return true;
+    }
+
     void execute() override;
 };
 
@@ -294,27 +848,91 @@ private:
     // TODO: Add your data members
     SmallShell();
     std::string m_prompt;
-    char *m_currDir;
-    char *m_prevDir;
+    // The session's working directory as an O_PATH fd, which children
+    // fchdir() to; only the process's own shell chdir()s as well. The path
+    // is worked out on first use.
+    int m_cwdFd;
+    std::string m_currDir;
+    std::string m_prevDir;
     JobsList jobs;
 
+    // Deadline requested by "timeout" for the command it is about to run;
+    // m_timeoutSeconds is 0 when there is none.
+    double m_timeoutSeconds;
+    int m_timeoutSignal;
+    std::string m_timeoutCmdLine;
+
+    // Resource usage of children reaped while "time" is measuring, or nullptr.
+    struct rusage *m_timedUsage;
+
+    // Time CreateCommand spent forking and waiting, kept out of the parse phase.
+    uint64_t m_spawnNs;
+
+    // Counters "perfstat" wants attached to the next foreground command, or nullptr.
+    PerfCounters *m_pendingPerf;
+
+    // Exit status of the last foreground command, as a script exits with.
+    int m_lastStatus;
+
+    // Redirections "cmd > file" wants applied to the command it runs, or nullptr.
+    const RedirectionList *m_pendingRedirections;
+
+    // Nesting of executeCommand; only depth 0 is text straight from the user.
+    int m_executeDepth;
+
+    // Shell variables and the exported environment; see prepareChild().
+    VariableStore m_variables;
+    char **m_childEnv;
+
+    History m_history;
+
+    // Runs inside a host process (see libsmash.h): std::cout is left alone
+    // and quit ends the session instead of the process.
+    bool m_embedded;
+    bool m_quit;
+
+    // std::cout is pointed at this buffer unless embedded; see flushOutput().
+    FdStreamBuf m_outBuf;
+    std::streambuf *m_stdoutBuf;
+
+    // The shell whose command this thread is running, if not the process's own.
+    static thread_local SmallShell *m_current;
+
+    void runCommand(const char *cmd_line);
+
+    // aliasSource is the user's line when cmd_line is its alias expansion;
+    // such a line is not expanded again.
+    Command *createCommand(const char *cmd_line, const std::string *aliasSource);
+
 public:
     static pid_t m_shellPid;
     int m_foregroundPid;
+    // Pseudo-job brought to the foreground with fg, for the ctrl-C handler,
+    // and its job id: it has no pid of its own to report.
+    std::atomic<BackgroundTask *> m_foregroundTask;
+    int m_foregroundTaskJobId;
+    // Cancel flag of the built-in running in the foreground; ctrl-C raises it.
+    std::atomic<std::atomic<bool> *> m_foregroundCancel;
     static const std::unordered_set<std::string> RESERVED_COMMANDS;
 
     // Aliases
-    std::vector<std::pair<std::string, std::string>> m_aliases;
+    AliasTable m_aliases;
     void addAlias(const std::string& name, const std::string& command);
     bool getAliasCommand(const std::string& name, std::string& outCommand) const;
-    void printAliases() const;
+    void printAliases(std::ostream &out) const;
     bool isAliasNameTaken(const std::string& name) const;
     void removeAlias(const std::string& name);
     
     SmallShell(SmallShell const &) = delete; // disable copy ctor
     void operator=(SmallShell const &) = delete; // disable = operator
+    explicit SmallShell(bool embedded);
+
     static SmallShell &getInstance() // make SmallShell singleton
     {
+        // Commands of an embedded session find their own shell
+        if (m_current) {
+            return *m_current;
+        }
         static SmallShell instance; // Guaranteed to be destroyed.
         // Instantiated on first use.
         return instance;
@@ -326,20 +944,104 @@ public:
 
     void executeCommand(const char *cmd_line);
 
+    // One command per line, as "smash -c" runs its argument; stops at quit.
+    // redirections, if given, apply to every line.
+    void executeLines(const std::string &lines, const RedirectionList *redirections = nullptr);
+
+    // Makes getInstance() on this thread return shell (nullptr: the process's
+    // own). Returns the previous one, to be restored.
+    static SmallShell *makeCurrent(SmallShell *shell);
+
+    bool isEmbedded() const;
+
+    // An embedded session ran quit.
+    bool hasQuit() const;
+
     std::string getPrompt() const;
 
     void changePrompt(const std::string& new_prompt = "smash");
 
-    void setCurrDir(const char *newDir);
+    // Enters path, relative to the current directory. Prints and returns
+    // false if it cannot be entered.
+    bool changeDir(const std::string &path);
 
-    char *getCurrDir() const;
+    const std::string &getCurrDir();
 
-    void setPrevDir();
+    // "" until the first cd
+    const std::string &getPrevDir() const;
 
-    char *getPrevDir() const;
+    // Relative paths a built-in opens are taken from here (openat and co.)
+    int getCwdFd() const;
 
     JobsList *getAllJobs();
 
+    void setPendingTimeout(double seconds, int signal, const std::string& cmdLine);
+
+    void clearPendingTimeout();
+
+    // Hand the pending "timeout" deadline, if any, to the command that was just
+    // started. Returns the TimerWheel id, or 0 when no timeout was requested.
+    unsigned long armPendingTimeout(pid_t pid);
+
+    unsigned long armPendingTimeout(std::atomic<bool> *flag, const std::shared_ptr<void> &keepAlive);
+
+    // waitpid() for children the shell waits on in the foreground. Uses wait4
+    // so a running "time" can charge the child's rusage to its command.
+    pid_t waitChild(pid_t pid, int *status, int options);
+
+    // Sets the last status from a child's wait status, as waitChild() does.
+    void recordWaitStatus(int status);
+
+    // Start charging reaped children to `usage`; returns the previous target.
+    struct rusage *beginTiming(struct rusage *usage);
+
+    void endTiming(struct rusage *previous);
+
+    void setPendingPerf(PerfCounters *counters);
+
+    // 0 for built-ins and background jobs; for a pipe, its last stage.
+    int getLastStatus() const;
+
+    // Built-in output collects in a shell-owned buffer instead of costing a
+    // write(2) per line. It is written out before the prompt, before fork,
+    // before blocking on a child or job, around redirections and at exit, so
+    // it stays in order with what children write to the same fd.
+    void flushOutput();
+
+    // Consumed by the next leaf command: externals apply it in the child,
+    // built-ins write to streams on the redirected fds.
+    void setPendingRedirections(const RedirectionList *redirections);
+
+    const RedirectionList *takePendingRedirections();
+
+    VariableStore &getVariables();
+
+    History &getHistory();
+
+    // In the parent before fork: builds the environment the child will get,
+    // so the child allocates nothing. The envp array is only rebuilt after a
+    // variable changed.
+    void prepareChild();
+
+    // In the child right after fork: unblocks every signal and takes on the
+    // session's working directory and environment. The parent's environ and cwd are never
+    // touched, so sessions on other threads keep their own.
+    void enterChild();
+
+    // Replaces each $(...) with the words the command printed, single-quoted
+    // so they are only ever arguments. Prints and returns false on error.
+    bool expandSubstitutions(const std::string &cmdLine, std::string &expanded);
+
+    // "set JOBLOG=SIZE": a background job's stdout and stderr go to a pipe,
+    // made here as fds, whose read end JobLogDrainer empties into a ring of
+    // SIZE bytes (64 KiB if SIZE is not a number). nullptr, with no pipe
+    // made, when JOBLOG is unset, empty or 0.
+    std::shared_ptr<JobLog> openJobLog(int fds[2]);
+
+    // Runs cmdLine with stdout into a pipe drained into output. Built-ins run
+    // in the shell, externals take the usual fork path.
+    bool captureOutput(const std::string &cmdLine, std::string &output);
+
 };
 
 #endif //SMASH_COMMAND_H_
@@ -0,0 +1,276 @@
+#include "complete.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dirscan.h"
+
+namespace {
+
+// Up to the first 8 bytes of a name as an integer, zero padded. mask, if
+// given, gets the bits those bytes occupy.
+uint64_t nameHead(const char *name, size_t length, uint64_t *mask) {
+    uint64_t head = 0;
+    size_t bytes = std::min(length, sizeof(head));
+    memcpy(&head, name, bytes);
+    if (mask) {
+        *mask = bytes == sizeof(head) ? ~uint64_t(0) : (uint64_t(1) << (bytes * 8)) - 1;
+    }
+    return head;
+}
+
+void addMatch(const std::string &match, size_t limit, Completion &out) {
+    if (out.matches.empty()) {
+        out.common = match;
+    } else {
+        size_t common = 0;
+        while (common < out.common.size() && common < match.size() && out.common[common] == match[common]) {
+            ++common;
+        }
+        out.common.resize(common);
+    }
+    if (out.matches.size() < limit) {
+        out.matches.push_back(match);
+    } else {
+        out.truncated = true;
+    }
+}
+
+}
+
+//-------------------------------------CommandTrie-------------------------------------
+
+CommandTrie::CommandTrie() : m_built(false), m_names(0) {}
+
+void CommandTrie::setBuiltins(const std::vector<std::string> &names) {
+    m_builtins = names;
+    m_built = false;
+}
+
+bool CommandTrie::stale(const std::string &path) const {
+    if (!m_built || path != m_path) {
+        return true;
+    }
+    for (const Dir &dir : m_dirs) {
+        struct stat st;
+        struct timespec mtime = {0, 0};
+        if (stat(dir.path.c_str(), &st) == 0) {
+            mtime = st.st_mtim;
+        }
+        if (mtime.tv_sec != dir.mtime.tv_sec || mtime.tv_nsec != dir.mtime.tv_nsec) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommandTrie::insert(const char *name, size_t length) {
+    uint32_t node = 0;
+    for (size_t i = 0; i < length; ++i) {
+        std::vector<std::pair<char, uint32_t>> &children = m_nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(name[i], uint32_t(0)));
+        if (it != children.end() && it->first == name[i]) {
+            node = it->second;
+            continue;
+        }
+        uint32_t child = static_cast<uint32_t>(m_nodes.size());
+        children.insert(it, std::make_pair(name[i], child));
+        m_nodes.push_back(Node());
+        m_nodes.back().terminal = false;
+        node = child;
+    }
+    if (!m_nodes[node].terminal) {
+        m_nodes[node].terminal = true;
+        ++m_names;
+    }
+}
+
+void CommandTrie::rebuild(const std::string &path) {
+    m_nodes.assign(1, Node());
+    m_nodes[0].terminal = false;
+    m_names = 0;
+    m_dirs.clear();
+    m_path = path;
+    m_built = true;
+    for (const std::string &name : m_builtins) {
+        insert(name.data(), name.size());
+    }
+
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        Dir dir;
+        dir.path = end > start ? path.substr(start, end - start) : ".";
+        dir.mtime.tv_sec = 0;
+        dir.mtime.tv_nsec = 0;
+        start = end + 1;
+
+        int dirfd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        struct stat st;
+        if (dirfd != -1 && fstat(dirfd, &st) == 0) {
+            dir.mtime = st.st_mtim;
+        }
+        m_dirs.push_back(dir);
+        if (dirfd == -1) {
+            continue;
+        }
+        scanDirectory(dirfd, [this, dirfd](const char *name, size_t length, unsigned char type) {
+            if (type == DT_DIR) {
+                return true;
+            }
+            struct stat entry;
+            if (type == DT_UNKNOWN && (fstatat(dirfd, name, &entry, 0) == -1 || S_ISDIR(entry.st_mode))) {
+                return true;
+            }
+            if (faccessat(dirfd, name, X_OK, 0) == 0) {
+                insert(name, length);
+            }
+            return true;
+        });
+        close(dirfd);
+    }
+}
+
+void CommandTrie::collect(uint32_t node, std::string &name, size_t limit, Completion &out) const {
+    if (out.truncated) {
+        return;
+    }
+    if (m_nodes[node].terminal) {
+        addMatch(name, limit, out);
+    }
+    for (const auto &child : m_nodes[node].children) {
+        name += child.first;
+        collect(child.second, name, limit, out);
+        name.pop_back();
+        if (out.truncated) {
+            return;
+        }
+    }
+}
+
+void CommandTrie::complete(const std::string &path, const std::string &prefix, size_t limit, Completion &out) {
+    if (stale(path)) {
+        rebuild(path);
+    }
+    uint32_t node = 0;
+    for (char c : prefix) {
+        const std::vector<std::pair<char, uint32_t>> &children = m_nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, uint32_t(0)));
+        if (it == children.end() || it->first != c) {
+            return;
+        }
+        node = it->second;
+    }
+    std::string name = prefix;
+    collect(node, name, limit, out);
+    // The common prefix runs down the trie while there is only one way on
+    out.common = prefix;
+    while (!m_nodes[node].terminal && m_nodes[node].children.size() == 1) {
+        out.common += m_nodes[node].children[0].first;
+        node = m_nodes[node].children[0].second;
+    }
+}
+
+size_t CommandTrie::size() const {
+    return m_names;
+}
+
+//-------------------------------------Completer-------------------------------------
+
+Completer::Completer() : m_haveListing(false) {}
+
+void Completer::setPath(const std::string &path) {
+    m_path = path;
+}
+
+CommandTrie &Completer::commands() {
+    return m_commands;
+}
+
+void Completer::complete(const std::string &word, bool command, bool list, size_t limit, Completion &out) {
+    out.matches.clear();
+    out.common.clear();
+    out.truncated = false;
+    if (command && word.find('/') == std::string::npos) {
+        m_commands.complete(m_path, word, list ? limit : 2, out);
+    } else {
+        completePath(word, list, limit, out);
+    }
+}
+
+void Completer::completePath(const std::string &word, bool list, size_t limit, Completion &out) {
+    size_t slash = word.rfind('/');
+    std::string dirPart = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+    std::string base = slash == std::string::npos ? word : word.substr(slash + 1);
+    int dirfd = open(dirPart.empty() ? "." : dirPart.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1) {
+        return;
+    }
+    if (!list) {
+        limit = 2;
+    }
+    bool hidden = !base.empty() && base[0] == '.';
+    auto consider = [&](const char *name, size_t length, unsigned char type) {
+        if (length < base.size() || memcmp(name, base.data(), base.size()) != 0 || (name[0] == '.' && !hidden)) {
+            return true;
+        }
+        bool isDir = type == DT_DIR;
+        struct stat st;
+        if ((type == DT_LNK || type == DT_UNKNOWN) && fstatat(dirfd, name, &st, 0) == 0) {
+            isDir = S_ISDIR(st.st_mode);
+        }
+        addMatch(dirPart + std::string(name, length) + (isDir ? "/" : ""), limit, out);
+        // Once two names share no more than base, a first Tab has nothing
+        // to insert: no need to read the rest of a huge directory
+        if (!list && out.matches.size() >= 2 && out.common.size() <= dirPart.size() + base.size()) {
+            out.truncated = true;
+            return false;
+        }
+        // Without list only two names are kept, but every one still
+        // narrows the common prefix
+        return !(list && out.truncated);
+    };
+
+    struct stat dirStat;
+    bool statted = fstat(dirfd, &dirStat) == 0;
+    if (statted && m_haveListing && m_listing.dev == dirStat.st_dev && m_listing.ino == dirStat.st_ino &&
+        m_listing.mtime.tv_sec == dirStat.st_mtim.tv_sec && m_listing.mtime.tv_nsec == dirStat.st_mtim.tv_nsec) {
+        // One integer compare of the first 8 bytes rejects almost every name
+        uint64_t mask;
+        uint64_t key = nameHead(base.data(), base.size(), &mask);
+        const char *names = m_listing.names.data();
+        for (const Entry &entry : m_listing.entries) {
+            if ((entry.head & mask) == key && !consider(names + entry.offset, entry.length, entry.type)) {
+                break;
+            }
+        }
+        close(dirfd);
+        return;
+    }
+
+    Listing listing;
+    bool complete = true;
+    scanDirectory(dirfd, [&](const char *name, size_t length, unsigned char type) {
+        Entry entry = {nameHead(name, length, nullptr), static_cast<uint32_t>(listing.names.size()),
+                       static_cast<uint32_t>(length), type};
+        listing.names.append(name, length);
+        listing.entries.push_back(entry);
+        complete = consider(name, length, type);
+        return complete;
+    });
+    if (complete && statted) {
+        m_listing.dev = dirStat.st_dev;
+        m_listing.ino = dirStat.st_ino;
+        m_listing.mtime = dirStat.st_mtim;
+        m_listing.names.swap(listing.names);
+        m_listing.entries.swap(listing.entries);
+        m_haveListing = true;
+    }
+    close(dirfd);
+}
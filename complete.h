@@ -0,0 +1,106 @@
+#ifndef SMASH__COMPLETE_H_
+#define SMASH__COMPLETE_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+// What a completion found. common is the longest prefix shared by every
+// match seen, which is what a first Tab inserts.
+struct Completion {
+    // At most the limit asked for, in directory/trie order
+    std::vector<std::string> matches;
+    std::string common;
+    // The scan stopped before seeing every candidate
+    bool truncated;
+};
+
+// Executable names in $PATH directories, plus the shell's built-ins, in a
+// prefix trie. Built on first use; rebuilt only when PATH changes or the
+// mtime of one of its directories does.
+class CommandTrie {
+public:
+    CommandTrie();
+
+    void setBuiltins(const std::vector<std::string> &names);
+
+    void complete(const std::string &path, const std::string &prefix, size_t limit, Completion &out);
+
+    size_t size() const;
+
+private:
+    struct Node {
+        // Sorted by character
+        std::vector<std::pair<char, uint32_t>> children;
+        bool terminal;
+    };
+
+    struct Dir {
+        std::string path;
+        struct timespec mtime;
+    };
+
+    bool stale(const std::string &path) const;
+
+    void rebuild(const std::string &path);
+
+    void insert(const char *name, size_t length);
+
+    void collect(uint32_t node, std::string &name, size_t limit, Completion &out) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<std::string> m_builtins;
+    bool m_built;
+    std::string m_path;
+    std::vector<Dir> m_dirs;
+    size_t m_names;
+};
+
+// Tab completion for the line editor: command names from the trie, paths
+// from a getdents64 scan of the one directory involved. A scan that had to
+// read a whole directory keeps its names in one flat buffer, so the next
+// completions there are an in-memory pass until the directory's mtime moves.
+class Completer {
+public:
+    Completer();
+
+    // The trie follows this PATH from the next completion on.
+    void setPath(const std::string &path);
+
+    CommandTrie &commands();
+
+    // Completes word as a command name if command is true, else as a path.
+    // Without list, the scan stops as soon as the common prefix is no
+    // longer than word, since a Tab could then insert nothing; with it,
+    // after limit matches.
+    void complete(const std::string &word, bool command, bool list, size_t limit, Completion &out);
+
+private:
+    void completePath(const std::string &word, bool list, size_t limit, Completion &out);
+
+    struct Entry {
+        // First bytes of the name, for a quick prefix check
+        uint64_t head;
+        uint32_t offset;
+        uint32_t length;
+        unsigned char type;
+    };
+
+    struct Listing {
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+        // Names back to back; entries index into it
+        std::string names;
+        std::vector<Entry> entries;
+    };
+
+    std::string m_path;
+    CommandTrie m_commands;
+    bool m_haveListing;
+    Listing m_listing;
+};
+
+#endif //SMASH__COMPLETE_H_
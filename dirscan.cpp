@@ -0,0 +1,46 @@
+#include "dirscan.h"
+
+#include <string.h>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+struct linux_dirent64 {
+  ino64_t        d_ino;    // 64-bit inode number
+  off64_t        d_off;    // 64-bit offset to next dirent
+  unsigned short d_reclen; // Length of this dirent
+  unsigned char  d_type;   // File type
+  char           d_name[]; // Filename (null-terminated)
+};
+
+namespace {
+
+// Large enough for a few thousand entries per system call.
+const size_t BUF_SIZE = 1 << 16;
+
+}
+
+bool scanDirectory(int dirfd, const std::function<bool(const char *name, size_t length, unsigned char type)> &fn) {
+    std::vector<char> buf(BUF_SIZE);
+    while (true) {
+        long nread = syscall(SYS_getdents64, dirfd, buf.data(), BUF_SIZE);
+        if (nread == 0) {
+            return true;
+        }
+        if (nread < 0) {
+            return false;
+        }
+        for (long bpos = 0; bpos < nread;) {
+            auto *d = reinterpret_cast<struct linux_dirent64 *>(buf.data() + bpos);
+            bpos += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            if (!fn(name, strlen(name), d->d_type)) {
+                return true;
+            }
+        }
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef SMASH__DIRSCAN_H_
+#define SMASH__DIRSCAN_H_
+
+#include <functional>
+#include <stddef.h>
+
+// Entries of an open directory read straight from getdents64 into one large
+// buffer, without readdir's per-entry call and copy. "." and ".." are
+// skipped. fn gets the name, its length and the d_type (DT_UNKNOWN on file
+// systems that do not report it) and returns false to stop the scan early.
+// Returns false with errno set if getdents64 fails.
+bool scanDirectory(int dirfd, const std::function<bool(const char *name, size_t length, unsigned char type)> &fn);
+
+#endif //SMASH__DIRSCAN_H_
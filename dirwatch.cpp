@@ -0,0 +1,249 @@
+#include "dirwatch.h"
+#include "dirscan.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+namespace {
+
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+                            IN_ATTRIB | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+std::string join(const std::string &dir, const char *name) {
+    return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+}
+
+//-------------------------------------DirectoryWatcher-------------------------------------
+
+DirectoryWatcher::DirectoryWatcher() :
+    m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), m_recursive(false), m_failures(0), m_lastError(0) {}
+
+DirectoryWatcher::~DirectoryWatcher() {
+    // Closing the inotify fd drops every watch at once
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+bool DirectoryWatcher::start(const std::string &dir, bool recursive) {
+    if (m_fd == -1) {
+        return false;
+    }
+    m_root = dir;
+    m_recursive = recursive;
+    if (!addWatch("")) {
+        errno = m_lastError;
+        m_failures = 0;
+        return false;
+    }
+    if (recursive) {
+        addTree("", false);
+    }
+    return true;
+}
+
+int DirectoryWatcher::fd() const {
+    return m_fd;
+}
+
+size_t DirectoryWatcher::watchCount() const {
+    return m_paths.size();
+}
+
+size_t DirectoryWatcher::failures() const {
+    return m_failures;
+}
+
+int DirectoryWatcher::lastError() const {
+    return m_lastError;
+}
+
+std::string DirectoryWatcher::absolute(const std::string &path) const {
+    return path.empty() ? m_root : m_root + "/" + path;
+}
+
+bool DirectoryWatcher::addWatch(const std::string &path) {
+    int wd = inotify_add_watch(m_fd, absolute(path).c_str(), WATCH_MASK);
+    if (wd == -1) {
+        ++m_failures;
+        m_lastError = errno;
+        return false;
+    }
+    // The same directory again (moved before its old events were read)
+    auto old = m_paths.find(wd);
+    if (old != m_paths.end()) {
+        m_wds.erase(old->second);
+    }
+    m_paths[wd] = path;
+    m_wds[path] = wd;
+    return true;
+}
+
+void DirectoryWatcher::addTree(const std::string &path, bool report) {
+    std::vector<std::string> stack;
+    stack.push_back(path);
+    while (!stack.empty()) {
+        std::string dir = stack.back();
+        stack.pop_back();
+        // Watched before it is read: an entry created meanwhile is at worst seen twice
+        if (dir != path || report) {
+            if (!addWatch(dir)) {
+                continue;
+            }
+        }
+        int dirfd = open(absolute(dir).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd == -1) {
+            continue;
+        }
+        scanDirectory(dirfd, [&](const char *name, size_t, unsigned char type) {
+            std::string child = join(dir, name);
+            if (report) {
+                note(child, IN_CREATE | (type == DT_DIR ? IN_ISDIR : 0));
+            }
+            struct stat st;
+            if (type == DT_DIR ||
+                (type == DT_UNKNOWN && fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))) {
+                stack.push_back(child);
+            }
+            return true;
+        });
+        close(dirfd);
+    }
+}
+
+void DirectoryWatcher::subtree(const std::string &path, std::map<std::string, int>::iterator &first,
+                               std::map<std::string, int>::iterator &last) {
+    // '0' comes right after '/': what is below path sorts in between
+    first = m_wds.lower_bound(path + "/");
+    last = m_wds.lower_bound(path + "0");
+}
+
+void DirectoryWatcher::removeTree(const std::string &path) {
+    auto self = m_wds.find(path);
+    if (self != m_wds.end()) {
+        inotify_rm_watch(m_fd, self->second);
+        m_paths.erase(self->second);
+        m_wds.erase(self);
+    }
+    std::map<std::string, int>::iterator first, last;
+    subtree(path, first, last);
+    for (auto it = first; it != last; ++it) {
+        inotify_rm_watch(m_fd, it->second);
+        m_paths.erase(it->second);
+    }
+    m_wds.erase(first, last);
+}
+
+void DirectoryWatcher::moveTree(const std::string &path, const std::string &newPath) {
+    std::vector<std::pair<std::string, int>> moved;
+    auto self = m_wds.find(path);
+    if (self != m_wds.end()) {
+        moved.push_back(*self);
+        m_wds.erase(self);
+    }
+    std::map<std::string, int>::iterator first, last;
+    subtree(path, first, last);
+    moved.insert(moved.end(), first, last);
+    m_wds.erase(first, last);
+    for (const auto &entry : moved) {
+        std::string renamed = newPath + entry.first.substr(path.size());
+        m_paths[entry.second] = renamed;
+        m_wds[renamed] = entry.second;
+    }
+}
+
+void DirectoryWatcher::note(const std::string &path, uint32_t mask) {
+    auto it = m_changeIndex.find(path);
+    if (it != m_changeIndex.end()) {
+        m_changes[it->second].mask |= mask;
+        return;
+    }
+    m_changeIndex[path] = m_changes.size();
+    Change change = {path, mask};
+    m_changes.push_back(change);
+}
+
+bool DirectoryWatcher::readEvents() {
+    char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool any = false;
+    ssize_t len;
+    while ((len = read(m_fd, buf, sizeof(buf))) > 0) {
+        any = true;
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                note("", IN_Q_OVERFLOW);
+                continue;
+            }
+            auto dir = m_paths.find(event->wd);
+            if (dir == m_paths.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // Removed, or on a file system that went away
+                m_wds.erase(dir->second);
+                m_paths.erase(dir);
+                continue;
+            }
+            if (event->len == 0) {
+                note(dir->second, event->mask);
+                continue;
+            }
+            std::string path = join(dir->second, event->name);
+            note(path, event->mask);
+            if (!m_recursive || !(event->mask & IN_ISDIR)) {
+                continue;
+            }
+            if (event->mask & IN_CREATE) {
+                addTree(path, true);
+            } else if (event->mask & IN_MOVED_FROM) {
+                m_movedFrom[event->cookie] = path;
+            } else if (event->mask & IN_MOVED_TO) {
+                auto from = m_movedFrom.find(event->cookie);
+                if (from != m_movedFrom.end()) {
+                    moveTree(from->second, path);
+                    m_movedFrom.erase(from);
+                } else {
+                    addTree(path, true);
+                }
+            }
+        }
+    }
+    return any;
+}
+
+void DirectoryWatcher::takeChanges(std::vector<Change> &changes) {
+    // A move whose other half never came took the directory out of the tree
+    for (auto &from : m_movedFrom) {
+        removeTree(from.second);
+    }
+    m_movedFrom.clear();
+    changes.clear();
+    changes.swap(m_changes);
+    m_changeIndex.clear();
+}
+
+std::string DirectoryWatcher::maskNames(uint32_t mask) {
+    static const struct {
+        uint32_t bit;
+        const char *name;
+    } NAMES[] = {
+        {IN_CREATE, "CREATE"}, {IN_DELETE, "DELETE"}, {IN_MODIFY, "MODIFY"}, {IN_CLOSE_WRITE, "CLOSE_WRITE"},
+        {IN_MOVED_FROM, "MOVED_FROM"}, {IN_MOVED_TO, "MOVED_TO"}, {IN_ATTRIB, "ATTRIB"}, {IN_ISDIR, "ISDIR"},
+        {IN_Q_OVERFLOW, "OVERFLOW"},
+    };
+    std::string names;
+    for (const auto &entry : NAMES) {
+        if (mask & entry.bit) {
+            names += (names.empty() ? "" : ",") + std::string(entry.name);
+        }
+    }
+    return names;
+}
@@ -0,0 +1,95 @@
+#ifndef SMASH__DIRWATCH_H_
+#define SMASH__DIRWATCH_H_
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// inotify watches on a directory and, recursively, every directory below
+// it. The tree is walked once with scanDirectory(); after that directories
+// created, moved in, moved around or removed are followed from the events
+// alone, so a tree of any size is never rescanned. Events are coalesced:
+// each path changed since the last takeChanges() is reported once, with
+// every kind of event it saw.
+class DirectoryWatcher {
+public:
+    struct Change {
+        // Relative to the watched directory; "" for the directory itself
+        std::string path;
+        // IN_* bits seen; IN_Q_OVERFLOW alone when the kernel dropped events
+        uint32_t mask;
+    };
+
+    DirectoryWatcher();
+
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(DirectoryWatcher const &) = delete;
+    void operator=(DirectoryWatcher const &) = delete;
+
+    // Watches dir, an absolute path, and if recursive the directories below
+    // it. Returns false with errno set if dir itself cannot be watched;
+    // directories below it that cannot be are only counted in failures().
+    bool start(const std::string &dir, bool recursive);
+
+    // For poll(): readable when events are waiting.
+    int fd() const;
+
+    // Reads the waiting events into the pending changes, watching new
+    // directories as they appear. Returns whether there were any.
+    bool readEvents();
+
+    // Hands over the pending changes in the order they were first seen.
+    void takeChanges(std::vector<Change> &changes);
+
+    size_t watchCount() const;
+
+    // Directories left unwatched, and the errno of the last one (ENOSPC
+    // when fs.inotify.max_user_watches is reached).
+    size_t failures() const;
+
+    int lastError() const;
+
+    // "CREATE,CLOSE_WRITE" and so on.
+    static std::string maskNames(uint32_t mask);
+
+private:
+    // Watches path and, recursively, what is below it. Entries found
+    // inside are reported as created if report is set: they appeared
+    // before the directory's own watch did.
+    void addTree(const std::string &path, bool report);
+
+    bool addWatch(const std::string &path);
+
+    // A directory moved out of the tree or removed: its watches go.
+    void removeTree(const std::string &path);
+
+    // Renames path, and every directory below it, to newPath.
+    void moveTree(const std::string &path, const std::string &newPath);
+
+    // The watches strictly below path, as a range of m_wds.
+    void subtree(const std::string &path, std::map<std::string, int>::iterator &first,
+                 std::map<std::string, int>::iterator &last);
+
+    void note(const std::string &path, uint32_t mask);
+
+    std::string absolute(const std::string &path) const;
+
+    int m_fd;
+    std::string m_root;
+    bool m_recursive;
+    std::unordered_map<int, std::string> m_paths;
+    // Ordered by path, so the directories below one form a single range
+    std::map<std::string, int> m_wds;
+    // Directories moved away, by cookie, until their IN_MOVED_TO shows up
+    std::unordered_map<uint32_t, std::string> m_movedFrom;
+    std::vector<Change> m_changes;
+    std::unordered_map<std::string, size_t> m_changeIndex;
+    size_t m_failures;
+    int m_lastError;
+};
+
+#endif //SMASH__DIRWATCH_H_
@@ -0,0 +1,341 @@
+#include "editor.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "output.h"
+
+namespace {
+
+const int CTRL_A = 1;
+const int CTRL_C = 3;
+const int CTRL_D = 4;
+const int CTRL_E = 5;
+const int CTRL_G = 7;
+const int CTRL_H = 8;
+const int CTRL_K = 11;
+const int CTRL_L = 12;
+const int CTRL_R = 18;
+const int CTRL_U = 21;
+const int CTRL_W = 23;
+const int ESC = 27;
+const int BACKSPACE = 127;
+
+// Candidates a double Tab shows before giving up
+const size_t LIST_LIMIT = 100;
+
+}
+
+//-------------------------------------LineEditor-------------------------------------
+
+LineEditor::LineEditor(int inFd, int outFd, History &history, Completer &completer) :
+    m_in(inFd), m_out(outFd), m_history(history), m_completer(completer), m_usable(false),
+    m_cursor(0), m_historyIndex(-1), m_lastWasTab(false) {
+    m_usable = isatty(inFd) && isatty(outFd) && tcgetattr(inFd, &m_cooked) == 0;
+}
+
+bool LineEditor::usable() const {
+    return m_usable;
+}
+
+int LineEditor::readByte() {
+    unsigned char c;
+    ssize_t n;
+    do {
+        n = read(m_in, &c, 1);
+    } while (n == -1 && errno == EINTR);
+    return n == 1 ? c : -1;
+}
+
+void LineEditor::write(const std::string &s) {
+    writeAll(m_out, s.data(), s.size());
+}
+
+void LineEditor::refresh() {
+    std::string s = "\r" + m_prompt + m_line + "\x1b[K";
+    if (m_cursor < m_line.size()) {
+        s += "\x1b[" + std::to_string(m_line.size() - m_cursor) + "D";
+    }
+    write(s);
+}
+
+void LineEditor::insert(const std::string &s) {
+    m_line.insert(m_cursor, s);
+    m_cursor += s.size();
+}
+
+void LineEditor::complete(bool list) {
+    size_t start = m_line.find_last_of(" \t", m_cursor == 0 ? 0 : m_cursor - 1);
+    start = (start == std::string::npos || start >= m_cursor) ? 0 : start + 1;
+    if (m_cursor > 0 && (m_line[m_cursor - 1] == ' ' || m_line[m_cursor - 1] == '\t')) {
+        start = m_cursor;
+    }
+    std::string word = m_line.substr(start, m_cursor - start);
+    // The first word of a command names a program, the rest are paths
+    size_t before = m_line.find_last_not_of(" \t", start == 0 ? std::string::npos : start - 1);
+    bool command = start == 0 || before == std::string::npos || m_line[before] == '|' ||
+                   m_line[before] == ';' || m_line[before] == '&';
+
+    Completion completion;
+    m_completer.complete(word, command, list, LIST_LIMIT, completion);
+    if (completion.matches.empty()) {
+        write("\a");
+        return;
+    }
+    if (list) {
+        size_t slash = word.rfind('/');
+        size_t skip = command || slash == std::string::npos ? 0 : slash + 1;
+        std::string listing = "\r\n";
+        for (const std::string &match : completion.matches) {
+            listing += match.substr(skip) + "  ";
+        }
+        if (completion.truncated) {
+            listing += "\r\n(more than " + std::to_string(LIST_LIMIT) + " matches)";
+        }
+        listing += "\r\n";
+        write(listing);
+        refresh();
+        return;
+    }
+    std::string replacement;
+    if (completion.matches.size() == 1 && !completion.truncated) {
+        replacement = completion.matches[0];
+        if (replacement.empty() || replacement.back() != '/') {
+            replacement += ' ';
+        }
+    } else if (completion.common.size() > word.size()) {
+        replacement = completion.common;
+    } else {
+        write("\a");
+        return;
+    }
+    m_line.replace(start, word.size(), replacement);
+    m_cursor = start + replacement.size();
+    refresh();
+}
+
+void LineEditor::historyMove(long delta) {
+    long total = static_cast<long>(m_history.size());
+    if (m_historyIndex < 0) {
+        m_historyIndex = total;
+        m_typed = m_line;
+    }
+    long index = m_historyIndex + delta;
+    if (index < 0 || index > total) {
+        write("\a");
+        return;
+    }
+    m_historyIndex = index;
+    if (index == total) {
+        m_line = m_typed;
+    } else {
+        size_t len;
+        const char *text = m_history.entry(index, len);
+        m_line.assign(text, len);
+    }
+    m_cursor = m_line.size();
+    refresh();
+}
+
+bool LineEditor::reverseSearch() {
+    std::string query;
+    long total = static_cast<long>(m_history.size());
+    long match = -1;
+    bool failing = false;
+    while (true) {
+        std::string shown;
+        if (match >= 0) {
+            size_t len;
+            const char *text = m_history.entry(match, len);
+            shown.assign(text, len);
+        }
+        write(std::string("\r(") + (failing ? "failing " : "") + "reverse-i-search)`" + query + "': " +
+              shown + "\x1b[K");
+        int c = readByte();
+        if (c == CTRL_R) {
+            long next = query.empty() || match < 0 ? -1 : m_history.search(query, match);
+            failing = next < 0;
+            if (next >= 0) {
+                match = next;
+            } else {
+                write("\a");
+            }
+        } else if (c == BACKSPACE || c == CTRL_H) {
+            if (!query.empty()) {
+                query.pop_back();
+            }
+            match = query.empty() ? -1 : m_history.search(query, total);
+            failing = !query.empty() && match < 0;
+        } else if (c >= 32 && c < 127) {
+            query += static_cast<char>(c);
+            // A longer query can only match the current entry or older ones
+            long next = m_history.search(query, match >= 0 ? match + 1 : total);
+            failing = next < 0;
+            if (next >= 0) {
+                match = next;
+            } else {
+                write("\a");
+            }
+        } else if (c == CTRL_G || c == ESC || c == -1) {
+            refresh();
+            return false;
+        } else {
+            if (match >= 0) {
+                m_line = shown;
+                m_cursor = m_line.size();
+            }
+            refresh();
+            return c == '\r' || c == '\n';
+        }
+    }
+}
+
+bool LineEditor::readLine(const std::string &prompt, std::string &line) {
+    struct termios raw = m_cooked;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    // ISIG off: ctrl-C is read as a key and handed to the shell's handler
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(m_in, TCSADRAIN, &raw);
+
+    m_prompt = prompt;
+    m_line.clear();
+    m_cursor = 0;
+    m_historyIndex = -1;
+    m_lastWasTab = false;
+    write(m_prompt);
+
+    bool gotLine = true;
+    bool done = false;
+    while (!done) {
+        int c = readByte();
+        bool tab = c == '\t';
+        switch (c) {
+            case -1:
+                gotLine = !m_line.empty();
+                done = true;
+                break;
+            case '\r':
+            case '\n':
+                done = true;
+                break;
+            case '\t':
+                complete(m_lastWasTab);
+                break;
+            case CTRL_C:
+                write("^C\r\n");
+                raise(SIGINT);
+                m_line.clear();
+                m_cursor = 0;
+                m_historyIndex = -1;
+                refresh();
+                break;
+            case CTRL_D:
+                if (m_line.empty()) {
+                    gotLine = false;
+                    done = true;
+                } else if (m_cursor < m_line.size()) {
+                    m_line.erase(m_cursor, 1);
+                    refresh();
+                }
+                break;
+            case BACKSPACE:
+            case CTRL_H:
+                if (m_cursor > 0) {
+                    m_line.erase(--m_cursor, 1);
+                    refresh();
+                }
+                break;
+            case CTRL_A:
+                m_cursor = 0;
+                refresh();
+                break;
+            case CTRL_E:
+                m_cursor = m_line.size();
+                refresh();
+                break;
+            case CTRL_K:
+                m_line.erase(m_cursor);
+                refresh();
+                break;
+            case CTRL_U:
+                m_line.erase(0, m_cursor);
+                m_cursor = 0;
+                refresh();
+                break;
+            case CTRL_W: {
+                size_t start = m_cursor;
+                while (start > 0 && m_line[start - 1] == ' ') {
+                    --start;
+                }
+                while (start > 0 && m_line[start - 1] != ' ') {
+                    --start;
+                }
+                m_line.erase(start, m_cursor - start);
+                m_cursor = start;
+                refresh();
+                break;
+            }
+            case CTRL_L:
+                write("\x1b[H\x1b[2J");
+                refresh();
+                break;
+            case CTRL_R:
+                done = reverseSearch();
+                break;
+            case ESC: {
+                int kind = readByte();
+                if (kind != '[' && kind != 'O') {
+                    break;
+                }
+                int key = readByte();
+                if (key >= '0' && key <= '9') {
+                    // ESC [ n ~
+                    int tilde = readByte();
+                    while (tilde != -1 && tilde != '~') {
+                        tilde = readByte();
+                    }
+                    key = key == '3' ? 'X' : (key == '1' || key == '7') ? 'H' : (key == '4' || key == '8') ? 'F' : 0;
+                }
+                if (key == 'A') {
+                    historyMove(-1);
+                } else if (key == 'B') {
+                    historyMove(1);
+                } else if (key == 'C' && m_cursor < m_line.size()) {
+                    ++m_cursor;
+                    refresh();
+                } else if (key == 'D' && m_cursor > 0) {
+                    --m_cursor;
+                    refresh();
+                } else if (key == 'H') {
+                    m_cursor = 0;
+                    refresh();
+                } else if (key == 'F') {
+                    m_cursor = m_line.size();
+                    refresh();
+                } else if (key == 'X' && m_cursor < m_line.size()) {
+                    m_line.erase(m_cursor, 1);
+                    refresh();
+                }
+                break;
+            }
+            default:
+                if (c >= 32 && c != BACKSPACE) {
+                    insert(std::string(1, static_cast<char>(c)));
+                    if (m_cursor == m_line.size()) {
+                        write(std::string(1, static_cast<char>(c)));
+                    } else {
+                        refresh();
+                    }
+                }
+                break;
+        }
+        m_lastWasTab = tab;
+    }
+    write("\r\n");
+    tcsetattr(m_in, TCSADRAIN, &m_cooked);
+    line = m_line;
+    return gotLine;
+}
@@ -0,0 +1,61 @@
+#ifndef SMASH__EDITOR_H_
+#define SMASH__EDITOR_H_
+
+#include <string>
+#include <termios.h>
+#include "complete.h"
+#include "history.h"
+
+// Line editing for an interactive smash on a terminal. The terminal is in
+// raw mode only while a line is being read, so children always start in the
+// normal mode. Keys: arrows, Home/End, ctrl-A/E/K/U/W/L, up/down through
+// history, ctrl-R incremental history search, Tab to complete (twice to
+// list the candidates).
+class LineEditor {
+public:
+    LineEditor(int inFd, int outFd, History &history, Completer &completer);
+
+    LineEditor(LineEditor const &) = delete;
+    void operator=(LineEditor const &) = delete;
+
+    // Whether inFd is a terminal we can switch to raw mode.
+    bool usable() const;
+
+    // Reads one line after showing prompt. Returns false at end of input
+    // (ctrl-D on an empty line).
+    bool readLine(const std::string &prompt, std::string &line);
+
+private:
+    // Next byte, or -1 at end of input
+    int readByte();
+
+    void write(const std::string &s);
+
+    void refresh();
+
+    void insert(const std::string &s);
+
+    void complete(bool list);
+
+    void historyMove(long delta);
+
+    // ctrl-R; returns true if Enter accepted the match
+    bool reverseSearch();
+
+    int m_in;
+    int m_out;
+    History &m_history;
+    Completer &m_completer;
+    bool m_usable;
+    struct termios m_cooked;
+
+    std::string m_prompt;
+    std::string m_line;
+    size_t m_cursor;
+    // Entry shown by up/down; size() for the line being typed
+    long m_historyIndex;
+    std::string m_typed;
+    bool m_lastWasTab;
+};
+
+#endif //SMASH__EDITOR_H_
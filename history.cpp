@@ -0,0 +1,345 @@
+#include "history.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+// Backward search reads the mapped file in windows that start small and
+// double up to the maximum, so a recent match costs a few hundred bytes
+// rather than the whole file.
+const size_t SEARCH_WINDOW_MIN = 1 << 10;
+const size_t SEARCH_WINDOW_MAX = 1 << 18;
+
+// "!prefix" checks this many of the newest records one by one before it
+// turns to the index, which is sorted on first use.
+const long PREFIX_SCAN_RECENT = 4096;
+
+}
+
+//-------------------------------------History-------------------------------------
+
+History::History() : m_fd(-1), m_loaded(false), m_loadLimit(0), m_map(nullptr), m_mapSize(0),
+  m_prefixIndexed(false) {}
+
+History::~History() {
+    if (m_map) {
+        munmap(const_cast<char *>(m_map), m_mapSize);
+    }
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+void History::setPath(const std::string &path) {
+    m_path = path;
+}
+
+bool History::openForAppend() {
+    if (m_fd != -1) {
+        return true;
+    }
+    if (m_path.empty()) {
+        return false;
+    }
+    m_fd = open(m_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd == -1) {
+        perror("smash error: history: open failed");
+        m_path.clear();
+        return false;
+    }
+    struct stat st;
+    if (!m_loaded) {
+        m_loadLimit = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    }
+    return true;
+}
+
+void History::add(const std::string &line) {
+    if (line.find_first_not_of(" \t\n\r\f\v") == std::string::npos) {
+        return;
+    }
+    m_session.push_back(line);
+    if (!openForAppend()) {
+        return;
+    }
+    std::string record = ":" + std::to_string(line.size()) + ":" + line + "\n";
+    // One write per record: O_APPEND keeps it whole next to other shells'
+    ssize_t written;
+    do {
+        written = write(m_fd, record.data(), record.size());
+    } while (written == -1 && errno == EINTR);
+    if (written == -1) {
+        perror("smash error: history: write failed");
+    }
+}
+
+void History::load() {
+    if (m_loaded) {
+        return;
+    }
+    m_loaded = true;
+    if (m_path.empty()) {
+        return;
+    }
+    int fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    struct stat st;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0) {
+        size = m_fd != -1 ? static_cast<size_t>(m_loadLimit) : static_cast<size_t>(st.st_size);
+    }
+    if (size > 0) {
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            m_map = static_cast<const char *>(map);
+            m_mapSize = size;
+            madvise(map, size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+
+    const char *p = m_map;
+    const char *end = m_map + m_mapSize;
+    while (p < end) {
+        // ":LENGTH:TEXT\n"; anything else is a torn record, skip its line
+        const char *q = p + 1;
+        uint64_t length = 0;
+        while (q < end && isdigit(static_cast<unsigned char>(*q))) {
+            length = length * 10 + (*q++ - '0');
+        }
+        if (*p == ':' && q > p + 1 && q < end && *q == ':' &&
+            length < static_cast<uint64_t>(end - q - 1) && q[1 + length] == '\n') {
+            Record record = {static_cast<uint64_t>(q + 1 - m_map), static_cast<uint32_t>(length)};
+            m_records.push_back(record);
+            p = q + 2 + length;
+            continue;
+        }
+        const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+        p = newline ? newline + 1 : end;
+    }
+}
+
+size_t History::size() {
+    load();
+    return m_records.size() + m_session.size();
+}
+
+const char *History::entry(size_t index, size_t &len) {
+    load();
+    if (index < m_records.size()) {
+        len = m_records[index].length;
+        return m_map + m_records[index].offset;
+    }
+    const std::string &line = m_session[index - m_records.size()];
+    len = line.size();
+    return line.data();
+}
+
+long History::search(const std::string &needle, long before) {
+    long total = static_cast<long>(size());
+    if (before > total) {
+        before = total;
+    }
+    if (before <= 0) {
+        return -1;
+    }
+    if (needle.empty()) {
+        return before - 1;
+    }
+    const size_t n = needle.size();
+    long mapped = static_cast<long>(m_records.size());
+    for (long i = before - 1; i >= mapped; --i) {
+        const std::string &line = m_session[i - mapped];
+        if (line.find(needle) != std::string::npos) {
+            return i;
+        }
+    }
+    if (std::min(before, mapped) == 0) {
+        return -1;
+    }
+
+    // The records are contiguous in the map: search the raw bytes backwards
+    // window by window, then check a hit lies inside one record's text.
+    const Record &last = m_records[std::min(before, mapped) - 1];
+    const size_t lo = m_records[0].offset;
+    const size_t hi = last.offset + last.length;
+    std::vector<size_t> hits;
+    size_t window = SEARCH_WINDOW_MIN;
+    for (size_t windowEnd = hi; windowEnd > lo;) {
+        size_t windowStart = windowEnd - lo > window ? windowEnd - window : lo;
+        window = std::min(window * 2, SEARCH_WINDOW_MAX);
+        size_t scanEnd = std::min(windowEnd + n - 1, hi);
+        hits.clear();
+        const char *p = m_map + windowStart;
+        const char *scanLimit = m_map + scanEnd;
+        while (p + n <= scanLimit) {
+            const char *hit = static_cast<const char *>(memmem(p, scanLimit - p, needle.data(), n));
+            if (hit == nullptr || static_cast<size_t>(hit - m_map) >= windowEnd) {
+                break;
+            }
+            hits.push_back(hit - m_map);
+            p = hit + 1;
+        }
+        for (auto it = hits.rbegin(); it != hits.rend(); ++it) {
+            auto record = std::upper_bound(m_records.begin(), m_records.end(), *it,
+                                           [](size_t pos, const Record &r) { return pos < r.offset; });
+            if (record == m_records.begin()) {
+                continue;
+            }
+            --record;
+            if (*it + n <= record->offset + record->length) {
+                return record - m_records.begin();
+            }
+        }
+        windowEnd = windowStart;
+    }
+    return -1;
+}
+
+void History::indexPrefixes() {
+    m_prefixIndexed = true;
+    const size_t count = m_records.size();
+    m_sorted.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        m_sorted[i] = static_cast<uint32_t>(i);
+    }
+    std::sort(m_sorted.begin(), m_sorted.end(), [this](uint32_t a, uint32_t b) {
+        const Record &ra = m_records[a];
+        const Record &rb = m_records[b];
+        int order = memcmp(m_map + ra.offset, m_map + rb.offset, std::min(ra.length, rb.length));
+        return order != 0 ? order < 0 : ra.length < rb.length;
+    });
+    m_newest.resize(2 * count);
+    std::copy(m_sorted.begin(), m_sorted.end(), m_newest.begin() + count);
+    for (size_t i = count - 1; i > 0; --i) {
+        m_newest[i] = std::max(m_newest[2 * i], m_newest[2 * i + 1]);
+    }
+}
+
+long History::findPrefix(const std::string &prefix) {
+    const size_t n = prefix.size();
+    auto matches = [&prefix, n](const char *text, size_t len) {
+        return len >= n && memcmp(text, prefix.data(), n) == 0;
+    };
+    long mapped = static_cast<long>(size()) - static_cast<long>(m_session.size());
+    for (long i = static_cast<long>(m_session.size()) - 1; i >= 0; --i) {
+        if (matches(m_session[i].data(), m_session[i].size())) {
+            return mapped + i;
+        }
+    }
+    // A recent command is what "!prefix" usually names
+    long oldestScanned = std::max(0L, mapped - PREFIX_SCAN_RECENT);
+    for (long i = mapped - 1; i >= oldestScanned; --i) {
+        if (matches(m_map + m_records[i].offset, m_records[i].length)) {
+            return i;
+        }
+    }
+    if (oldestScanned == 0) {
+        return -1;
+    }
+    if (!m_prefixIndexed) {
+        indexPrefixes();
+    }
+
+    // The records starting with prefix are a run of the sorted order, after
+    // those that sort below it
+    auto first = std::partition_point(m_sorted.begin(), m_sorted.end(), [this, &prefix, n](uint32_t i) {
+        const Record &r = m_records[i];
+        int order = memcmp(m_map + r.offset, prefix.data(), std::min<size_t>(r.length, n));
+        return order != 0 ? order < 0 : r.length < n;
+    });
+    auto last = std::partition_point(first, m_sorted.end(), [this, &matches](uint32_t i) {
+        return matches(m_map + m_records[i].offset, m_records[i].length);
+    });
+    long newest = -1;
+    size_t lo = (first - m_sorted.begin()) + m_sorted.size();
+    size_t hi = (last - m_sorted.begin()) + m_sorted.size();
+    for (; lo < hi; lo >>= 1, hi >>= 1) {
+        if (lo & 1) {
+            newest = std::max(newest, static_cast<long>(m_newest[lo++]));
+        }
+        if (hi & 1) {
+            newest = std::max(newest, static_cast<long>(m_newest[--hi]));
+        }
+    }
+    return newest;
+}
+
+bool History::expand(const std::string &line, std::string &expanded) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line[start] != '!' || start + 1 >= line.size() ||
+        isspace(static_cast<unsigned char>(line[start + 1])) || line[start + 1] == '=') {
+        expanded = line;
+        return true;
+    }
+    size_t end = line.find_first_of(" \t", start);
+    if (end == std::string::npos) {
+        end = line.size();
+    }
+    std::string event = line.substr(start, end - start);
+    long total = static_cast<long>(size());
+    long index = -1;
+    if (event == "!!") {
+        index = total - 1;
+    } else if (isdigit(static_cast<unsigned char>(event[1]))) {
+        char *numberEnd;
+        long number = strtol(event.c_str() + 1, &numberEnd, 10);
+        if (*numberEnd == '\0' && number >= 1 && number <= total) {
+            index = number - 1;
+        }
+    } else {
+        index = findPrefix(event.substr(1));
+    }
+    if (index < 0) {
+        expanded = event;
+        return false;
+    }
+    size_t len;
+    const char *text = entry(index, len);
+    expanded = line.substr(0, start);
+    expanded.append(text, len);
+    expanded += line.substr(end);
+    return true;
+}
+
+void History::printEntry(std::ostream &out, size_t index, std::string &line) {
+    char number[24];
+    size_t len;
+    const char *text = entry(index, len);
+    snprintf(number, sizeof(number), "%5zu  ", index + 1);
+    line = number;
+    line.append(text, len);
+    line += '\n';
+    out << line;
+}
+
+void History::print(std::ostream &out, size_t last) {
+    size_t total = size();
+    size_t first = last != 0 && last < total ? total - last : 0;
+    std::string line;
+    for (size_t i = first; i < total; ++i) {
+        printEntry(out, i, line);
+    }
+}
+
+void History::printMatches(std::ostream &out, const std::string &needle) {
+    std::vector<long> matches;
+    for (long i = search(needle, static_cast<long>(size())); i >= 0; i = search(needle, i)) {
+        matches.push_back(i);
+    }
+    std::string line;
+    for (auto it = matches.rbegin(); it != matches.rend(); ++it) {
+        printEntry(out, *it, line);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef SMASH__HISTORY_H_
+#define SMASH__HISTORY_H_
+
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Command history kept in an append-only file shared by every smash. Each
+// line is one ":LENGTH:TEXT\n" record written with a single O_APPEND write,
+// so concurrent shells never interleave inside a record, and a torn record
+// is skipped on load. The file is mmap'd and indexed on first use rather
+// than at startup; entries added since live in memory.
+class History {
+public:
+    History();
+
+    ~History();
+
+    History(History const &) = delete;
+    void operator=(History const &) = delete;
+
+    // File to load from and append to; "" keeps history in memory only.
+    // Nothing is opened or read here.
+    void setPath(const std::string &path);
+
+    // Records line unless it is blank.
+    void add(const std::string &line);
+
+    size_t size();
+
+    // Entry by 0-based index; len gets its length.
+    const char *entry(size_t index, size_t &len);
+
+    // Index of the newest entry below `before` containing needle, or -1.
+    // Calling it again with before = the last match walks further back, as
+    // an incremental (ctrl-R style) search does.
+    long search(const std::string &needle, long before);
+
+    // Replaces a leading "!!", "!n" or "!prefix" event with the entry it
+    // names. Returns false (expanded holds the event) if there is none.
+    bool expand(const std::string &line, std::string &expanded);
+
+    // Numbered like bash, starting at 1; only the last `last` if non-zero.
+    void print(std::ostream &out, size_t last);
+
+    // The entries containing needle, oldest first, numbered like print().
+    void printMatches(std::ostream &out, const std::string &needle);
+
+private:
+    struct Record {
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    void load();
+
+    bool openForAppend();
+
+    void printEntry(std::ostream &out, size_t index, std::string &line);
+
+    // Newest entry starting with prefix, or -1.
+    long findPrefix(const std::string &prefix);
+
+    // Builds m_sorted and m_newest over the loaded records.
+    void indexPrefixes();
+
+    std::string m_path;
+    int m_fd;
+    bool m_loaded;
+    // Bytes in the file before this shell appended anything; only they are
+    // loaded, what we appended is in m_session already
+    off_t m_loadLimit;
+    const char *m_map;
+    size_t m_mapSize;
+    std::vector<Record> m_records;
+    std::deque<std::string> m_session;
+    // Built on the first "!prefix" the recent records do not answer: the
+    // records' indices sorted by text, and over that order a segment tree
+    // (leaves from m_sorted.size() on) of the newest index in each range
+    bool m_prefixIndexed;
+    std::vector<uint32_t> m_sorted;
+    std::vector<uint32_t> m_newest;
+};
+
+#endif //SMASH__HISTORY_H_
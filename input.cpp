@@ -0,0 +1,113 @@
+#include "input.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+LineReader::LineReader(int fd) :
+    m_fd(fd), m_map(nullptr), m_mapSize(0), m_bufferPos(0), m_bufferEnd(0),
+    m_seekable(false), m_offset(0), m_resync(false), m_eof(false) {
+    m_offset = lseek(fd, 0, SEEK_CUR);
+    m_seekable = m_offset != -1;
+    if (!m_seekable) {
+        m_offset = 0;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        void *map = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, sb.st_size, MADV_SEQUENTIAL);
+            m_map = static_cast<const char *>(map);
+            m_mapSize = sb.st_size;
+            return;
+        }
+    }
+    m_buffer.resize(CHUNK_SIZE);
+}
+
+LineReader::~LineReader() {
+    if (m_map) {
+        munmap(const_cast<char *>(m_map), m_mapSize);
+    }
+}
+
+bool LineReader::fill() {
+    // Keep the unfinished line, make room behind it
+    size_t pending = m_bufferEnd - m_bufferPos;
+    if (m_bufferPos > 0) {
+        memmove(m_buffer.data(), m_buffer.data() + m_bufferPos, pending);
+        m_bufferPos = 0;
+        m_bufferEnd = pending;
+    }
+    if (m_bufferEnd == m_buffer.size()) {
+        m_buffer.resize(m_buffer.size() * 2);
+    }
+    ssize_t len;
+    do {
+        len = read(m_fd, m_buffer.data() + m_bufferEnd, m_buffer.size() - m_bufferEnd);
+    } while (len == -1 && errno == EINTR);
+    if (len <= 0) {
+        m_eof = true;
+        return false;
+    }
+    m_bufferEnd += len;
+    return true;
+}
+
+bool LineReader::next(std::string &line) {
+    if (m_resync) {
+        // Continue wherever the last child left the shared offset
+        m_offset = lseek(m_fd, 0, SEEK_CUR);
+        m_bufferPos = m_bufferEnd = 0;
+        m_eof = false;
+        m_resync = false;
+    }
+
+    if (m_map) {
+        if (static_cast<size_t>(m_offset) >= m_mapSize) {
+            return false;
+        }
+        const char *start = m_map + m_offset;
+        size_t left = m_mapSize - m_offset;
+        const char *newline = static_cast<const char *>(memchr(start, '\n', left));
+        size_t len = newline ? newline - start : left;
+        line.assign(start, len);
+        m_offset += newline ? len + 1 : len;
+        return true;
+    }
+
+    while (true) {
+        const char *start = m_buffer.data() + m_bufferPos;
+        size_t left = m_bufferEnd - m_bufferPos;
+        const char *newline = static_cast<const char *>(memchr(start, '\n', left));
+        if (newline) {
+            size_t len = newline - start;
+            line.assign(start, len);
+            m_bufferPos += len + 1;
+            m_offset += len + 1;
+            return true;
+        }
+        if (m_eof || !fill()) {
+            if (m_bufferPos == m_bufferEnd) {
+                return false;
+            }
+            // Last line without a trailing newline
+            line.assign(m_buffer.data() + m_bufferPos, m_bufferEnd - m_bufferPos);
+            m_offset += m_bufferEnd - m_bufferPos;
+            m_bufferPos = m_bufferEnd;
+            return true;
+        }
+    }
+}
+
+void LineReader::syncOffset() {
+    if (!m_seekable) {
+        return;
+    }
+    if (lseek(m_fd, m_offset, SEEK_SET) != -1) {
+        m_resync = true;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SMASH__INPUT_H_
+#define SMASH__INPUT_H_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Reads command lines from a file descriptor without iostreams. Regular
+// files are mmap'd and split in place; pipes and terminals are read in large
+// chunks.
+class LineReader {
+public:
+    explicit LineReader(int fd);
+
+    ~LineReader();
+
+    LineReader(LineReader const &) = delete;
+    void operator=(LineReader const &) = delete;
+
+    // Next line without its newline. Returns false at end of input.
+    bool next(std::string &line);
+
+    // Children share the shell's stdin, so before one runs move the fd offset
+    // back to just after the last line handed out (like bash does). Only
+    // possible for seekable input; a no-op otherwise.
+    void syncOffset();
+
+private:
+    static const size_t CHUNK_SIZE = 1 << 16;
+
+    bool fill();
+
+    int m_fd;
+    // mmap'd file, or nullptr when reading in chunks
+    const char *m_map;
+    size_t m_mapSize;
+    std::vector<char> m_buffer;
+    size_t m_bufferPos;
+    size_t m_bufferEnd;
+    bool m_seekable;
+    // File offset of the next unread byte (seekable input only)
+    off_t m_offset;
+    // A child may have moved the offset since syncOffset(): re-read it
+    bool m_resync;
+    bool m_eof;
+};
+
+#endif //SMASH__INPUT_H_
@@ -0,0 +1,164 @@
+#include "joblog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// Reads per ready pipe before the others get a turn
+const int READS_PER_WAKEUP = 4;
+
+}
+
+//-------------------------------------JobLog-------------------------------------
+
+JobLog::JobLog(size_t capacity) : m_capacity(capacity > 0 ? capacity : 1), m_total(0), m_closed(false) {}
+
+void JobLog::append(const char *data, size_t length) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Only the last m_capacity bytes can survive this write
+    if (length > m_capacity) {
+        m_total += length - m_capacity;
+        data += length - m_capacity;
+        length = m_capacity;
+    }
+    // The ring grows up to its capacity, then byte n lives at n % capacity
+    while (length > 0) {
+        size_t at = m_total % m_capacity;
+        size_t chunk = std::min(length, m_capacity - at);
+        if (m_ring.size() < m_capacity) {
+            m_ring.resize(std::min(m_capacity, at + chunk));
+        }
+        memcpy(m_ring.data() + at, data, chunk);
+        m_total += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    m_cond.notify_all();
+}
+
+void JobLog::close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_cond.notify_all();
+}
+
+uint64_t JobLog::read(uint64_t *offset, std::string &out) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t oldest = m_total - std::min<uint64_t>(m_total, m_ring.size());
+    uint64_t start = std::max(*offset, oldest);
+    uint64_t dropped = start - *offset;
+    while (start < m_total) {
+        size_t at = start % m_capacity;
+        size_t chunk = std::min<uint64_t>(m_total - start, m_capacity - at);
+        out.append(m_ring.data() + at, chunk);
+        start += chunk;
+    }
+    *offset = m_total;
+    return dropped;
+}
+
+bool JobLog::wait(uint64_t offset, int timeoutMs) const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                    [this, offset] { return m_total > offset || m_closed; });
+    return m_total > offset || !m_closed;
+}
+
+//-------------------------------------JobLogDrainer-------------------------------------
+
+JobLogDrainer &JobLogDrainer::getInstance() {
+    static JobLogDrainer *instance = new JobLogDrainer();
+    return *instance;
+}
+
+JobLogDrainer::JobLogDrainer() : m_epoll(epoll_create1(EPOLL_CLOEXEC)), m_owner(getpid()) {
+    if (m_epoll == -1) {
+        perror("smash error: epoll_create1 failed");
+        return;
+    }
+    // The drainer must not take the shell's signals
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    m_thread = std::thread(&JobLogDrainer::drainLoop, this);
+    m_thread.detach();
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+bool JobLogDrainer::usable() const {
+    return m_epoll != -1 && getpid() == m_owner;
+}
+
+bool JobLogDrainer::attach(int fd, const std::shared_ptr<JobLog> &log) {
+    if (!usable() || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+        close(fd);
+        log->close();
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_logs[fd] = log;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("smash error: epoll_ctl failed");
+        m_logs.erase(fd);
+        close(fd);
+        log->close();
+        return false;
+    }
+    return true;
+}
+
+void JobLogDrainer::drainLoop() {
+    struct epoll_event events[64];
+    char buf[65536];
+    while (true) {
+        int ready = epoll_wait(m_epoll, events, 64, -1);
+        if (ready == -1) {
+            if (errno != EINTR) {
+                perror("smash error: epoll_wait failed");
+                return;
+            }
+            continue;
+        }
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            std::shared_ptr<JobLog> log;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_logs.find(fd);
+                if (it == m_logs.end()) {
+                    continue;
+                }
+                log = it->second;
+            }
+            bool open = true;
+            for (int reads = 0; reads < READS_PER_WAKEUP; ++reads) {
+                ssize_t len = ::read(fd, buf, sizeof(buf));
+                if (len > 0) {
+                    log->append(buf, len);
+                    continue;
+                }
+                open = len == -1 && (errno == EAGAIN || errno == EINTR);
+                break;
+            }
+            if (!open) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                m_logs.erase(fd);
+                log->close();
+            }
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef SMASH__JOBLOG_H_
+#define SMASH__JOBLOG_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The last bytes a background job wrote, kept while "set JOBLOG=SIZE" is
+// on. Memory is bounded by the capacity: once it is full each write drops
+// the oldest bytes. Offsets count every byte ever appended, so a reader
+// that fell behind learns how much it missed instead of blocking the job.
+class JobLog {
+public:
+    explicit JobLog(size_t capacity);
+
+    JobLog(JobLog const &) = delete;
+    void operator=(JobLog const &) = delete;
+
+    void append(const char *data, size_t length);
+
+    // The job and everything it started have closed their output.
+    void close();
+
+    // Appends to out what was written from *offset on, and moves *offset
+    // past it. Returns how many of those bytes had been dropped already.
+    uint64_t read(uint64_t *offset, std::string &out) const;
+
+    // Waits up to timeoutMs for bytes past offset. Returns false once the
+    // log is closed and has nothing past offset.
+    bool wait(uint64_t offset, int timeoutMs) const;
+
+private:
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_cond;
+    std::vector<char> m_ring;
+    size_t m_capacity;
+    uint64_t m_total;
+    bool m_closed;
+};
+
+// The shell's event loop for captured output: one thread moves whatever any
+// job writes from its pipe into the job's JobLog, so a job never waits on
+// whoever reads its log. Created on first use and never destroyed, like
+// ChildReaper.
+class JobLogDrainer {
+public:
+    static JobLogDrainer &getInstance();
+
+    JobLogDrainer(JobLogDrainer const &) = delete;
+    void operator=(JobLogDrainer const &) = delete;
+
+    // False in a forked copy of the shell, where nothing would drain a pipe.
+    bool usable() const;
+
+    // Takes over fd, the read end of a job's output pipe, and fills log
+    // from it until end of file. Returns false (fd closed, log closed) if
+    // it cannot.
+    bool attach(int fd, const std::shared_ptr<JobLog> &log);
+
+private:
+    JobLogDrainer();
+
+    void drainLoop();
+
+    std::mutex m_mutex;
+    std::unordered_map<int, std::shared_ptr<JobLog>> m_logs;
+    int m_epoll;
+    // The process the draining thread runs in; a fork() does not copy it
+    pid_t m_owner;
+    std::thread m_thread;
+};
+
+#endif //SMASH__JOBLOG_H_
@@ -0,0 +1,163 @@
+#include "libsmash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "Commands.h"
+
+namespace {
+
+// One read from fd handed to callback. Returns what read() did: > 0 data,
+// 0 end of file, -1 nothing ready (or an error).
+ssize_t forward(int fd, const SmashSession::OutputCallback &callback, std::vector<char> &buf) {
+    ssize_t len;
+    do {
+        len = read(fd, buf.data(), buf.size());
+    } while (len == -1 && errno == EINTR);
+    if (len > 0 && callback) {
+        callback(buf.data(), len);
+    }
+    return len;
+}
+
+// Feeds input to the command and its output to the callbacks until stopFd
+// is closed, all from one thread, so a command that never reads its stdin
+// cannot hold up its output. Closes inFd.
+void pump(int inFd, const std::string &input, int outFd, int errFd, int stopFd,
+          const SmashSession::OutputCallback &onStdout, const SmashSession::OutputCallback &onStderr) {
+    std::vector<char> buf(65536);
+    int readers[2] = {outFd, errFd};
+    const SmashSession::OutputCallback *callbacks[2] = {&onStdout, &onStderr};
+    size_t written = 0;
+    if (input.empty()) {
+        close(inFd);
+        inFd = -1;
+    }
+    bool stopping = false;
+    while (!stopping) {
+        // poll() skips negative fds: streams already at end of file
+        struct pollfd fds[4] = {{stopFd, POLLIN, 0}, {readers[0], POLLIN, 0}, {readers[1], POLLIN, 0},
+                                {inFd, POLLOUT, 0}};
+        if (poll(fds, 4, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("smash error: poll failed");
+            break;
+        }
+        stopping = fds[0].revents != 0;
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i + 1].revents && forward(readers[i], *callbacks[i], buf) == 0) {
+                readers[i] = -1;
+            }
+        }
+        if (fds[3].revents) {
+            ssize_t len = write(inFd, input.data() + written, input.size() - written);
+            if (len > 0) {
+                written += len;
+            }
+            // EPIPE: the command exited without reading it all
+            if (written == input.size() || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+                close(inFd);
+                inFd = -1;
+            }
+        }
+    }
+    // The command has finished: what is in the pipes now is all of its
+    // output. A background job may still hold them open, so no waiting for EOF.
+    for (int i = 0; i < 2; ++i) {
+        while (readers[i] != -1 && forward(readers[i], *callbacks[i], buf) > 0) {
+        }
+    }
+    if (inFd != -1) {
+        close(inFd);
+    }
+}
+
+}
+
+//-------------------------------------SmashSession-------------------------------------
+
+SmashSession::SmashSession() : m_shell(new SmallShell(true)) {}
+
+SmashSession::~SmashSession() {}
+
+int SmashSession::run(const std::string &cmdLine, const std::string &input,
+                      const OutputCallback &onStdout, const OutputCallback &onStderr) {
+    std::lock_guard<std::mutex> lock(m_runLock);
+    if (m_shell->hasQuit()) {
+        static const char message[] = "smash error: session has quit\n";
+        if (onStderr) {
+            onStderr(message, sizeof(message) - 1);
+        }
+        return 1;
+    }
+
+    // stdin, stdout, stderr and the pump's stop signal
+    int pipes[4][2] = {{-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}};
+    for (int i = 0; i < 4; ++i) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
+            perror("smash error: pipe failed");
+            for (int j = 0; j < i; ++j) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            return 1;
+        }
+    }
+    int (&in)[2] = pipes[0];
+    int (&out)[2] = pipes[1];
+    int (&err)[2] = pipes[2];
+    int (&stop)[2] = pipes[3];
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    fcntl(err[0], F_SETFL, O_NONBLOCK);
+
+    // The pump must not take the host's signals, nor die of SIGPIPE
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    std::thread pumper(pump, in[1], std::cref(input), out[0], err[0], stop[0], std::cref(onStdout),
+                       std::cref(onStderr));
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    // Through the usual redirection path: applied in the child for externals,
+    // streams on the pipes for built-ins
+    RedirectionList redirections;
+    redirections.addDuplicate(STDIN_FILENO, in[0]);
+    redirections.addDuplicate(STDOUT_FILENO, out[1]);
+    redirections.addDuplicate(STDERR_FILENO, err[1]);
+    SmallShell *previous = SmallShell::makeCurrent(m_shell.get());
+    m_shell->executeLines(cmdLine, &redirections);
+    SmallShell::makeCurrent(previous);
+
+    close(in[0]);
+    close(out[1]);
+    close(err[1]);
+    close(stop[1]);
+    pumper.join();
+    close(out[0]);
+    close(err[0]);
+    close(stop[0]);
+    return m_shell->getLastStatus();
+}
+
+std::future<int> SmashSession::runAsync(const std::string &cmdLine, const std::string &input,
+                                        const OutputCallback &onStdout, const OutputCallback &onStderr) {
+    return std::async(std::launch::async, [this, cmdLine, input, onStdout, onStderr] {
+        return run(cmdLine, input, onStdout, onStderr);
+    });
+}
+
+bool SmashSession::hasQuit() const {
+    return m_shell->hasQuit();
+}
+
+SmallShell &SmashSession::shell() {
+    return *m_shell;
+}
@@ -0,0 +1,57 @@
+#ifndef SMASH__LIBSMASH_H_
+#define SMASH__LIBSMASH_H_
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class SmallShell;
+
+// A smash session inside the caller's process, for services that would
+// otherwise spawn "smash -c" per command. Each session has its own jobs,
+// aliases, variables, history and working directory, and is ready once
+// constructed: a run() costs only the command it runs. Runs on one session
+// are serialized; different sessions run concurrently on their own threads,
+// and their background children are reaped by one ChildReaper (reaper.h).
+// The process's cwd and environ are left alone.
+//
+// A session installs no signal handlers; a host that wants "timeout" routes
+// SIGALRM to alarmHandler() (signals.h) as smash does.
+class SmashSession {
+public:
+    // Receives output as it arrives, on a thread of the session's.
+    typedef std::function<void(const char *data, size_t length)> OutputCallback;
+
+    SmashSession();
+
+    ~SmashSession();
+
+    SmashSession(SmashSession const &) = delete;
+    void operator=(SmashSession const &) = delete;
+
+    // Runs cmdLine, one command per line, with input on its stdin. Returns
+    // the status "smash -c cmdLine" would exit with. A missing callback
+    // discards that stream. Output a background job writes after run()
+    // returns is dropped.
+    int run(const std::string &cmdLine, const std::string &input = "",
+            const OutputCallback &onStdout = nullptr, const OutputCallback &onStderr = nullptr);
+
+    // run() on a thread of its own. The session must outlive the future.
+    std::future<int> runAsync(const std::string &cmdLine, const std::string &input = "",
+                              const OutputCallback &onStdout = nullptr, const OutputCallback &onStderr = nullptr);
+
+    // The session ran quit; later runs fail with status 1.
+    bool hasQuit() const;
+
+    // For what the run() API does not cover (variables, history, jobs).
+    // Not to be used while a run is in progress.
+    SmallShell &shell();
+
+private:
+    std::unique_ptr<SmallShell> m_shell;
+    std::mutex m_runLock;
+};
+
+#endif //SMASH__LIBSMASH_H_
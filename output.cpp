@@ -0,0 +1,110 @@
+#include "output.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+//-------------------------------------SignalMessage-------------------------------------
+
+SignalMessage &SignalMessage::operator<<(const char *str) {
+    for (; *str; ++str) {
+        if (m_length == sizeof(m_buffer)) {
+            m_truncated = true;
+            break;
+        }
+        m_buffer[m_length++] = *str;
+    }
+    return *this;
+}
+
+SignalMessage &SignalMessage::operator<<(long number) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    *--p = '\0';
+    unsigned long value = number < 0 ? 0UL - number : number;
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    if (number < 0) {
+        *--p = '-';
+    }
+    return *this << p;
+}
+
+void SignalMessage::write() {
+    if (m_truncated) {
+        m_buffer[m_length - 1] = '\n';
+    }
+    writeAll(STDOUT_FILENO, m_buffer, m_length);
+}
+
+//-------------------------------------FdStreamBuf-------------------------------------
+
+FdStreamBuf::FdStreamBuf(int fd, size_t capacity) : m_fd(fd), m_buffer(capacity) {
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+}
+
+FdStreamBuf::~FdStreamBuf() {
+    flushBuffer();
+}
+
+int FdStreamBuf::fd() const {
+    return m_fd;
+}
+
+bool FdStreamBuf::flushBuffer() {
+    size_t pending = pptr() - pbase();
+    bool ok = pending == 0 || writeAll(m_fd, pbase(), pending);
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+    return ok;
+}
+
+int FdStreamBuf::overflow(int ch) {
+    if (!flushBuffer()) {
+        return traits_type::eof();
+    }
+    if (ch != traits_type::eof()) {
+        *pptr() = static_cast<char>(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize FdStreamBuf::xsputn(const char *s, std::streamsize n) {
+    std::streamsize room = epptr() - pptr();
+    if (n <= room) {
+        memcpy(pptr(), s, n);
+        pbump(static_cast<int>(n));
+        return n;
+    }
+    if (!flushBuffer()) {
+        return 0;
+    }
+    if (n < static_cast<std::streamsize>(m_buffer.size())) {
+        memcpy(pptr(), s, n);
+        pbump(static_cast<int>(n));
+        return n;
+    }
+    // Bigger than the whole buffer: hand it to the kernel without copying.
+    return writeAll(m_fd, s, n) ? n : 0;
+}
+
+int FdStreamBuf::sync() {
+    return flushBuffer() ? 0 : -1;
+}
@@ -0,0 +1,61 @@
+#ifndef SMASH__OUTPUT_H_
+#define SMASH__OUTPUT_H_
+
+#include <streambuf>
+#include <vector>
+
+// A std::streambuf that writes straight to a file descriptor. Output is kept
+// in a private buffer and handed to write(2) when the buffer fills or when the
+// stream is flushed (std::endl / std::flush), so each flushed line reaches the
+// fd in a single write.
+class FdStreamBuf : public std::streambuf {
+public:
+    explicit FdStreamBuf(int fd, size_t capacity = 4096);
+
+    virtual ~FdStreamBuf();
+
+    FdStreamBuf(FdStreamBuf const &) = delete;
+    void operator=(FdStreamBuf const &) = delete;
+
+    int fd() const;
+
+protected:
+    int overflow(int ch) override;
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+    int sync() override;
+
+private:
+    bool flushBuffer();
+
+    int m_fd;
+    std::vector<char> m_buffer;
+};
+
+// write(2) the whole range, retrying on partial writes and EINTR.
+bool writeAll(int fd, const char *data, size_t len);
+
+// A message from a signal handler, put together in a buffer of its own and
+// written to stdout in one write(2). It goes straight to the fd so a
+// handler never touches the shell's output buffer while the code it
+// interrupted is in the middle of filling it, and formats numbers by hand:
+// nothing it calls may take a lock or allocate. A message too long for the
+// buffer is cut short but still ends its line.
+class SignalMessage {
+public:
+    SignalMessage() : m_length(0), m_truncated(false) {}
+
+    SignalMessage &operator<<(const char *str);
+
+    SignalMessage &operator<<(long number);
+
+    void write();
+
+private:
+    char m_buffer[256];
+    size_t m_length;
+    bool m_truncated;
+};
+
+#endif //SMASH__OUTPUT_H_
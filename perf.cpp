@@ -0,0 +1,125 @@
+#include "perf.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace {
+
+struct EventSpec {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+};
+
+const EventSpec EVENT_SPECS[] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+};
+
+int perfEventOpen(struct perf_event_attr *attr, pid_t pid) {
+    return static_cast<int>(syscall(SYS_perf_event_open, attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+}
+
+PerfCounters::PerfCounters() : m_attached(false) {
+    for (int i = 0; i < EVENTS; ++i) {
+        m_fds[i] = -1;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int i = 0; i < EVENTS; ++i) {
+        if (m_fds[i] != -1) {
+            close(m_fds[i]);
+        }
+    }
+}
+
+bool PerfCounters::open(pid_t pid, bool enableOnExec) {
+    for (int i = 0; i < EVENTS; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = EVENT_SPECS[i].type;
+        attr.config = EVENT_SPECS[i].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1;
+        attr.disabled = enableOnExec ? 1 : 0;
+        attr.enable_on_exec = enableOnExec ? 1 : 0;
+
+        m_fds[i] = perfEventOpen(&attr, pid);
+        if (m_fds[i] == -1 && (errno == EACCES || errno == EPERM)) {
+            // perf_event_paranoid may only allow user space counting
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fds[i] = perfEventOpen(&attr, pid);
+        }
+        if (m_fds[i] != -1) {
+            m_attached = true;
+        }
+    }
+    return m_attached;
+}
+
+bool PerfCounters::attachBeforeExec(pid_t pid) {
+    return open(pid, true);
+}
+
+bool PerfCounters::attachSelf() {
+    return open(0, false);
+}
+
+void PerfCounters::stop() {
+    for (int i = 0; i < EVENTS; ++i) {
+        if (m_fds[i] != -1) {
+            ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+bool PerfCounters::attached() const {
+    return m_attached;
+}
+
+bool PerfCounters::value(Event event, uint64_t *out) const {
+    if (m_fds[event] == -1) {
+        return false;
+    }
+    // value, time enabled, time running
+    uint64_t data[3];
+    if (read(m_fds[event], data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+        return false;
+    }
+    // Scale up if the PMU had to multiplex the counter
+    *out = data[2] < data[1] ? static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]) : data[0];
+    return true;
+}
+
+void PerfCounters::print(std::ostream &out, const char *cmd, uint64_t elapsedNs) const {
+    char line[128];
+    out << std::endl << " Performance counter stats for '" << cmd << "':" << std::endl << std::endl;
+    for (int i = 0; i < EVENTS; ++i) {
+        uint64_t count;
+        if (!value(static_cast<Event>(i), &count)) {
+            snprintf(line, sizeof(line), "%20s      %s", "<not supported>", EVENT_SPECS[i].name);
+        } else if (i == TASK_CLOCK) {
+            snprintf(line, sizeof(line), "%20.2f msec %s", count / 1e6, EVENT_SPECS[i].name);
+        } else {
+            snprintf(line, sizeof(line), "%20llu      %s", static_cast<unsigned long long>(count),
+                     EVENT_SPECS[i].name);
+        }
+        out << line << std::endl;
+    }
+    snprintf(line, sizeof(line), "%20.6f seconds time elapsed", elapsedNs / 1e9);
+    out << std::endl << line << std::endl;
+}
@@ -0,0 +1,54 @@
+#ifndef SMASH__PERF_H_
+#define SMASH__PERF_H_
+
+#include <ostream>
+#include <stdint.h>
+#include <sys/types.h>
+
+// perf_event_open counters for one command, as printed by "perfstat".
+// Software events are always tried; hardware ones (instructions, cycles) are
+// reported as not supported when the kernel or a VM does not expose a PMU.
+class PerfCounters {
+public:
+    PerfCounters();
+
+    ~PerfCounters();
+
+    PerfCounters(PerfCounters const &) = delete;
+    void operator=(PerfCounters const &) = delete;
+
+    // Attach to a child stopped before exec: counting starts at its exec and
+    // covers everything it forks (inherit). Returns false if nothing opened.
+    bool attachBeforeExec(pid_t pid);
+
+    // Count the calling thread from now until stop().
+    bool attachSelf();
+
+    void stop();
+
+    bool attached() const;
+
+    // perf stat style report. elapsedNs is the wall time of the command.
+    void print(std::ostream &out, const char *cmd, uint64_t elapsedNs) const;
+
+private:
+    enum Event {
+        TASK_CLOCK,
+        CONTEXT_SWITCHES,
+        CPU_MIGRATIONS,
+        PAGE_FAULTS,
+        INSTRUCTIONS,
+        CYCLES,
+        EVENTS
+    };
+
+    bool open(pid_t pid, bool enableOnExec);
+
+    // Scaled counter value, or false if the event was not counted.
+    bool value(Event event, uint64_t *out) const;
+
+    int m_fds[EVENTS];
+    bool m_attached;
+};
+
+#endif //SMASH__PERF_H_
@@ -0,0 +1,160 @@
+#include "reaper.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+namespace {
+
+int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+}
+
+//-------------------------------------ChildReaper-------------------------------------
+
+ChildReaper &ChildReaper::getInstance() {
+    static ChildReaper *instance = new ChildReaper();
+    return *instance;
+}
+
+ChildReaper::ChildReaper() : m_epoll(epoll_create1(EPOLL_CLOEXEC)), m_owner(getpid()) {
+    if (m_epoll == -1) {
+        perror("smash error: epoll_create1 failed");
+        return;
+    }
+    // The reaper must not take the shell's signals
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    m_thread = std::thread(&ChildReaper::reapLoop, this);
+    m_thread.detach();
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+bool ChildReaper::watch(pid_t pid) {
+    if (m_epoll == -1 || getpid() != m_owner) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_children.find(pid);
+    if (it != m_children.end()) {
+        if (!it->second.exited) {
+            it->second.wanted = true;
+            return true;
+        }
+        // Reaped, so the pid is free again: this is a new child
+        m_children.erase(it);
+    }
+    int pidfd = pidfdOpen(pid);
+    if (pidfd == -1) {
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = static_cast<uint64_t>(pid);
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, pidfd, &event) == -1) {
+        close(pidfd);
+        return false;
+    }
+    Child child = {pidfd, false, true, 0};
+    m_children[pid] = child;
+    return true;
+}
+
+bool ChildReaper::reaped(pid_t pid, int *status) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_children.find(pid);
+    if (it == m_children.end()) {
+        if (status) {
+            *status = 0;
+        }
+        return true;
+    }
+    if (!it->second.exited) {
+        return false;
+    }
+    if (status) {
+        *status = it->second.status;
+    }
+    m_children.erase(it);
+    return true;
+}
+
+bool ChildReaper::release(pid_t pid, int *status) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_children.find(pid);
+    if (it == m_children.end()) {
+        return false;
+    }
+    bool exited = it->second.exited;
+    if (exited) {
+        *status = it->second.status;
+    } else {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, it->second.pidfd, nullptr);
+        close(it->second.pidfd);
+    }
+    m_children.erase(it);
+    return exited;
+}
+
+void ChildReaper::forget(pid_t pid) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_children.find(pid);
+    if (it == m_children.end()) {
+        return;
+    }
+    if (it->second.exited) {
+        m_children.erase(it);
+    } else {
+        it->second.wanted = false;
+    }
+}
+
+void ChildReaper::reapLoop() {
+    struct epoll_event events[64];
+    while (true) {
+        int ready = epoll_wait(m_epoll, events, 64, -1);
+        if (ready == -1) {
+            if (errno != EINTR) {
+                perror("smash error: epoll_wait failed");
+                return;
+            }
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (int i = 0; i < ready; ++i) {
+            pid_t pid = static_cast<pid_t>(events[i].data.u64);
+            // Released since epoll_wait returned, or a new child with a reused pid
+            auto it = m_children.find(pid);
+            if (it == m_children.end() || it->second.exited) {
+                continue;
+            }
+            int status = 0;
+            pid_t result = waitpid(pid, &status, WNOHANG);
+            if (result == 0) {
+                continue;
+            }
+            // -1 (ECHILD): already reaped elsewhere, nothing left to learn
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, it->second.pidfd, nullptr);
+            close(it->second.pidfd);
+            if (!it->second.wanted) {
+                m_children.erase(it);
+                continue;
+            }
+            it->second.exited = true;
+            it->second.status = result == pid ? status : 0;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SMASH__REAPER_H_
+#define SMASH__REAPER_H_
+
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <sys/types.h>
+
+// Reaps the background children of every shell session in the process from
+// one thread, so no session polls waitpid() per job and an idle session
+// leaves no zombies behind. Each child is watched through a pidfd rather
+// than with wait(-1), so children the shell did not start (an embedding
+// host's own) are never taken. Foreground children are not watched: their
+// session waits for them itself.
+class ChildReaper {
+public:
+    // Created on first use and never destroyed, like WorkerPool: sessions
+    // may still ask about their jobs during exit.
+    static ChildReaper &getInstance();
+
+    ChildReaper(ChildReaper const &) = delete;
+    void operator=(ChildReaper const &) = delete;
+
+    // Starts watching pid. Returns false if it cannot (no pidfd support, or
+    // this is a forked copy of the shell), and the caller reaps it itself.
+    bool watch(pid_t pid);
+
+    // Whether the watched pid has exited; if so it is forgotten and status,
+    // if given, gets its wait status. Unknown pids count as exited.
+    bool reaped(pid_t pid, int *status = nullptr);
+
+    // Stops watching pid so the caller can wait for it itself. Returns true,
+    // with status set, if it had exited already.
+    bool release(pid_t pid, int *status);
+
+    // Nobody will ask about pid again; its status is dropped once reaped.
+    void forget(pid_t pid);
+
+private:
+    ChildReaper();
+
+    void reapLoop();
+
+    struct Child {
+        int pidfd;
+        bool exited;
+        bool wanted;
+        int status;
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<pid_t, Child> m_children;
+    int m_epoll;
+    // The process the reaping thread runs in; a fork() does not copy it
+    pid_t m_owner;
+    std::thread m_thread;
+};
+
+#endif //SMASH__REAPER_H_
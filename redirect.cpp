@@ -0,0 +1,288 @@
+#include "redirect.h"
+
+#include <iostream>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace {
+
+bool isOperatorStart(const std::string &s, size_t i) {
+    return s[i] == '<' || s[i] == '>' || (s[i] == '&' && i + 1 < s.size() && s[i + 1] == '>');
+}
+
+}
+
+//-------------------------------------RedirectionList-------------------------------------
+
+bool RedirectionList::parse(const std::string &cmdLine, std::string &command, std::string &error) {
+    m_actions.clear();
+    command.clear();
+    const size_t n = cmdLine.size();
+    char quote = 0;
+    size_t i = 0;
+    while (i < n) {
+        char c = cmdLine[i];
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+            command += c;
+            ++i;
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            quote = c;
+            command += c;
+            ++i;
+            continue;
+        }
+        if (!isOperatorStart(cmdLine, i)) {
+            command += c;
+            ++i;
+            continue;
+        }
+
+        // "2>": digits that make up a whole word name the fd
+        int fd = -1;
+        size_t digits = command.size();
+        while (digits > 0 && isdigit(static_cast<unsigned char>(command[digits - 1]))) {
+            --digits;
+        }
+        if (c != '&' && digits < command.size() &&
+            (digits == 0 || isspace(static_cast<unsigned char>(command[digits - 1])))) {
+            fd = atoi(command.c_str() + digits);
+            command.erase(digits);
+        }
+
+        bool both = c == '&';
+        if (both) {
+            ++i;
+        }
+        char op = cmdLine[i++];
+        bool append = false;
+        if (op == '>' && i < n && cmdLine[i] == '>') {
+            append = true;
+            ++i;
+        }
+
+        FdAction action;
+        action.fd = fd != -1 ? fd : (op == '<' ? STDIN_FILENO : STDOUT_FILENO);
+        action.flags = 0;
+        action.sourceFd = -1;
+
+        if (!both && !append && i < n && cmdLine[i] == '&') {
+            // N>&M
+            size_t start = ++i;
+            while (i < n && isdigit(static_cast<unsigned char>(cmdLine[i]))) {
+                ++i;
+            }
+            if (start == i) {
+                error = "redirection: invalid file descriptor";
+                return false;
+            }
+            action.type = FdAction::DUPLICATE;
+            action.sourceFd = atoi(cmdLine.substr(start, i - start).c_str());
+            m_actions.push_back(action);
+            command += ' ';
+            continue;
+        }
+
+        while (i < n && isspace(static_cast<unsigned char>(cmdLine[i]))) {
+            ++i;
+        }
+        char pathQuote = 0;
+        while (i < n) {
+            char t = cmdLine[i];
+            if (pathQuote) {
+                if (t == pathQuote) {
+                    pathQuote = 0;
+                } else {
+                    action.path += t;
+                }
+                ++i;
+                continue;
+            }
+            if (t == '\'' || t == '"') {
+                pathQuote = t;
+                ++i;
+                continue;
+            }
+            if (isspace(static_cast<unsigned char>(t)) || t == '|' || isOperatorStart(cmdLine, i)) {
+                break;
+            }
+            action.path += t;
+            ++i;
+        }
+        if (action.path.empty()) {
+            error = "redirection: missing file name";
+            return false;
+        }
+        action.type = FdAction::OPEN;
+        action.flags = op == '<' ? O_RDONLY : O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+        m_actions.push_back(action);
+        if (both) {
+            FdAction dup;
+            dup.type = FdAction::DUPLICATE;
+            dup.fd = STDERR_FILENO;
+            dup.flags = 0;
+            dup.sourceFd = action.fd;
+            m_actions.push_back(dup);
+        }
+        command += ' ';
+    }
+    return true;
+}
+
+bool RedirectionList::empty() const {
+    return m_actions.empty();
+}
+
+void RedirectionList::addDuplicate(int fd, int sourceFd) {
+    FdAction action;
+    action.type = FdAction::DUPLICATE;
+    action.fd = fd;
+    action.flags = 0;
+    action.sourceFd = sourceFd;
+    m_actions.push_back(action);
+}
+
+void RedirectionList::append(const RedirectionList &other) {
+    m_actions.insert(m_actions.end(), other.m_actions.begin(), other.m_actions.end());
+}
+
+bool RedirectionList::apply() const {
+    for (const FdAction &action : m_actions) {
+        if (action.type == FdAction::OPEN) {
+            int fd = open(action.path.c_str(), action.flags, 0666);
+            if (fd == -1) {
+                perror("smash error: open failed");
+                return false;
+            }
+            if (fd != action.fd) {
+                if (dup2(fd, action.fd) == -1) {
+                    perror("smash error: dup2 failed");
+                    close(fd);
+                    return false;
+                }
+                close(fd);
+            }
+        } else if (action.sourceFd != action.fd && dup2(action.sourceFd, action.fd) == -1) {
+            perror("smash error: dup2 failed");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RedirectionList::resolve(int fds[3], std::vector<int> &opened, int dirfd) const {
+    for (int fd = 0; fd < 3; ++fd) {
+        fds[fd] = fd;
+    }
+    for (const FdAction &action : m_actions) {
+        int target;
+        if (action.type == FdAction::OPEN) {
+            target = openat(dirfd, action.path.c_str(), action.flags | O_CLOEXEC, 0666);
+            if (target == -1) {
+                perror("smash error: open failed");
+                return false;
+            }
+            opened.push_back(target);
+        } else {
+            target = action.sourceFd < 3 ? fds[action.sourceFd] : action.sourceFd;
+            if (fcntl(target, F_GETFD) == -1) {
+                perror("smash error: dup2 failed");
+                return false;
+            }
+        }
+        if (action.fd < 3) {
+            fds[action.fd] = target;
+        }
+    }
+    return true;
+}
+
+bool RedirectionList::contains(const std::string &cmdLine) {
+    char quote = 0;
+    for (size_t i = 0; i < cmdLine.size(); ++i) {
+        char c = cmdLine[i];
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (isOperatorStart(cmdLine, i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//-------------------------------------BuiltinRedirection-------------------------------------
+
+BuiltinRedirection::BuiltinRedirection(const RedirectionList &redirections, int dirfd) :
+    m_ok(false), m_out(&std::cout), m_err(&std::cerr) {
+    m_ok = redirections.resolve(m_fds, m_opened, dirfd);
+    if (!m_ok) {
+        return;
+    }
+    m_out = streamFor(m_fds[STDOUT_FILENO], m_outBuf, m_outStream);
+    // "&> file": one stream, so output and errors stay in order
+    if (m_fds[STDERR_FILENO] == m_fds[STDOUT_FILENO]) {
+        m_err = m_out;
+    } else {
+        m_err = streamFor(m_fds[STDERR_FILENO], m_errBuf, m_errStream);
+    }
+}
+
+BuiltinRedirection::~BuiltinRedirection() {
+    if (m_outStream) {
+        m_outStream->flush();
+    }
+    if (m_errStream) {
+        m_errStream->flush();
+    }
+    for (int fd : m_opened) {
+        close(fd);
+    }
+}
+
+std::ostream *BuiltinRedirection::streamFor(int fd, std::unique_ptr<FdStreamBuf> &buf,
+                                            std::unique_ptr<std::ostream> &stream) {
+    if (fd == STDOUT_FILENO) {
+        return &std::cout;
+    }
+    if (fd == STDERR_FILENO) {
+        return &std::cerr;
+    }
+    buf.reset(new FdStreamBuf(fd, 1 << 16));
+    stream.reset(new std::ostream(buf.get()));
+    return stream.get();
+}
+
+bool BuiltinRedirection::ok() const {
+    return m_ok;
+}
+
+std::ostream *BuiltinRedirection::out() {
+    return m_out;
+}
+
+std::ostream *BuiltinRedirection::err() {
+    return m_err;
+}
+
+int BuiltinRedirection::inFd() const {
+    return m_fds[STDIN_FILENO];
+}
+
+int BuiltinRedirection::outFd() const {
+    return m_fds[STDOUT_FILENO];
+}
+
+int BuiltinRedirection::errFd() const {
+    return m_fds[STDERR_FILENO];
+}
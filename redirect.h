@@ -0,0 +1,101 @@
+#ifndef SMASH__REDIRECT_H_
+#define SMASH__REDIRECT_H_
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include "output.h"
+
+// One redirection, e.g. "2>> log" or "2>&1".
+struct FdAction {
+    enum Type {
+        OPEN,       // open path with flags onto fd
+        DUPLICATE   // make fd a copy of sourceFd
+    };
+
+    Type type;
+    int fd;
+    int flags;
+    int sourceFd;
+    std::string path;
+};
+
+// The redirections of one command, in the order they were written ("> f 2>&1"
+// and "2>&1 > f" differ). Understands <, >, >>, N<, N>, N>>, N>&M, N<&M, &>
+// and &>>; operators inside quotes are left alone. Nothing touches the
+// shell's own fds: externals apply() the list in the child between fork and
+// exec, built-ins get streams on the resolved fds from BuiltinRedirection.
+class RedirectionList {
+public:
+    // Splits the redirections off cmdLine; command gets what is left. Returns
+    // false and sets error for a malformed one such as "ls >".
+    bool parse(const std::string &cmdLine, std::string &command, std::string &error);
+
+    bool empty() const;
+
+    // Append "fd>&sourceFd".
+    void addDuplicate(int fd, int sourceFd);
+
+    // Append the actions of other, after this list's own.
+    void append(const RedirectionList &other);
+
+    // Child side: perform the actions on the real fds. Prints and returns
+    // false if a file cannot be opened.
+    bool apply() const;
+
+    // Where stdin/stdout/stderr end up, without touching the real fds. Files
+    // it opens (O_CLOEXEC, relative to dirfd) are appended to opened for the
+    // caller to close.
+    bool resolve(int fds[3], std::vector<int> &opened, int dirfd = AT_FDCWD) const;
+
+    // Whether cmdLine has an unquoted redirection operator.
+    static bool contains(const std::string &cmdLine);
+
+private:
+    std::vector<FdAction> m_actions;
+};
+
+// Output and error streams for a built-in run under a RedirectionList. Fds
+// that still point at the shell's stdout/stderr keep using std::cout and
+// std::cerr, so the shell's output buffer stays in order.
+class BuiltinRedirection {
+public:
+    // Relative paths are opened from dirfd, the session's directory.
+    explicit BuiltinRedirection(const RedirectionList &redirections, int dirfd = AT_FDCWD);
+
+    ~BuiltinRedirection();
+
+    BuiltinRedirection(BuiltinRedirection const &) = delete;
+    void operator=(BuiltinRedirection const &) = delete;
+
+    // False if a file could not be opened; the built-in should not run.
+    bool ok() const;
+
+    std::ostream *out();
+
+    std::ostream *err();
+
+    // For built-ins that read input, such as wc.
+    int inFd() const;
+
+    int outFd() const;
+
+    int errFd() const;
+
+private:
+    std::ostream *streamFor(int fd, std::unique_ptr<FdStreamBuf> &buf, std::unique_ptr<std::ostream> &stream);
+
+    bool m_ok;
+    std::ostream *m_out;
+    std::ostream *m_err;
+    int m_fds[3];
+    std::vector<int> m_opened;
+    std::unique_ptr<FdStreamBuf> m_outBuf;
+    std::unique_ptr<FdStreamBuf> m_errBuf;
+    std::unique_ptr<std::ostream> m_outStream;
+    std::unique_ptr<std::ostream> m_errStream;
+};
+
+#endif //SMASH__REDIRECT_H_
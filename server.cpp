@@ -0,0 +1,442 @@
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace {
+
+// Longest header line ("run 4294967295\n" and then some)
+const size_t MAX_HEADER = 32;
+const size_t MAX_REQUEST = 1 << 20;
+// Output queued for a client beyond which its command's pipes are not read
+const size_t MAX_PENDING_OUTPUT = 1 << 20;
+
+}
+
+//-------------------------------------ControlServer-------------------------------------
+
+ControlServer::ControlServer() :
+    m_shell(true), m_listenFd(-1), m_epoll(epoll_create1(EPOLL_CLOEXEC)),
+    m_doneFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), m_devNull(open("/dev/null", O_RDONLY | O_CLOEXEC)),
+    m_nextSerial(1), m_running(false), m_pipesPaused(false), m_haveWork(false), m_shutdown(false),
+    m_status(0) {
+    m_outPipe[0] = m_outPipe[1] = m_errPipe[0] = m_errPipe[1] = -1;
+    if (m_epoll == -1 || m_doneFd == -1 || m_devNull == -1) {
+        perror("smash error: listen: setup failed");
+        return;
+    }
+    watch(m_doneFd, EPOLLIN, EPOLL_CTL_ADD);
+    // The executor must not take the shell's signals
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    m_executor = std::thread(&ControlServer::executorLoop, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+ControlServer::~ControlServer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_cond.notify_one();
+    if (m_executor.joinable()) {
+        m_executor.join();
+    }
+    while (!m_clients.empty()) {
+        closeClient(m_clients.begin()->first);
+    }
+    for (int fd : {m_outPipe[0], m_outPipe[1], m_errPipe[0], m_errPipe[1], m_listenFd, m_epoll, m_doneFd,
+                   m_devNull}) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    if (!m_path.empty()) {
+        unlink(m_path.c_str());
+    }
+}
+
+void ControlServer::watch(int fd, uint32_t events, int op) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epoll, op, fd, &event) == -1) {
+        perror("smash error: listen: epoll_ctl failed");
+    }
+}
+
+bool ControlServer::listen(const std::string &path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "smash error: listen: socket path too long\n");
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listenFd == -1) {
+        perror("smash error: listen: socket failed");
+        return false;
+    }
+    if (bind(m_listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        // Left behind by a server that is gone: nothing accepts on it
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool stale = errno == EADDRINUSE && probe != -1 &&
+                     connect(probe, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 &&
+                     errno == ECONNREFUSED;
+        if (probe != -1) {
+            close(probe);
+        }
+        if (!stale || unlink(path.c_str()) == -1 ||
+            bind(m_listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+            perror("smash error: listen: bind failed");
+            return false;
+        }
+    }
+    if (::listen(m_listenFd, SOMAXCONN) == -1) {
+        perror("smash error: listen: listen failed");
+        unlink(path.c_str());
+        return false;
+    }
+    m_path = path;
+    watch(m_listenFd, EPOLLIN, EPOLL_CTL_ADD);
+    return true;
+}
+
+void ControlServer::run() {
+    struct epoll_event events[64];
+    bool stopping = false;
+    while (true) {
+        if (stopping) {
+            // quit: done once every reply has gone out
+            bool pending = false;
+            for (auto &entry : m_clients) {
+                pending = pending || !entry.second->out.empty();
+            }
+            if (!pending) {
+                return;
+            }
+        }
+        int ready = epoll_wait(m_epoll, events, 64, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("smash error: listen: epoll_wait failed");
+            return;
+        }
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == m_listenFd) {
+                accept();
+            } else if (fd == m_doneFd) {
+                uint64_t count;
+                while (read(m_doneFd, &count, sizeof(count)) == -1 && errno == EINTR) {
+                }
+                finish();
+                if (m_shell.hasQuit()) {
+                    stopping = true;
+                    m_queue.clear();
+                    epoll_ctl(m_epoll, EPOLL_CTL_DEL, m_listenFd, nullptr);
+                }
+            } else if (m_running && fd == m_outPipe[0]) {
+                forward(fd, "out");
+            } else if (m_running && fd == m_errPipe[0]) {
+                forward(fd, "err");
+            } else {
+                auto it = m_clients.find(fd);
+                if (it == m_clients.end()) {
+                    continue;
+                }
+                Client &client = *it->second;
+                bool alive = true;
+                if (events[i].events & EPOLLOUT) {
+                    alive = flush(client);
+                }
+                if (alive && client.closing && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                    // Gone both ways: nobody is left to read the replies
+                    alive = false;
+                } else if (alive && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !stopping &&
+                           !client.closing) {
+                    alive = readRequests(client);
+                }
+                if (!alive) {
+                    closeClient(fd);
+                } else {
+                    closeIfAnswered(client);
+                }
+            }
+        }
+        if (!m_running && !stopping) {
+            startNext();
+        }
+        updatePipes();
+    }
+}
+
+void ControlServer::accept() {
+    while (true) {
+        int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+                perror("smash error: listen: accept failed");
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        std::unique_ptr<Client> client(new Client());
+        client->fd = fd;
+        client->serial = m_nextSerial++;
+        client->writing = false;
+        client->closing = false;
+        client->queued = 0;
+        m_clients[fd] = std::move(client);
+        watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+}
+
+bool ControlServer::readRequests(Client &client) {
+    char buf[65536];
+    while (true) {
+        ssize_t len = read(client.fd, buf, sizeof(buf));
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len == -1 && errno == EAGAIN) {
+            break;
+        }
+        if (len == 0) {
+            // Half-closed (shutdown(SHUT_WR)): what it sent still runs
+            client.closing = true;
+            watchClient(client);
+            break;
+        }
+        if (len == -1) {
+            return false;
+        }
+        client.in.append(buf, len);
+    }
+    while (true) {
+        size_t newline = client.in.find('\n');
+        if (newline == std::string::npos) {
+            return client.in.size() <= MAX_HEADER;
+        }
+        char *end;
+        const char *header = client.in.c_str();
+        unsigned long length = strtoul(header + 4, &end, 10);
+        if (newline > MAX_HEADER || strncmp(header, "run ", 4) != 0 || end != header + newline ||
+            end == header + 4 || length > MAX_REQUEST) {
+            return false;
+        }
+        if (client.in.size() < newline + 1 + length) {
+            return true;
+        }
+        Request request = {client.fd, client.serial, client.in.substr(newline + 1, length)};
+        m_queue.push_back(request);
+        ++client.queued;
+        client.in.erase(0, newline + 1 + length);
+    }
+}
+
+bool ControlServer::flush(Client &client) {
+    while (!client.out.empty()) {
+        ssize_t len = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len == -1 && errno == EAGAIN) {
+            break;
+        }
+        if (len <= 0) {
+            return false;
+        }
+        client.out.erase(0, len);
+    }
+    bool writing = !client.out.empty();
+    if (writing != client.writing) {
+        client.writing = writing;
+        watchClient(client);
+    }
+    return true;
+}
+
+void ControlServer::watchClient(Client &client) {
+    // A client at EOF would report EPOLLIN for ever
+    watch(client.fd, (client.closing ? 0 : EPOLLIN) | (client.writing ? EPOLLOUT : 0), EPOLL_CTL_MOD);
+}
+
+void ControlServer::closeClient(int fd) {
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    m_clients.erase(fd);
+}
+
+void ControlServer::closeIfAnswered(Client &client) {
+    if (client.closing && client.queued == 0 && client.out.empty() && !(m_running && current() == &client)) {
+        closeClient(client.fd);
+    }
+}
+
+ControlServer::Client *ControlServer::current() {
+    auto it = m_clients.find(m_current.fd);
+    if (it == m_clients.end() || it->second->serial != m_current.serial) {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+void ControlServer::startNext() {
+    // Requests of a client that hung up since are dropped
+    do {
+        if (m_queue.empty()) {
+            return;
+        }
+        m_current = m_queue.front();
+        m_queue.pop_front();
+    } while (!current());
+    --current()->queued;
+    if (pipe2(m_outPipe, O_CLOEXEC) == -1 || pipe2(m_errPipe, O_CLOEXEC) == -1) {
+        perror("smash error: listen: pipe failed");
+        for (int *fd : {&m_outPipe[0], &m_outPipe[1]}) {
+            if (*fd != -1) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+        m_current.command.clear();
+        Client *client = current();
+        client->out += "exit 1\n";
+        if (!flush(*client)) {
+            closeClient(client->fd);
+        } else {
+            closeIfAnswered(*client);
+        }
+        return;
+    }
+    fcntl(m_outPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_errPipe[0], F_SETFL, O_NONBLOCK);
+    watch(m_outPipe[0], EPOLLIN, EPOLL_CTL_ADD);
+    watch(m_errPipe[0], EPOLLIN, EPOLL_CTL_ADD);
+    m_pipesPaused = false;
+
+    m_redirections = RedirectionList();
+    m_redirections.addDuplicate(STDIN_FILENO, m_devNull);
+    m_redirections.addDuplicate(STDOUT_FILENO, m_outPipe[1]);
+    m_redirections.addDuplicate(STDERR_FILENO, m_errPipe[1]);
+    m_running = true;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_haveWork = true;
+    }
+    m_cond.notify_one();
+}
+
+bool ControlServer::forward(int fd, const char *tag) {
+    char buf[65536];
+    ssize_t len;
+    do {
+        len = read(fd, buf, sizeof(buf));
+    } while (len == -1 && errno == EINTR);
+    if (len <= 0) {
+        if (len == 0) {
+            // Every writer is gone; finish() still has the fd to close
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        return false;
+    }
+    Client *client = current();
+    if (client) {
+        client->out += tag;
+        client->out += ' ' + std::to_string(len) + '\n';
+        client->out.append(buf, len);
+        if (!flush(*client)) {
+            closeClient(client->fd);
+        }
+    }
+    return true;
+}
+
+void ControlServer::finish() {
+    // The command has finished: what is in the pipes now is all of its
+    // output. A background job may still hold them open, so no waiting for EOF.
+    close(m_outPipe[1]);
+    close(m_errPipe[1]);
+    while (forward(m_outPipe[0], "out")) {
+    }
+    while (forward(m_errPipe[0], "err")) {
+    }
+    for (int fd : {m_outPipe[0], m_errPipe[0]}) {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+    }
+    m_outPipe[0] = m_outPipe[1] = m_errPipe[0] = m_errPipe[1] = -1;
+    m_running = false;
+
+    Client *client = current();
+    if (client) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        client->out += "exit " + std::to_string(m_status) + '\n';
+    }
+    if (client && !flush(*client)) {
+        closeClient(client->fd);
+    } else if (client) {
+        closeIfAnswered(*client);
+    }
+}
+
+void ControlServer::updatePipes() {
+    if (!m_running) {
+        return;
+    }
+    Client *client = current();
+    bool pause = client && client->out.size() > MAX_PENDING_OUTPUT;
+    if (pause == m_pipesPaused) {
+        return;
+    }
+    m_pipesPaused = pause;
+    // A pipe at EOF has been removed already; ENOENT then is harmless
+    for (int fd : {m_outPipe[0], m_errPipe[0]}) {
+        struct epoll_event event;
+        event.events = pause ? 0 : EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &event);
+    }
+}
+
+void ControlServer::executorLoop() {
+    SmallShell::makeCurrent(&m_shell);
+    while (true) {
+        std::string command;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_haveWork || m_shutdown; });
+            if (m_shutdown) {
+                return;
+            }
+            m_haveWork = false;
+            command = m_current.command;
+        }
+        m_shell.executeLines(command, &m_redirections);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_status = m_shell.getLastStatus();
+        }
+        uint64_t one = 1;
+        while (write(m_doneFd, &one, sizeof(one)) == -1 && errno == EINTR) {
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef SMASH__SERVER_H_
+#define SMASH__SERVER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <stdint.h>
+#include "Commands.h"
+
+// "smash --listen PATH": commands sent over a Unix domain socket run in one
+// long-lived shell, so an orchestration script pays no startup per command
+// and aliases, variables, jobs and cd carry over between requests.
+//
+// Both ways, a header line and then its payload:
+//   request:   "run LEN\n" and LEN bytes of command lines
+//   responses: "out LEN\n" or "err LEN\n" and LEN bytes of the command's
+//              stdout or stderr, as it is produced, then "exit STATUS\n"
+// A connection may send several requests without waiting for replies, and
+// may shut down its writing side after them: they still run, and the
+// server closes it once every reply has gone out.
+// Requests run one at a time, in arrival order across connections, with
+// stdin from /dev/null. A malformed header closes the connection.
+//
+// One epoll loop accepts connections, reads requests, and moves the running
+// command's output from its pipes to its client; the shell runs on a thread
+// of its own meanwhile. A client that does not read its replies stops its
+// command at a full pipe rather than growing the server's memory.
+class ControlServer {
+public:
+    ControlServer();
+
+    ~ControlServer();
+
+    ControlServer(ControlServer const &) = delete;
+    void operator=(ControlServer const &) = delete;
+
+    // Binds path, replacing a socket nobody listens on any more. Prints and
+    // returns false on error.
+    bool listen(const std::string &path);
+
+    // Serves until a request runs quit.
+    void run();
+
+private:
+    struct Client {
+        int fd;
+        // Tells a client from a later one that got the same fd
+        uint64_t serial;
+        std::string in;
+        std::string out;
+        bool writing;
+        // Sent EOF: read no more, close once its requests are answered
+        bool closing;
+        // Its requests waiting in m_queue
+        size_t queued;
+    };
+
+    struct Request {
+        int fd;
+        uint64_t serial;
+        std::string command;
+    };
+
+    void accept();
+
+    // False once the client is gone.
+    bool readRequests(Client &client);
+
+    bool flush(Client &client);
+
+    // Epoll interest for what the client is waiting on.
+    void watchClient(Client &client);
+
+    void closeClient(int fd);
+
+    // Closes a client that sent EOF once nothing of its is queued, running
+    // or unsent.
+    void closeIfAnswered(Client &client);
+
+    // The running request's client, or nullptr if it has gone.
+    Client *current();
+
+    void startNext();
+
+    // Moves what the command wrote so far to its client. Returns false at
+    // end of file.
+    bool forward(int fd, const char *tag);
+
+    void finish();
+
+    // Stops reading the command's output while its client is behind.
+    void updatePipes();
+
+    void executorLoop();
+
+    void watch(int fd, uint32_t events, int op);
+
+    SmallShell m_shell;
+    std::string m_path;
+    int m_listenFd;
+    int m_epoll;
+    // Written by the executor when a command has finished
+    int m_doneFd;
+    int m_devNull;
+    uint64_t m_nextSerial;
+    std::unordered_map<int, std::unique_ptr<Client>> m_clients;
+    std::deque<Request> m_queue;
+
+    bool m_running;
+    Request m_current;
+    int m_outPipe[2];
+    int m_errPipe[2];
+    bool m_pipesPaused;
+    RedirectionList m_redirections;
+
+    std::thread m_executor;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_haveWork;
+    bool m_shutdown;
+    int m_status;
+};
+
+#endif //SMASH__SERVER_H_
@@ -2,20 +2,40 @@
 #include <signal.h>
 #include "signals.h"
 #include "Commands.h"
+#include "timers.h"
 
 using namespace std;
 
 void ctrlCHandler(int sig_num) {
-    cout << "smash: got ctrl-C" << endl;
+    (SignalMessage() << "smash: got ctrl-C\n").write();
     SmallShell &shell = SmallShell::getInstance();
+    BackgroundTask *fgTask = shell.m_foregroundTask.load();
+    if (fgTask) {
+        // A built-in brought back with fg runs on a worker thread: ask it to stop.
+        fgTask->cancel();
+        (SignalMessage() << "smash: job-id " << shell.m_foregroundTaskJobId << " was killed\n").write();
+        shell.m_foregroundTask = nullptr;
+        return;
+    }
+    std::atomic<bool> *cancel = shell.m_foregroundCancel.load();
+    if (cancel) {
+        // A built-in running in the foreground stops at its next check
+        cancel->store(true);
+    }
     pid_t fg = shell.m_foregroundPid; 
   
     if (fg) {
         if (kill(fg, SIGINT) == -1) {
-            perror("smash error: kill failed");
+            // In the handler: a fixed message through write(2), not perror()
+            static const char MESSAGE[] = "smash error: kill failed\n";
+            writeAll(STDERR_FILENO, MESSAGE, sizeof(MESSAGE) - 1);
             return;
         }
-        cout << "smash: process " << shell.m_foregroundPid << " was killed" << endl;
+        (SignalMessage() << "smash: process " << fg << " was killed\n").write();
     }
     shell.m_foregroundPid = 0;
-}
\ No newline at end of file
+}
+
+void alarmHandler(int sig_num) {
+    TimerWheel::getInstance().onAlarm();
+}
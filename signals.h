@@ -3,4 +3,6 @@
 
 void ctrlCHandler(int sig_num);
 
+void alarmHandler(int sig_num);
+
 #endif //SMASH__SIGNALS_H_
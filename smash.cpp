@@ -1,22 +1,131 @@
 #include <iostream>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include "Commands.h"
 #include "signals.h"
+#include "trace.h"
+#include "input.h"
+#include "editor.h"
+#include "server.h"
 
 int main(int argc, char *argv[]) {
     if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
         perror("smash error: failed to set ctrl-C handler");
     }
+    if (signal(SIGALRM, alarmHandler) == SIG_ERR) {
+        perror("smash error: failed to set alarm handler");
+    }
     
+    // smash [--trace file] [-i] [-c "command" | script | --listen socket]
+    const char *command = nullptr;
+    const char *listenPath = nullptr;
+    const char *script = nullptr;
+    bool forceInteractive = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            Tracer::getInstance().start(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && !script) {
+            command = argv[++i];
+        } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc && !command && !script) {
+            listenPath = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0) {
+            forceInteractive = true;
+        } else if (argv[i][0] != '-' && !command && !script && !listenPath) {
+            script = argv[i];
+        } else {
+            std::cerr << "smash error: invalid option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if (listenPath) {
+        // No terminal to take ctrl-C from: it stops the server
+        signal(SIGINT, SIG_DFL);
+        ControlServer server;
+        if (!server.listen(listenPath)) {
+            return 1;
+        }
+        server.run();
+        return 0;
+    }
 
     SmallShell &smash = SmallShell::getInstance();
+    if (command) {
+        smash.executeLines(command);
+        return smash.getLastStatus();
+    }
+
+    int fd = STDIN_FILENO;
+    if (script) {
+        fd = open(script, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror("smash error: open failed");
+            return 127;
+        }
+    }
+    // Prompts only when someone is typing at us (or the caller insists)
+    bool interactive = !script && (forceInteractive || isatty(STDIN_FILENO));
+
+    // Interactive lines are kept in $HISTFILE, else ~/.smash_history;
+    // an empty HISTFILE keeps them in memory only
+    History &history = smash.getHistory();
+    if (interactive) {
+        const std::string *histFile = smash.getVariables().find("HISTFILE");
+        const std::string *home = smash.getVariables().find("HOME");
+        if (histFile) {
+            history.setPath(*histFile);
+        } else if (home) {
+            history.setPath(*home + "/.smash_history");
+        }
+    }
+
+    // On a terminal lines are edited in raw mode, with Tab completion
+    Completer completer;
+    completer.commands().setBuiltins(std::vector<std::string>(SmallShell::RESERVED_COMMANDS.begin(),
+                                                              SmallShell::RESERVED_COMMANDS.end()));
+    LineEditor editor(fd, STDOUT_FILENO, history, completer);
+    bool editing = interactive && editor.usable();
+
+    LineReader reader(fd);
+    std::string cmd_line;
+    std::string expanded;
     while (true) {
-        std::cout << smash.getPrompt() << "> ";
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
+        if (editing) {
+            const std::string *path = smash.getVariables().find("PATH");
+            completer.setPath(path ? *path : "");
+            smash.flushOutput();
+            if (!editor.readLine(smash.getPrompt() + "> ", cmd_line)) {
+                break;
+            }
+        } else {
+            if (interactive) {
+                std::cout << smash.getPrompt() << "> " << std::flush;
+            }
+            if (!reader.next(cmd_line)) {
+                break;
+            }
+            if (!script) {
+                reader.syncOffset();
+            }
+        }
+        if (interactive) {
+            if (!history.expand(cmd_line, expanded)) {
+                std::cerr << "smash error: " << expanded << ": event not found" << std::endl;
+                continue;
+            }
+            if (expanded != cmd_line) {
+                // Show what "!..." stood for, like bash
+                std::cout << expanded << '\n';
+                cmd_line.swap(expanded);
+            }
+            history.add(cmd_line);
+        }
         smash.executeCommand(cmd_line.c_str());
     }
-    return 0;
-}
\ No newline at end of file
+    if (script) {
+        close(fd);
+    }
+    return smash.getLastStatus();
+}
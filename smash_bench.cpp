@@ -0,0 +1,873 @@
+// Micro and macro benchmarks of the shell's hot paths. Results are written as
+// JSON to stdout so runs can be compared across builds; the shell's own
+// output is sent to /dev/null while the benchmarks run.
+//
+// usage: smash_bench [name-filter]
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "Commands.h"
+#include "stats.h"
+#include "input.h"
+#include "complete.h"
+#include "libsmash.h"
+#include "dirwatch.h"
+#include "wordcount.h"
+#include "strsearch.h"
+
+int _parseCommandLine(const char *cmd_line, char **args);
+
+using namespace std;
+
+namespace {
+
+struct Result {
+    string name;
+    unsigned long iterations;
+    double nsPerOp;
+    double bytesPerSec;
+    double linesPerSec;
+    double writesPerOp;
+};
+
+vector<Result> g_results;
+const char *g_filter = nullptr;
+
+// write(2)-family calls made by this process so far (syscw in /proc/self/io).
+unsigned long writeSyscalls() {
+    char buf[512];
+    int fd = open("/proc/self/io", O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    const char *field = strstr(buf, "syscw:");
+    return field ? strtoul(field + 6, nullptr, 10) : 0;
+}
+
+// Runs op `iterations` times after a short warm-up and records ns/op.
+// bytesPerOp and linesPerOp, when given, also report throughput.
+void bench(const string &name, unsigned long iterations, const function<void()> &op,
+           double bytesPerOp = 0, double linesPerOp = 0) {
+    if (g_filter && name.find(g_filter) == string::npos) {
+        return;
+    }
+    for (unsigned long i = 0; i < iterations / 10 + 1; ++i) {
+        op();
+    }
+    unsigned long writesBefore = writeSyscalls();
+    uint64_t start = statsNow();
+    for (unsigned long i = 0; i < iterations; ++i) {
+        op();
+    }
+    double nsPerOp = static_cast<double>(statsNow() - start) / iterations;
+    double writesPerOp = static_cast<double>(writeSyscalls() - writesBefore) / iterations;
+    Result result = {name, iterations, nsPerOp, bytesPerOp > 0 ? bytesPerOp * 1e9 / nsPerOp : 0,
+                     linesPerOp > 0 ? linesPerOp * 1e9 / nsPerOp : 0, writesPerOp};
+    g_results.push_back(result);
+}
+
+// Output of printJobsList/printAliases goes to std::cout: swallow it.
+class CoutSilencer {
+public:
+    CoutSilencer() : m_old(cout.rdbuf(m_sink.rdbuf())) {}
+
+    ~CoutSilencer() {
+        cout.rdbuf(m_old);
+    }
+
+private:
+    ostringstream m_sink;
+    streambuf *m_old;
+};
+
+class WatchProcParser : public WatchProcCommand {
+public:
+    WatchProcParser() : WatchProcCommand("watchproc 1") {}
+
+    double memory(const string &status) {
+        return parseMemoryMb(status);
+    }
+
+    double cpu(const string &stat) {
+        return parseCpuPercent(stat);
+    }
+};
+
+string readFile(const char *path) {
+    string content;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return content;
+    }
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        content.append(buf, len);
+    }
+    close(fd);
+    return content;
+}
+
+// depth levels of `fanout` directories, each holding `files` 4KB files.
+void buildTree(const string &root, int depth, int fanout, int files) {
+    mkdir(root.c_str(), 0755);
+    string block(4096, 'x');
+    for (int f = 0; f < files; ++f) {
+        string path = root + "/file" + to_string(f);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd != -1) {
+            if (write(fd, block.data(), block.size()) == -1) {
+                perror("smash_bench: write failed");
+            }
+            close(fd);
+        }
+    }
+    if (depth > 0) {
+        for (int d = 0; d < fanout; ++d) {
+            buildTree(root + "/dir" + to_string(d), depth - 1, fanout, files);
+        }
+    }
+}
+
+// Path of an executable next to this one, or "" if there is none.
+string siblingBinary(const char *name) {
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len <= 0) {
+        return "";
+    }
+    string path(self, len);
+    path = path.substr(0, path.rfind('/') + 1) + name;
+    return access(path.c_str(), X_OK) == 0 ? path : "";
+}
+
+// Starts an interactive smash on pipes and waits for its first prompt, then
+// closes its stdin so it exits.
+void timeToFirstPrompt(const string &smashBin) {
+    int in[2], out[2];
+    if (pipe(in) == -1 || pipe(out) == -1) {
+        perror("smash_bench: pipe failed");
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execl(smashBin.c_str(), smashBin.c_str(), "-i", (char *) nullptr);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    char buf[64];
+    ssize_t len;
+    while ((len = read(out[0], buf, sizeof(buf))) > 0 && memchr(buf, '>', len) == nullptr) {
+    }
+    close(in[1]);
+    while (read(out[0], buf, sizeof(buf)) > 0) {
+    }
+    close(out[0]);
+    waitpid(pid, nullptr, 0);
+}
+
+// Starts "smash --listen path" and connects to it. Returns the connection,
+// or -1 with *pid still set if the server would not come up.
+int startServer(const string &smashBin, const string &path, pid_t *pid) {
+    *pid = fork();
+    if (*pid == 0) {
+        int devNull = open("/dev/null", O_RDWR);
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        execl(smashBin.c_str(), smashBin.c_str(), "--listen", path.c_str(), (char *) nullptr);
+        _exit(127);
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+// Sends count copies of a request at once, then reads until every reply's
+// "exit" line is in; the output frames are skipped.
+void serverRequests(int fd, const string &command, int count) {
+    string request = "run " + to_string(command.size()) + "\n" + command;
+    string all;
+    for (int i = 0; i < count; ++i) {
+        all += request;
+    }
+    if (write(fd, all.data(), all.size()) != static_cast<ssize_t>(all.size())) {
+        return;
+    }
+    string in;
+    size_t pos = 0;
+    while (count > 0) {
+        size_t newline = in.find('\n', pos);
+        if (newline == string::npos) {
+            char buf[4096];
+            ssize_t len = read(fd, buf, sizeof(buf));
+            if (len <= 0) {
+                return;
+            }
+            in.append(buf, len);
+            continue;
+        }
+        if (in.compare(pos, 5, "exit ") == 0) {
+            --count;
+            pos = newline + 1;
+            continue;
+        }
+        size_t length = strtoul(in.c_str() + pos + 4, nullptr, 10);
+        if (in.size() < newline + 1 + length) {
+            char buf[4096];
+            ssize_t len = read(fd, buf, sizeof(buf));
+            if (len <= 0) {
+                return;
+            }
+            in.append(buf, len);
+            continue;
+        }
+        pos = newline + 1 + length;
+    }
+}
+
+void microBenchmarks() {
+    SmallShell &smash = SmallShell::getInstance();
+
+    bench("parse_command_line", 200000, [] {
+        char *args[COMMAND_MAX_ARGS + 1];
+        int argc = _parseCommandLine("ls -la /usr/share/doc --color=never", args);
+        for (int i = 0; i < argc; ++i) {
+            free(args[i]);
+        }
+    });
+
+    bench("create_command_builtin", 200000, [&smash] {
+        delete smash.CreateCommand("pwd");
+    });
+
+    bench("create_command_redirection", 200000, [&smash] {
+        delete smash.CreateCommand("showpid > /dev/null");
+    });
+
+    for (int i = 0; i < 100; ++i) {
+        smash.addAlias("bench_alias" + to_string(i), "bench_alias" + to_string(i + 1));
+    }
+    smash.addAlias("bench_alias100", "pwd");
+    bench("alias_expand_depth_1", 100000, [&smash] {
+        delete smash.CreateCommand("bench_alias100");
+    });
+    bench("alias_expand_depth_100", 2000, [&smash] {
+        delete smash.CreateCommand("bench_alias0");
+    });
+    for (int i = 0; i <= 100; ++i) {
+        smash.removeAlias("bench_alias" + to_string(i));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        smash.addAlias("bench_many" + to_string(i), "showpid");
+    }
+    bench("alias_resolve_10k", 200000, [&smash] {
+        delete smash.CreateCommand("bench_many9999");
+    });
+    bench("alias_define_remove_10k", 200000, [&smash] {
+        smash.addAlias("bench_tmp", "pwd");
+        smash.removeAlias("bench_tmp");
+    });
+    for (int i = 0; i < 10000; ++i) {
+        smash.removeAlias("bench_many" + to_string(i));
+    }
+
+    // 10k exported variables: lookups and unsets must not scan them
+    VariableStore &variables = smash.getVariables();
+    for (int i = 0; i < 10000; ++i) {
+        variables.set("BENCH_VAR" + to_string(i), "value" + to_string(i), true);
+    }
+    bench("var_lookup_10k", 1000000, [&variables] {
+        variables.find("BENCH_VAR5000");
+    });
+    bench("var_set_unset_10k", 200000, [&variables] {
+        variables.set("BENCH_TMP", "x", true);
+        variables.unset("BENCH_TMP");
+    });
+    bench("parse_expand_variable", 200000, [] {
+        char *args[COMMAND_MAX_ARGS + 1];
+        int argc = _parseCommandLine("echo $BENCH_VAR5000 ${BENCH_VAR9999}/bin", args);
+        for (int i = 0; i < argc; ++i) {
+            free(args[i]);
+        }
+    });
+    bench("envp_cached_10k", 1000000, [&variables] {
+        variables.envp();
+    });
+    bench("envp_rebuild_10k", 200, [&variables] {
+        variables.set("BENCH_VAR0", "changed", true);
+        variables.envp();
+        variables.set("BENCH_VAR0", "value0", true);
+    });
+    for (int i = 0; i < 10000; ++i) {
+        variables.unset("BENCH_VAR" + to_string(i));
+    }
+
+    // Jobs all point at one long-lived child so the reaping sweep keeps them.
+    pid_t sleeper = fork();
+    if (sleeper == 0) {
+        pause();
+        _exit(0);
+    }
+    {
+        CoutSilencer silence;
+        bench("jobs_add_1000", 5, [sleeper] {
+            JobsList jobs;
+            for (int i = 0; i < 1000; ++i) {
+                jobs.addJob("sleep 100&", sleeper);
+            }
+        });
+        JobsList jobs;
+        for (int i = 0; i < 1000; ++i) {
+            jobs.addJob("sleep 100&", sleeper);
+        }
+        bench("jobs_get_by_id", 100000, [&jobs] {
+            jobs.getJobById(500);
+        });
+        bench("jobs_remove_finished", 1000, [&jobs] {
+            jobs.removeFinishedJobs();
+        });
+        bench("jobs_print", 1000, [&jobs] {
+            jobs.printJobsList(cout);
+        });
+    }
+    kill(sleeper, SIGKILL);
+    waitpid(sleeper, nullptr, 0);
+
+    WatchProcParser parser;
+    string status = readFile("/proc/self/status");
+    string stat = readFile("/proc/self/stat");
+    bench("watchproc_parse_memory", 100000, [&parser, &status] {
+        parser.memory(status);
+    });
+    bench("watchproc_parse_cpu", 20000, [&parser, &stat] {
+        parser.cpu(stat);
+    });
+
+    bench("stats_timed_phase", 1000000, [] {
+        StatTimer timer(STAT_PARSE);
+    });
+}
+
+void macroBenchmarks() {
+    SmallShell &smash = SmallShell::getInstance();
+
+    bench("fork_exec_true", 500, [&smash] {
+        smash.executeCommand("/bin/true");
+    });
+
+    // libsmash: a command string through a live session, output captured,
+    // against the "smash -c" subprocess it replaces (spawn_smash_c_true below)
+    SmashSession session;
+    bench("session_run_builtin", 20000, [&session] {
+        session.run("pwd");
+    });
+    bench("session_run_external", 500, [&session] {
+        session.run("/bin/true");
+    });
+    // Many sessions on their own threads at once, each in its own directory
+    vector<unique_ptr<SmashSession>> sessions;
+    for (int i = 0; i < 64; ++i) {
+        sessions.emplace_back(new SmashSession());
+    }
+    bench("sessions_64_concurrent_cd_pwd", 50, [&sessions] {
+        vector<thread> threads;
+        for (unique_ptr<SmashSession> &s : sessions) {
+            SmashSession *one = s.get();
+            threads.emplace_back([one] {
+                one->run("cd /tmp\npwd\ncd -");
+            });
+        }
+        for (thread &t : threads) {
+            t.join();
+        }
+    });
+
+    // Lists run in-process: no interpreter between the shell and its commands
+    bench("list_builtins", 20000, [&smash] {
+        smash.executeCommand("chprompt bench && pwd; chprompt smash || pwd");
+    });
+    bench("list_externals", 200, [&smash] {
+        smash.executeCommand("/bin/true && /bin/false || /bin/true");
+    });
+
+    // $(...): a built-in is captured without forking, an external takes the fork path
+    bench("substitute_builtin", 20000, [&smash] {
+        smash.executeCommand("cd $(pwd)");
+    });
+    bench("substitute_external", 200, [&smash] {
+        smash.executeCommand("cd $(/bin/pwd)");
+    });
+
+    const double pipeBytes = 64.0 * 1024 * 1024;
+    bench("pipe_64MB", 5, [&smash] {
+        smash.executeCommand("head -c 67108864 /dev/zero | cat");
+    }, pipeBytes);
+
+    char dir[] = "/tmp/smash_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("smash_bench: mkdtemp failed");
+        return;
+    }
+    string root = dir;
+    string redirectCmd = "showpid > " + root + "/redirect.txt";
+    bench("redirect_builtin", 5000, [&smash, &redirectCmd] {
+        smash.executeCommand(redirectCmd.c_str());
+    });
+    // jobs > file with 10k entries: one write per line before output buffering
+    pid_t sleeper = fork();
+    if (sleeper == 0) {
+        pause();
+        _exit(0);
+    }
+    JobsList *jobs = smash.getAllJobs();
+    for (int i = 0; i < 10000; ++i) {
+        jobs->addJob("sleep 100&", sleeper);
+    }
+    string jobsCmd = "jobs > " + root + "/jobs.txt";
+    bench("jobs_print_10k_redirected", 20, [&smash, &jobsCmd] {
+        smash.executeCommand(jobsCmd.c_str());
+    });
+    kill(sleeper, SIGKILL);
+    waitpid(sleeper, nullptr, 0);
+    jobs->removeFinishedJobs();
+
+    string redirectExternal = "/bin/true > " + root + "/redirect.txt";
+    bench("redirect_external", 500, [&smash, &redirectExternal] {
+        smash.executeCommand(redirectExternal.c_str());
+    });
+
+    // 3 levels of 8 directories with 20 files each: 585 dirs, 11700 files
+    buildTree(root + "/tree", 3, 8, 20);
+    string duCmd = "du " + root + "/tree";
+    bench("du_tree_585_dirs", 20, [&smash, &duCmd] {
+        smash.executeCommand(duCmd.c_str());
+    });
+
+    // watchdir -r: one getdents64 walk registers every directory; after that
+    // events alone keep the watches current
+    buildTree(root + "/wtree", 4, 8, 0);
+    string watchRoot = root + "/wtree";
+    bench("watchdir_register_4681_dirs", 20, [&watchRoot] {
+        DirectoryWatcher watcher;
+        watcher.start(watchRoot, true);
+    });
+
+    // wc on a 1 GiB log: the built-in maps the file and counts 32 bytes at
+    // a time, against coreutils wc, which the shell has to fork for
+    const size_t logBlock = 1 << 20;
+    const int logBlocks = 1024;
+    string logFile = root + "/big.log";
+    string block;
+    for (int i = 0; block.size() < logBlock; ++i) {
+        char line[128];
+        snprintf(line, sizeof(line), "2024-05-01 12:%02d:%02d INFO worker-%d request %d served in %d ms\n",
+                 i / 60 % 60, i % 60, i % 32, i, i * 7 % 500);
+        block += line;
+    }
+    block.resize(logBlock);
+    {
+        int fd = open(logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        for (int i = 0; fd != -1 && i < logBlocks; ++i) {
+            if (write(fd, block.data(), block.size()) != static_cast<ssize_t>(block.size())) {
+                break;
+            }
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    const double logBytes = static_cast<double>(logBlock) * logBlocks;
+    string wcLines = "wc -l " + logFile;
+    string wcAll = "wc " + logFile;
+    string coreutilsLines = "/usr/bin/wc -l " + logFile;
+    string coreutilsAll = "/usr/bin/wc " + logFile;
+    bench("wc_l_1GB_builtin", 5, [&smash, &wcLines] {
+        smash.executeCommand(wcLines.c_str());
+    }, logBytes);
+    bench("wc_l_1GB_coreutils", 5, [&smash, &coreutilsLines] {
+        smash.executeCommand(coreutilsLines.c_str());
+    }, logBytes);
+    bench("wc_1GB_builtin", 3, [&smash, &wcAll] {
+        smash.executeCommand(wcAll.c_str());
+    }, logBytes);
+    bench("wc_1GB_coreutils", 3, [&smash, &coreutilsAll] {
+        smash.executeCommand(coreutilsAll.c_str());
+    }, logBytes);
+    // As a pipe stage: read from the pipe in the shell, no second fork
+    bench("wc_l_pipe_stage_64MB", 5, [&smash] {
+        smash.executeCommand("head -c 67108864 /dev/zero | wc -l");
+    }, pipeBytes);
+    // The kernels alone, on data already in memory
+    for (int kernel = WordCounter::SCALAR; kernel <= WordCounter::AVX2; ++kernel) {
+        WordCounter::Kernel k = static_cast<WordCounter::Kernel>(kernel);
+        if (!WordCounter::supported(k)) {
+            continue;
+        }
+        const int rounds = 64;
+        bench(string("wc_kernel_lines_") + WordCounter::name(k), 10, [&block, k] {
+            WordCounter counter(WordCounter::LINES, k);
+            for (int i = 0; i < rounds; ++i) {
+                counter.add(block.data(), block.size());
+            }
+        }, static_cast<double>(logBlock) * rounds);
+        bench(string("wc_kernel_words_") + WordCounter::name(k), 10, [&block, k] {
+            WordCounter counter(WordCounter::LINES | WordCounter::WORDS, k);
+            for (int i = 0; i < rounds; ++i) {
+                counter.add(block.data(), block.size());
+            }
+        }, static_cast<double>(logBlock) * rounds);
+    }
+    // grep on the same log, against GNU grep: a string that never occurs
+    // (a pure scan), one on every 32nd line, ignoring case and inverted.
+    // Output goes to a file: GNU grep stops at the first match when it
+    // writes to /dev/null
+    const struct {
+        const char *name;
+        const char *args;
+    } grepCases[] = {
+        {"absent", "timeout"},
+        {"every_32nd", "worker-7"},
+        {"c_every_32nd", "-c worker-7"},
+        {"ci_absent", "-c -i TIMEOUT"},
+        {"cv_every_line", "-c -v INFO"},
+    };
+    for (const auto &grepCase : grepCases) {
+        string builtin = string("grep ") + grepCase.args + " " + logFile + " > " + root + "/grep.out";
+        string gnu = string("/usr/bin/grep ") + grepCase.args + " " + logFile + " > " + root + "/grep.out";
+        bench(string("grep_") + grepCase.name + "_1GB_builtin", 3, [&smash, &builtin] {
+            smash.executeCommand(builtin.c_str());
+        }, logBytes);
+        bench(string("grep_") + grepCase.name + "_1GB_gnu", 3, [&smash, &gnu] {
+            smash.executeCommand(gnu.c_str());
+        }, logBytes);
+    }
+    bench("grep_c_pipe_stage_64MB", 5, [&smash] {
+        smash.executeCommand("head -c 67108864 /dev/zero | grep -c x");
+    }, pipeBytes);
+    unlink((root + "/grep.out").c_str());
+    for (int kernel = StringSearcher::SCALAR; kernel <= StringSearcher::AVX2; ++kernel) {
+        StringSearcher::Kernel k = static_cast<StringSearcher::Kernel>(kernel);
+        if (!StringSearcher::supported(k)) {
+            continue;
+        }
+        const int rounds = 64;
+        for (int ignoreCase = 0; ignoreCase < 2; ++ignoreCase) {
+            StringSearcher searcher("timeout", ignoreCase != 0, k);
+            bench(string("grep_kernel_") + (ignoreCase ? "i_" : "") + StringSearcher::name(k), 10,
+                  [&block, &searcher] {
+                for (int i = 0; i < rounds; ++i) {
+                    if (searcher.find(block.data(), block.data() + block.size()) != block.data() + block.size()) {
+                        break;
+                    }
+                }
+            }, static_cast<double>(logBlock) * rounds);
+        }
+    }
+    unlink(logFile.c_str());
+
+    // Batch mode: 100k-line script, read alone and read + executed
+    const int scriptLines = 100000;
+    string script = root + "/script.sh";
+    {
+        string body;
+        for (int i = 0; i < scriptLines; ++i) {
+            body += (i % 2 ? "pwd\n" : "chprompt smash\n");
+        }
+        int fd = open(script.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || write(fd, body.data(), body.size()) != static_cast<ssize_t>(body.size())) {
+            perror("smash_bench: cannot write script");
+        }
+        close(fd);
+    }
+    bench("script_read_100k_lines", 20, [&script] {
+        int fd = open(script.c_str(), O_RDONLY);
+        LineReader reader(fd);
+        string line;
+        while (reader.next(line)) {
+        }
+        close(fd);
+    }, 0, scriptLines);
+    bench("script_read_100k_lines_getline", 20, [&script] {
+        ifstream in(script.c_str());
+        string line;
+        while (getline(in, line)) {
+        }
+    }, 0, scriptLines);
+    bench("script_run_100k_lines", 3, [&smash, &script] {
+        int fd = open(script.c_str(), O_RDONLY);
+        LineReader reader(fd);
+        string line;
+        while (reader.next(line)) {
+            smash.executeCommand(line.c_str());
+        }
+        close(fd);
+    }, 0, scriptLines);
+
+    // 100k alias definitions from a script; each run removes them again
+    const int aliasLines = 100000;
+    string aliasScript = root + "/aliases.sh";
+    {
+        string body;
+        for (int i = 0; i < aliasLines; ++i) {
+            body += "alias bench_def" + to_string(i) + "='echo " + to_string(i) + "'\n";
+        }
+        int fd = open(aliasScript.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || write(fd, body.data(), body.size()) != static_cast<ssize_t>(body.size())) {
+            perror("smash_bench: cannot write script");
+        }
+        close(fd);
+    }
+    bench("script_define_100k_aliases", 3, [&smash, &aliasScript] {
+        int fd = open(aliasScript.c_str(), O_RDONLY);
+        LineReader reader(fd);
+        string line;
+        while (reader.next(line)) {
+            smash.executeCommand(line.c_str());
+        }
+        close(fd);
+        for (int i = 0; i < aliasLines; ++i) {
+            smash.removeAlias("bench_def" + to_string(i));
+        }
+    }, 0, aliasLines);
+
+    // 1M-entry history file, loaded lazily on first use
+    const int historyEntries = 1000000;
+    string historyFile = root + "/history";
+    {
+        string body;
+        for (int i = 0; i < historyEntries; ++i) {
+            string line;
+            switch (i % 3) {
+                case 0: line = "git status --short " + to_string(i); break;
+                case 1: line = "make -j8 target" + to_string(i); break;
+                default: line = "ls -la /var/log/app" + to_string(i); break;
+            }
+            body += ":" + to_string(line.size()) + ":" + line + "\n";
+        }
+        int fd = open(historyFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || write(fd, body.data(), body.size()) != static_cast<ssize_t>(body.size())) {
+            perror("smash_bench: cannot write history");
+        }
+        close(fd);
+    }
+    bench("history_load_1M", 5, [&historyFile] {
+        History history;
+        history.setPath(historyFile);
+        history.size();
+    }, 0, historyEntries);
+    {
+        History history;
+        history.setPath(historyFile);
+        long total = static_cast<long>(history.size());
+        bench("history_search_recent_1M", 100000, [&history, total] {
+            history.search("git status", total);
+        });
+        // ctrl-R typing "target99": each key resumes from the previous match
+        bench("history_search_incremental_1M", 20000, [&history, total] {
+            string needle = "target99";
+            long match = total;
+            for (size_t len = 1; len <= needle.size() && match >= 0; ++len) {
+                match = history.search(needle.substr(0, len), match + 1);
+            }
+        });
+        bench("history_search_miss_1M", 20, [&history, total] {
+            history.search("no such command", total);
+        });
+        string expanded;
+        bench("history_expand_bang_n", 1000000, [&history, &expanded] {
+            history.expand("!500000", expanded);
+        });
+        bench("history_expand_bang_prefix", 100000, [&history, &expanded] {
+            history.expand("!make", expanded);
+        });
+    }
+    string appendFile = root + "/history_append";
+    History appendHistory;
+    appendHistory.setPath(appendFile);
+    bench("history_add", 100000, [&appendHistory] {
+        appendHistory.add("echo appended to the history file");
+    });
+
+    // Tab completion in a 200k-entry directory and over $PATH
+    string bigDir = root + "/big";
+    mkdir(bigDir.c_str(), 0755);
+    for (int i = 0; i < 200000; ++i) {
+        int fd = open((bigDir + "/file" + to_string(i)).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    Completer completer;
+    const char *pathVar = getenv("PATH");
+    completer.setPath(pathVar ? pathVar : "/usr/bin:/bin");
+    Completion completion;
+    // Unique: every entry has to be seen to know there is no other match
+    bench("complete_path_200k_unique", 50, [&completer, &completion, &bigDir] {
+        completer.complete(bigDir + "/file199999", false, false, 100, completion);
+    });
+    // Cold: a new entry moves the mtime, so the listing is read again
+    string touched = bigDir + "/touched";
+    bench("complete_path_200k_unique_cold", 10, [&completer, &completion, &bigDir, &touched] {
+        close(open(touched.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+        unlink(touched.c_str());
+        completer.complete(bigDir + "/file199999", false, false, 100, completion);
+    });
+    // Ambiguous: stops once two names share nothing beyond the prefix
+    bench("complete_path_200k_ambiguous", 20000, [&completer, &completion, &bigDir] {
+        completer.complete(bigDir + "/file1", false, false, 100, completion);
+    });
+    bench("complete_path_200k_list", 20000, [&completer, &completion, &bigDir] {
+        completer.complete(bigDir + "/file12", false, true, 100, completion);
+    });
+    bench("complete_command_trie", 100000, [&completer, &completion] {
+        completer.complete("gi", true, false, 100, completion);
+    });
+    vector<string> builtins(SmallShell::RESERVED_COMMANDS.begin(), SmallShell::RESERVED_COMMANDS.end());
+    bench("complete_command_trie_rebuild", 50, [&completer, &completion, &builtins] {
+        completer.commands().setBuiltins(builtins);
+        completer.complete("gi", true, false, 100, completion);
+    });
+
+    string smashBin = siblingBinary("smash");
+    if (smashBin.empty()) {
+        smashBin = siblingBinary("skeleton_smash");
+    }
+    if (!smashBin.empty()) {
+        bench("startup_to_first_prompt", 200, [&smashBin] {
+            timeToFirstPrompt(smashBin);
+        });
+        bench("spawn_smash_c_true", 200, [&smashBin] {
+            pid_t pid = fork();
+            if (pid == 0) {
+                execl(smashBin.c_str(), smashBin.c_str(), "-c", "/bin/true", (char *) nullptr);
+                _exit(127);
+            }
+            waitpid(pid, nullptr, 0);
+        });
+
+        // smash --listen: one long-lived shell serving requests over a socket,
+        // against the spawn per command above
+        string socketPath = root + "/smash.sock";
+        pid_t server;
+        int conn = startServer(smashBin, socketPath, &server);
+        if (conn != -1) {
+            bench("server_request_builtin", 20000, [conn] {
+                serverRequests(conn, "pwd", 1);
+            });
+            bench("server_request_external", 500, [conn] {
+                serverRequests(conn, "/bin/true", 1);
+            });
+            bench("server_requests_pipelined_100", 200, [conn] {
+                serverRequests(conn, "pwd", 100);
+            });
+            serverRequests(conn, "quit", 1);
+            close(conn);
+        } else {
+            cerr << "smash_bench: " << smashBin << " --listen did not come up" << endl;
+            kill(server, SIGKILL);
+        }
+        waitpid(server, nullptr, 0);
+    }
+
+    string cleanup = "rm -rf " + root;
+    if (system(cleanup.c_str()) != 0) {
+        cerr << "smash_bench: could not remove " << root << endl;
+    }
+}
+
+void printJson(ostream &out) {
+    out << "{" << endl << "  \"benchmarks\": [" << endl;
+    for (size_t i = 0; i < g_results.size(); ++i) {
+        const Result &r = g_results[i];
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "    {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.1f, \"ops_per_sec\": %.1f",
+                 r.name.c_str(), r.iterations, r.nsPerOp, 1e9 / r.nsPerOp);
+        out << line;
+        if (r.bytesPerSec > 0) {
+            snprintf(line, sizeof(line), ", \"bytes_per_sec\": %.0f", r.bytesPerSec);
+            out << line;
+        }
+        if (r.writesPerOp > 0) {
+            snprintf(line, sizeof(line), ", \"write_syscalls_per_op\": %.1f", r.writesPerOp);
+            out << line;
+        }
+        if (r.linesPerSec > 0) {
+            snprintf(line, sizeof(line), ", \"lines_per_sec\": %.0f", r.linesPerSec);
+            out << line;
+        }
+        out << "}" << (i + 1 < g_results.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl << "}" << endl;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        g_filter = argv[1];
+    }
+
+    // Keep the real stdout for the report; everything the shell prints goes away.
+    int report = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if (report == -1 || devNull == -1 || dup2(devNull, STDOUT_FILENO) == -1) {
+        perror("smash_bench: cannot redirect stdout");
+        return 1;
+    }
+    close(devNull);
+
+    microBenchmarks();
+    macroBenchmarks();
+
+    cout.flush();
+    if (dup2(report, STDOUT_FILENO) == -1) {
+        perror("smash_bench: cannot restore stdout");
+        return 1;
+    }
+    close(report);
+    printJson(cout);
+    return 0;
+}
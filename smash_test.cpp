@@ -0,0 +1,278 @@
+// Checks of what the scripted tests (test_input*.txt, fed to smash -i)
+// cannot reach: the embedding API and the control server. Each failure is
+// printed; the exit status is 1 if there was any.
+//
+// usage: smash_test
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "libsmash.h"
+
+using namespace std;
+
+namespace {
+
+int g_failures = 0;
+
+void check(bool ok, const string &what) {
+    if (!ok) {
+        cerr << "FAILED: " << what << endl;
+        ++g_failures;
+    }
+}
+
+struct Output {
+    int status;
+    string out;
+    string err;
+};
+
+Output run(SmashSession &session, const string &cmdLine) {
+    Output output;
+    output.status = session.run(cmdLine, "", [&output](const char *data, size_t length) {
+        output.out.append(data, length);
+    }, [&output](const char *data, size_t length) {
+        output.err.append(data, length);
+    });
+    return output;
+}
+
+void writeFile(const string &path, const string &content) {
+    ofstream file(path.c_str());
+    file << content;
+}
+
+// A line with redirections of its own still sends the other streams to
+// the session, for built-ins and externals alike.
+void testSessionRedirections(const string &dir) {
+    SmashSession session;
+    run(session, "cd " + dir);
+    writeFile(dir + "/rel.txt", "foo\nbar\n");
+
+    Output output = run(session, "cat < rel.txt");
+    check(output.status == 0 && output.out == "foo\nbar\n", "session: cat < rel.txt");
+    output = run(session, "pwd < rel.txt");
+    check(output.out == dir + "\n", "session: pwd < rel.txt");
+    output = run(session, "grep foo < rel.txt");
+    check(output.status == 0 && output.out == "foo\n", "session: grep foo < rel.txt");
+    output = run(session, "wc -l < rel.txt 2> err.txt");
+    check(output.out == "2\n", "session: wc -l < rel.txt 2> err.txt");
+    output = run(session, "wc --lines < rel.txt");
+    check(output.status == 0 && output.out == "2\n", "session: wc --lines < rel.txt");
+    output = run(session, "ls /nonexistent 2>&1 > /dev/null");
+    check(output.status != 0 && output.out.find("/nonexistent") != string::npos && output.err.empty(),
+          "session: ls /nonexistent 2>&1 > /dev/null");
+    output = run(session, "echo out > out.txt");
+    check(output.out.empty(), "session: echo out > out.txt");
+}
+
+// $(...) captures what the inner command prints even when it redirects
+// some of its streams itself.
+void testSubstitutions(const string &dir) {
+    SmashSession session;
+    run(session, "cd " + dir);
+    writeFile(dir + "/rel.txt", "foo\nbar\n");
+
+    Output output = run(session, "echo A$(pwd < /dev/null)B");
+    check(output.out == "A" + dir + "B\n", "substitution: echo A$(pwd < /dev/null)B");
+    output = run(session, "echo A$(cat < rel.txt)B");
+    check(output.out == "Afoo barB\n", "substitution: echo A$(cat < rel.txt)B");
+    output = run(session, "echo A$(wc -l < rel.txt)B");
+    check(output.out == "A2B\n", "substitution: echo A$(wc -l < rel.txt)B");
+    output = run(session, "echo A$(echo $(cat < rel.txt))B");
+    check(output.out == "Afoo barB\n", "substitution: echo A$(echo $(cat < rel.txt))B");
+    output = run(session, "echo A$(ls /nonexistent 2>&1 > /dev/null)B");
+    check(output.out.find("/nonexistent") != string::npos && output.err.empty(),
+          "substitution: echo A$(ls /nonexistent 2>&1 > /dev/null)B");
+}
+
+// Reports on stderr do not fail a command; error messages do.
+void testStatuses() {
+    SmashSession session;
+    Output output = run(session, "time /bin/true && echo ok");
+    check(output.status == 0 && output.out == "ok\n" && !output.err.empty(), "status: time /bin/true && echo ok");
+    output = run(session, "perfstat ls | wc -l");
+    check(output.status == 1 && output.err.find("pipelines are not supported") != string::npos,
+          "status: perfstat ls | wc -l");
+    output = run(session, "cd a b || echo failed");
+    check(output.out == "failed\n", "status: cd a b || echo failed");
+}
+
+// A built-in run with & is a pseudo-job on a thread of the shell: kill
+// names the job, not the shell's pid.
+void testPseudoJobs(const string &dir) {
+    SmashSession session;
+    run(session, "watchdir " + dir + " > /dev/null &");
+    Output output = run(session, "kill -15 1");
+    check(output.status == 0 && output.out == "signal number 15 was sent to job-id 1\n", "pseudo-job: kill -15 1");
+}
+
+// Path of an executable next to this one, or "" if there is none.
+string siblingBinary(const char *name) {
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len <= 0) {
+        return "";
+    }
+    string path(self, len);
+    path = path.substr(0, path.rfind('/') + 1) + name;
+    return access(path.c_str(), X_OK) == 0 ? path : "";
+}
+
+// Starts "smash --listen path" and connects to it; -1 if it would not
+// come up.
+int startServer(const string &smashBin, const string &path, pid_t *pid) {
+    *pid = fork();
+    if (*pid == 0) {
+        execl(smashBin.c_str(), smashBin.c_str(), "--listen", path.c_str(), (char *) nullptr);
+        _exit(127);
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+// Sends one request and collects the payloads of its out and err frames
+// up to its exit line.
+Output request(int fd, const string &command) {
+    Output output = {-1, "", ""};
+    string all = "run " + to_string(command.size()) + "\n" + command;
+    if (write(fd, all.data(), all.size()) != static_cast<ssize_t>(all.size())) {
+        return output;
+    }
+    string in;
+    while (true) {
+        size_t newline = in.find('\n');
+        if (newline != string::npos && in.compare(0, 5, "exit ") == 0) {
+            output.status = atoi(in.c_str() + 5);
+            return output;
+        }
+        size_t length = newline == string::npos ? 0 : strtoul(in.c_str() + 4, nullptr, 10);
+        if (newline != string::npos && in.size() >= newline + 1 + length) {
+            (in.compare(0, 4, "out ") == 0 ? output.out : output.err) += in.substr(newline + 1, length);
+            in.erase(0, newline + 1 + length);
+            continue;
+        }
+        char buf[4096];
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            return output;
+        }
+        in.append(buf, len);
+    }
+}
+
+// smash --listen sends the output of redirected requests to the client, and
+// the commands it runs take signals as usual.
+void testServer(const string &dir) {
+    string smashBin = siblingBinary("smash");
+    if (smashBin.empty()) {
+        smashBin = siblingBinary("skeleton_smash");
+    }
+    check(!smashBin.empty(), "server: smash binary next to smash_test");
+    if (smashBin.empty()) {
+        return;
+    }
+    string socketPath = dir + "/smash.sock";
+    pid_t server;
+    int conn = startServer(smashBin, socketPath, &server);
+    check(conn != -1, "server: --listen comes up");
+    if (conn == -1) {
+        kill(server, SIGKILL);
+        waitpid(server, nullptr, 0);
+        return;
+    }
+    request(conn, "cd " + dir);
+
+    Output output = request(conn, "pwd < /dev/null");
+    check(output.status == 0 && output.out == dir + "\n", "server: pwd < /dev/null");
+    output = request(conn, "ls /nonexistent 2>&1 > /dev/null");
+    check(output.status != 0 && output.out.find("/nonexistent") != string::npos && output.err.empty(),
+          "server: ls /nonexistent 2>&1 > /dev/null");
+    // yes dies of SIGPIPE rather than seeing EPIPE
+    output = request(conn, "yes | head -1");
+    check(output.out == "y\n" && output.err.empty(), "server: yes | head -1");
+    request(conn, "sleep 100&");
+    output = request(conn, "kill -15 1");
+    check(output.status == 0, "server: kill -15 1");
+    output = request(conn, "jobs");
+    for (int attempt = 0; attempt < 100 && !output.out.empty(); ++attempt) {
+        usleep(10000);
+        output = request(conn, "jobs");
+    }
+    check(output.out.empty(), "server: a job killed with SIGTERM is gone");
+
+    // A client may shut down its writing side right after its request
+    int halfClosed = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    string reply;
+    const char half[] = "run 10\necho hello";
+    if (connect(halfClosed, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0 &&
+        write(halfClosed, half, sizeof(half) - 1) == static_cast<ssize_t>(sizeof(half) - 1) &&
+        shutdown(halfClosed, SHUT_WR) == 0) {
+        char buf[4096];
+        ssize_t len;
+        while ((len = read(halfClosed, buf, sizeof(buf))) > 0) {
+            reply.append(buf, len);
+        }
+    }
+    close(halfClosed);
+    check(reply == "out 6\nhello\nexit 0\n", "server: request from a half-closed client");
+
+    request(conn, "quit kill");
+    close(conn);
+    waitpid(server, nullptr, 0);
+}
+
+}
+
+int main() {
+    char dirTemplate[] = "/tmp/smash_test.XXXXXX";
+    char resolved[PATH_MAX];
+    if (!mkdtemp(dirTemplate) || !realpath(dirTemplate, resolved)) {
+        perror("smash_test: mkdtemp failed");
+        return 1;
+    }
+    string dir = resolved;
+
+    testSessionRedirections(dir);
+    testSubstitutions(dir);
+    testStatuses();
+    testPseudoJobs(dir);
+    testServer(dir);
+
+    for (const char *name : {"rel.txt", "err.txt", "out.txt"}) {
+        unlink((dir + "/" + name).c_str());
+    }
+    rmdir(dir.c_str());
+    if (g_failures > 0) {
+        cerr << g_failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "smash_test: all checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <time.h>
+
+uint64_t statsNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+//-------------------------------------LatencyHistogram-------------------------------------
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+int LatencyHistogram::bucketOf(uint64_t ns) {
+    if (ns < LINEAR) {
+        return static_cast<int>(ns);
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    int sub = static_cast<int>((ns >> (exponent - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+    return LINEAR + (exponent - 4) * (1 << SUB_BITS) + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int bucket) {
+    if (bucket < LINEAR) {
+        return bucket;
+    }
+    int exponent = (bucket - LINEAR) / (1 << SUB_BITS) + 4;
+    uint64_t sub = (bucket - LINEAR) % (1 << SUB_BITS);
+    uint64_t step = 1ULL << (exponent - SUB_BITS);
+    return (1ULL << exponent) + (sub + 1) * step - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    m_buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = m_max.load(std::memory_order_relaxed);
+    while (ns > seen && !m_max.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::count() const {
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max() const {
+    return m_max.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += m_buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t bound = bucketUpperBound(bucket);
+            return bound < max() ? bound : max();
+        }
+    }
+    return max();
+}
+
+void LatencyHistogram::reset() {
+    for (int bucket = 0; bucket < BUCKETS; ++bucket) {
+        m_buckets[bucket].store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+//-------------------------------------ShellStats-------------------------------------
+
+namespace {
+
+const char *const PHASE_NAMES[STAT_PHASES] = {
+    "parse", "fork", "exec", "builtin", "reap"
+};
+
+const char *const COUNTER_NAMES[STAT_COUNTERS] = {
+    "commands", "builtins", "externals", "background", "jobs_reaped", "fork_failures"
+};
+
+// Formats a nanosecond value with a unit that keeps it short.
+void formatDuration(char *buf, size_t len, uint64_t ns) {
+    if (ns < 1000) {
+        snprintf(buf, len, "%lluns", static_cast<unsigned long long>(ns));
+    } else if (ns < 1000000) {
+        snprintf(buf, len, "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, len, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(buf, len, "%.2fs", ns / 1e9);
+    }
+}
+
+}
+
+ShellStats::ShellStats() {
+    reset();
+}
+
+void ShellStats::print(std::ostream &out) const {
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %10s %10s %10s %10s", "phase", "count", "p50", "p99", "max");
+    out << line << std::endl;
+    for (int phase = 0; phase < STAT_PHASES; ++phase) {
+        const LatencyHistogram &hist = m_phases[phase];
+        char p50[32], p99[32], max[32];
+        formatDuration(p50, sizeof(p50), hist.percentile(50));
+        formatDuration(p99, sizeof(p99), hist.percentile(99));
+        formatDuration(max, sizeof(max), hist.max());
+        snprintf(line, sizeof(line), "%-10s %10llu %10s %10s %10s", PHASE_NAMES[phase],
+                 static_cast<unsigned long long>(hist.count()), p50, p99, max);
+        out << line << std::endl;
+    }
+    for (int counter = 0; counter < STAT_COUNTERS; ++counter) {
+        snprintf(line, sizeof(line), "%-14s %llu", COUNTER_NAMES[counter],
+                 static_cast<unsigned long long>(m_counters[counter].load(std::memory_order_relaxed)));
+        out << line << std::endl;
+    }
+}
+
+void ShellStats::reset() {
+    for (int phase = 0; phase < STAT_PHASES; ++phase) {
+        m_phases[phase].reset();
+    }
+    for (int counter = 0; counter < STAT_COUNTERS; ++counter) {
+        m_counters[counter].store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef SMASH__STATS_H_
+#define SMASH__STATS_H_
+
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+
+// Phases of command handling the shell times on every command.
+enum StatPhase {
+    STAT_PARSE,     // CreateCommand: trimming, alias expansion, dispatch
+    STAT_FORK,      // fork() as seen by the parent
+    STAT_EXEC,      // fork returned in the parent until the child was reaped
+    STAT_BUILTIN,   // execute() of commands that run inside the shell
+    STAT_REAP,      // JobsList::removeFinishedJobs sweep
+    STAT_PHASES
+};
+
+enum StatCounter {
+    STAT_COMMANDS,
+    STAT_BUILTINS,
+    STAT_EXTERNALS,
+    STAT_BACKGROUND,
+    STAT_JOBS_REAPED,
+    STAT_FORK_FAILURES,
+    STAT_COUNTERS
+};
+
+// Log-linear latency histogram in nanoseconds, in the style of HdrHistogram:
+// exact below 16ns, then 8 sub-buckets per power of two (about 12% error).
+// Recording is a couple of relaxed atomic adds, so it can stay always on.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+
+    uint64_t count() const;
+
+    uint64_t max() const;
+
+    // Upper bound of the bucket holding the p-th percentile (0 < p <= 100).
+    uint64_t percentile(double p) const;
+
+    void reset();
+
+private:
+    static const int LINEAR = 16;
+    static const int SUB_BITS = 3;
+    static const int BUCKETS = LINEAR + (64 - 4) * (1 << SUB_BITS);
+
+    static int bucketOf(uint64_t ns);
+
+    static uint64_t bucketUpperBound(int bucket);
+
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_max;
+};
+
+class ShellStats {
+public:
+    static ShellStats &getInstance() {
+        static ShellStats instance;
+        return instance;
+    }
+
+    ShellStats(ShellStats const &) = delete;
+    void operator=(ShellStats const &) = delete;
+
+    void record(StatPhase phase, uint64_t ns) {
+        m_phases[phase].record(ns);
+    }
+
+    void count(StatCounter counter) {
+        m_counters[counter].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void print(std::ostream &out) const;
+
+    void reset();
+
+private:
+    ShellStats();
+
+    LatencyHistogram m_phases[STAT_PHASES];
+    std::atomic<uint64_t> m_counters[STAT_COUNTERS];
+};
+
+// CLOCK_MONOTONIC in nanoseconds.
+uint64_t statsNow();
+
+// Records the time between construction and destruction into a phase.
+class StatTimer {
+public:
+    explicit StatTimer(StatPhase phase) : m_phase(phase), m_start(statsNow()) {}
+
+    ~StatTimer() {
+        ShellStats::getInstance().record(m_phase, statsNow() - m_start);
+    }
+
+private:
+    StatPhase m_phase;
+    uint64_t m_start;
+};
+
+#endif //SMASH__STATS_H_
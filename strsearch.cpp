@@ -0,0 +1,201 @@
+#include "strsearch.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SMASH_STRSEARCH_X86 1
+#endif
+
+namespace {
+
+struct Pattern {
+    const char *needle;
+    size_t size;
+    bool ignoreCase;
+    unsigned char firstMask;
+    unsigned char firstValue;
+    unsigned char lastMask;
+    unsigned char lastValue;
+};
+
+bool isUpper(unsigned char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+unsigned char fold(unsigned char c) {
+    return isUpper(c) ? c | 0x20 : c;
+}
+
+bool matchesAt(const Pattern &pattern, const char *at) {
+    if (!pattern.ignoreCase) {
+        return memcmp(at, pattern.needle, pattern.size) == 0;
+    }
+    for (size_t i = 0; i < pattern.size; ++i) {
+        if (fold(at[i]) != static_cast<unsigned char>(pattern.needle[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *scalarFind(const Pattern &pattern, const char *begin, const char *end) {
+    if (static_cast<size_t>(end - begin) < pattern.size) {
+        return end;
+    }
+    // The last place a match can start
+    const char *last = end - pattern.size;
+    if (!pattern.ignoreCase) {
+        for (const char *p = begin; p <= last; ++p) {
+            p = static_cast<const char *>(memchr(p, pattern.needle[0], last - p + 1));
+            if (p == nullptr) {
+                break;
+            }
+            if (matchesAt(pattern, p)) {
+                return p;
+            }
+        }
+        return end;
+    }
+    for (const char *p = begin; p <= last; ++p) {
+        if ((static_cast<unsigned char>(*p) | pattern.firstMask) == pattern.firstValue && matchesAt(pattern, p)) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef SMASH_STRSEARCH_X86
+
+const char *sse2Find(const Pattern &pattern, const char *begin, const char *end) {
+    const __m128i firstMask = _mm_set1_epi8(static_cast<char>(pattern.firstMask));
+    const __m128i firstValue = _mm_set1_epi8(static_cast<char>(pattern.firstValue));
+    const __m128i lastMask = _mm_set1_epi8(static_cast<char>(pattern.lastMask));
+    const __m128i lastValue = _mm_set1_epi8(static_cast<char>(pattern.lastValue));
+    const size_t lastOffset = pattern.size - 1;
+    const char *p = begin;
+    // Both loads stay inside [begin, end)
+    for (; static_cast<size_t>(end - p) >= lastOffset + 16; p += 16) {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + lastOffset));
+        unsigned candidates = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_or_si128(first, firstMask), firstValue),
+                          _mm_cmpeq_epi8(_mm_or_si128(last, lastMask), lastValue)));
+        for (; candidates != 0; candidates &= candidates - 1) {
+            const char *at = p + __builtin_ctz(candidates);
+            if (matchesAt(pattern, at)) {
+                return at;
+            }
+        }
+    }
+    return scalarFind(pattern, p, end);
+}
+
+__attribute__((target("avx2"))) const char *avx2Find(const Pattern &pattern, const char *begin, const char *end) {
+    const __m256i firstMask = _mm256_set1_epi8(static_cast<char>(pattern.firstMask));
+    const __m256i firstValue = _mm256_set1_epi8(static_cast<char>(pattern.firstValue));
+    const __m256i lastMask = _mm256_set1_epi8(static_cast<char>(pattern.lastMask));
+    const __m256i lastValue = _mm256_set1_epi8(static_cast<char>(pattern.lastValue));
+    const size_t lastOffset = pattern.size - 1;
+    const char *p = begin;
+    for (; static_cast<size_t>(end - p) >= lastOffset + 32; p += 32) {
+        __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + lastOffset));
+        unsigned candidates = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_or_si256(first, firstMask), firstValue),
+                             _mm256_cmpeq_epi8(_mm256_or_si256(last, lastMask), lastValue)));
+        for (; candidates != 0; candidates &= candidates - 1) {
+            const char *at = p + __builtin_ctz(candidates);
+            if (matchesAt(pattern, at)) {
+                return at;
+            }
+        }
+    }
+    return scalarFind(pattern, p, end);
+}
+
+#endif
+
+}
+
+//-------------------------------------StringSearcher-------------------------------------
+
+StringSearcher::StringSearcher(const std::string &needle, bool ignoreCase) :
+    StringSearcher(needle, ignoreCase, best()) {}
+
+StringSearcher::StringSearcher(const std::string &needle, bool ignoreCase, Kernel kernel) :
+    m_needle(needle), m_ignoreCase(ignoreCase), m_kernel(supported(kernel) ? kernel : SCALAR), m_firstMask(0),
+    m_firstValue(0), m_lastMask(0), m_lastValue(0) {
+    if (m_needle.empty()) {
+        return;
+    }
+    if (ignoreCase) {
+        for (char &c : m_needle) {
+            c = static_cast<char>(fold(c));
+        }
+    }
+    // Only a letter has a second case: other bytes must match exactly
+    unsigned char first = m_needle[0];
+    unsigned char last = m_needle[m_needle.size() - 1];
+    m_firstMask = ignoreCase && isUpper(first & ~0x20) ? 0x20 : 0;
+    m_lastMask = ignoreCase && isUpper(last & ~0x20) ? 0x20 : 0;
+    m_firstValue = first | m_firstMask;
+    m_lastValue = last | m_lastMask;
+}
+
+const char *StringSearcher::find(const char *begin, const char *end) const {
+    if (m_needle.empty()) {
+        return begin;
+    }
+    Pattern pattern = {m_needle.data(), m_needle.size(), m_ignoreCase,
+                       m_firstMask, m_firstValue, m_lastMask, m_lastValue};
+    switch (m_kernel) {
+#ifdef SMASH_STRSEARCH_X86
+    case AVX2:
+        return avx2Find(pattern, begin, end);
+    case SSE2:
+        return sse2Find(pattern, begin, end);
+#endif
+    default:
+        return scalarFind(pattern, begin, end);
+    }
+}
+
+StringSearcher::Kernel StringSearcher::kernel() const {
+    return m_kernel;
+}
+
+StringSearcher::Kernel StringSearcher::best() {
+    if (supported(AVX2)) {
+        return AVX2;
+    }
+    return supported(SSE2) ? SSE2 : SCALAR;
+}
+
+bool StringSearcher::supported(Kernel kernel) {
+    switch (kernel) {
+#ifdef SMASH_STRSEARCH_X86
+    case AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case SSE2:
+        // Part of x86-64 itself
+        return true;
+#endif
+    case SCALAR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char *StringSearcher::name(Kernel kernel) {
+    switch (kernel) {
+    case AVX2:
+        return "avx2";
+    case SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SMASH__STRSEARCH_H_
+#define SMASH__STRSEARCH_H_
+
+#include <string>
+#include <stddef.h>
+
+// Fixed-string search, as the grep built-in needs it. Candidates are the
+// positions where both the first and the last byte of the needle match,
+// found 16 (SSE2) or 32 (AVX2) positions at a time and then compared in
+// full; which kernel runs is decided from the CPU at run time. The scalar
+// kernel jumps between occurrences of the first byte with memchr().
+// Ignoring case folds ASCII letters only, as the C locale does.
+class StringSearcher {
+public:
+    enum Kernel {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    StringSearcher(const std::string &needle, bool ignoreCase);
+
+    // A specific kernel, for benchmarks; falls back to SCALAR if the CPU
+    // does not support it.
+    StringSearcher(const std::string &needle, bool ignoreCase, Kernel kernel);
+
+    // The first occurrence in [begin, end), or end. An empty needle is
+    // found at begin.
+    const char *find(const char *begin, const char *end) const;
+
+    Kernel kernel() const;
+
+    static Kernel best();
+
+    static bool supported(Kernel kernel);
+
+    static const char *name(Kernel kernel);
+
+private:
+    // Folded to lower case when case is ignored
+    std::string m_needle;
+    bool m_ignoreCase;
+    Kernel m_kernel;
+    // The first and last byte compare as (byte | mask) == value; the mask
+    // is 0x20 for a letter when case is ignored, 0 otherwise
+    unsigned char m_firstMask;
+    unsigned char m_firstValue;
+    unsigned char m_lastMask;
+    unsigned char m_lastValue;
+};
+
+#endif //SMASH__STRSEARCH_H_
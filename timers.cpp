@@ -0,0 +1,258 @@
+#include "timers.h"
+#include "output.h"
+
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+using namespace std;
+
+namespace {
+
+// Keeps SIGALRM blocked for the lifetime of the guard.
+class AlarmBlocker {
+public:
+    AlarmBlocker() {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGALRM);
+        pthread_sigmask(SIG_BLOCK, &set, &m_old);
+    }
+
+    ~AlarmBlocker() {
+        pthread_sigmask(SIG_SETMASK, &m_old, nullptr);
+    }
+
+private:
+    sigset_t m_old;
+};
+
+// Holds the wheel's spin lock for the lifetime of the guard. Shell threads
+// take it with SIGALRM blocked, so the handler never spins on its own thread.
+class WheelLock {
+public:
+    explicit WheelLock(std::atomic_flag &lock) : m_lock(lock) {
+        while (m_lock.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+
+    ~WheelLock() {
+        m_lock.clear(std::memory_order_release);
+    }
+
+private:
+    std::atomic_flag &m_lock;
+};
+
+}
+
+TimerWheel::TimerWheel() : m_now(0), m_pending(0), m_nextId(1), m_announced(false) {
+    m_lock.clear();
+    for (int level = 0; level < LEVELS; ++level) {
+        for (int slot = 0; slot < SLOTS; ++slot) {
+            listInit(&m_slots[level][slot]);
+        }
+    }
+    listInit(&m_fired);
+}
+
+//-------------------------------------Lists-------------------------------------
+
+void TimerWheel::listInit(Link *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+void TimerWheel::listPush(Link *head, Link *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void TimerWheel::listUnlink(Link *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node;
+    node->next = node;
+}
+
+//-------------------------------------Public API-------------------------------------
+
+unsigned long TimerWheel::addProcessTimer(double seconds, pid_t pid, int signal, const char *cmd) {
+    Timer *timer = new Timer();
+    timer->pid = pid;
+    timer->signal = signal;
+    timer->flag = nullptr;
+    strncpy(timer->cmd, cmd, TIMER_CMD_MAX_LENGTH);
+    return addTimer(timer, seconds);
+}
+
+unsigned long TimerWheel::addFlagTimer(double seconds, std::atomic<bool> *flag,
+                                       const std::shared_ptr<void> &keepAlive, const char *cmd) {
+    Timer *timer = new Timer();
+    timer->pid = 0;
+    timer->signal = 0;
+    timer->flag = flag;
+    timer->keepAlive = keepAlive;
+    strncpy(timer->cmd, cmd, TIMER_CMD_MAX_LENGTH);
+    return addTimer(timer, seconds);
+}
+
+unsigned long TimerWheel::addTimer(Timer *timer, double seconds) {
+    timer->fired = false;
+    timer->cmd[TIMER_CMD_MAX_LENGTH] = '\0';
+    uint64_t ticks = static_cast<uint64_t>(ceil(seconds * 1000.0 / TICK_MS));
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    AlarmBlocker blocker;
+    WheelLock lock(m_lock);
+    if (m_pending == 0) {
+        // Nothing is pending, so the wheel can jump straight to the present.
+        m_now = currentTick();
+    }
+    timer->expires = currentTick() + ticks;
+    place(timer);
+    unsigned long id = m_nextId++;
+    m_timers[id] = timer;
+    if (m_pending++ == 0) {
+        startTicking();
+    }
+    return id;
+}
+
+void TimerWheel::cancel(unsigned long timerId) {
+    // Most commands have no deadline: no need to touch the signal mask
+    if (timerId == 0) {
+        return;
+    }
+    Timer *timer;
+    {
+        AlarmBlocker blocker;
+        WheelLock lock(m_lock);
+        auto it = m_timers.find(timerId);
+        if (it == m_timers.end()) {
+            return;
+        }
+        timer = it->second;
+        listUnlink(timer);
+        if (!timer->fired && --m_pending == 0) {
+            stopTicking();
+        }
+        m_timers.erase(it);
+    }
+    delete timer;
+}
+
+//-------------------------------------Wheel-------------------------------------
+
+uint64_t TimerWheel::currentTick() const {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000) / TICK_MS;
+}
+
+void TimerWheel::place(Timer *timer) {
+    const uint64_t maxDelta = (1ULL << (SLOT_BITS * LEVELS)) - 1;
+    if (timer->expires - m_now > maxDelta) {
+        timer->expires = m_now + maxDelta;
+    }
+    uint64_t delta = timer->expires - m_now;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    int slot = (timer->expires >> (SLOT_BITS * level)) & (SLOTS - 1);
+    listPush(&m_slots[level][slot], timer);
+}
+
+void TimerWheel::processTick() {
+    // At the start of each lap of a level, the matching slot of the level
+    // above is due: move its timers down to where they now belong.
+    for (int level = 1; level < LEVELS; ++level) {
+        if (m_now & ((1ULL << (SLOT_BITS * level)) - 1)) {
+            break;
+        }
+        Link *head = &m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)];
+        while (head->next != head) {
+            Timer *timer = static_cast<Timer *>(head->next);
+            listUnlink(timer);
+            place(timer);
+        }
+    }
+
+    Link *head = &m_slots[0][m_now & (SLOTS - 1)];
+    while (head->next != head) {
+        Timer *timer = static_cast<Timer *>(head->next);
+        listUnlink(timer);
+        fire(timer);
+    }
+    ++m_now;
+}
+
+void TimerWheel::fire(Timer *timer) {
+    timer->fired = true;
+    listPush(&m_fired, timer);
+    --m_pending;
+
+    if (!m_announced) {
+        (SignalMessage() << "smash: got an alarm\n").write();
+        m_announced = true;
+    }
+    (SignalMessage() << "smash: " << timer->cmd << " timed out!\n").write();
+    if (timer->flag) {
+        timer->flag->store(true);
+    } else if (kill(timer->pid, timer->signal) == -1) {
+        // In the handler: a fixed message through write(2), not perror()
+        static const char MESSAGE[] = "smash error: kill failed\n";
+        writeAll(STDERR_FILENO, MESSAGE, sizeof(MESSAGE) - 1);
+    }
+}
+
+void TimerWheel::onAlarm() {
+    // A shell thread is changing the wheel: its due ticks wait for the next alarm
+    if (m_lock.test_and_set(std::memory_order_acquire)) {
+        return;
+    }
+    onAlarmLocked();
+    m_lock.clear(std::memory_order_release);
+}
+
+void TimerWheel::onAlarmLocked() {
+    if (m_pending == 0) {
+        return;
+    }
+    uint64_t target = currentTick();
+    m_announced = false;
+    while (m_pending > 0 && m_now <= target) {
+        processTick();
+    }
+    if (m_pending == 0) {
+        stopTicking();
+    }
+}
+
+void TimerWheel::startTicking() {
+    struct itimerval tv;
+    tv.it_interval.tv_sec = 0;
+    tv.it_interval.tv_usec = TICK_MS * 1000;
+    tv.it_value = tv.it_interval;
+    if (setitimer(ITIMER_REAL, &tv, nullptr) == -1) {
+        perror("smash error: setitimer failed");
+    }
+}
+
+void TimerWheel::stopTicking() {
+    struct itimerval tv;
+    memset(&tv, 0, sizeof(tv));
+    // Also called from the handler once the last timer fired
+    if (setitimer(ITIMER_REAL, &tv, nullptr) == -1) {
+        static const char MESSAGE[] = "smash error: setitimer failed\n";
+        writeAll(STDERR_FILENO, MESSAGE, sizeof(MESSAGE) - 1);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef SMASH__TIMERS_H_
+#define SMASH__TIMERS_H_
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TIMER_CMD_MAX_LENGTH (200)
+
+// Hierarchical timer wheel for `timeout` deadlines, advanced from the SIGALRM
+// handler by a periodic ITIMER_REAL that only runs while timers are pending.
+// Four levels of 64 slots at 100ms per tick cover about 19 days; adding,
+// cancelling and each tick are O(1) no matter how many deadlines are pending.
+//
+// Sessions on several threads share the wheel, and the handler may run on
+// any of them, so changes hold a spin lock: shell methods block SIGALRM on
+// their thread and spin, the handler only tries it and leaves due ticks to
+// the next alarm if it is taken. Nodes are only allocated and freed by the
+// shell; the handler just moves them between lists.
+class TimerWheel {
+public:
+    static const int TICK_MS = 100;
+
+    static TimerWheel &getInstance() {
+        static TimerWheel instance;
+        return instance;
+    }
+
+    TimerWheel(TimerWheel const &) = delete;
+    void operator=(TimerWheel const &) = delete;
+
+    // Send `signal` to `pid` when `seconds` elapse. Returns the timer id.
+    unsigned long addProcessTimer(double seconds, pid_t pid, int signal, const char *cmd);
+
+    // Raise `*flag` when `seconds` elapse (built-ins poll it). `keepAlive`
+    // holds the flag's owner until the timer is cancelled.
+    unsigned long addFlagTimer(double seconds, std::atomic<bool> *flag,
+                               const std::shared_ptr<void> &keepAlive, const char *cmd);
+
+    // Drop a timer, whether it has fired or not. Unknown ids are ignored.
+    void cancel(unsigned long timerId);
+
+    // Called from the SIGALRM handler: run every tick that is due.
+    void onAlarm();
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    struct Link {
+        Link *prev;
+        Link *next;
+    };
+
+    struct Timer : Link {
+        uint64_t expires;
+        pid_t pid;
+        int signal;
+        std::atomic<bool> *flag;
+        std::shared_ptr<void> keepAlive;
+        bool fired;
+        char cmd[TIMER_CMD_MAX_LENGTH + 1];
+    };
+
+    TimerWheel();
+
+    unsigned long addTimer(Timer *timer, double seconds);
+
+    uint64_t currentTick() const;
+
+    void place(Timer *timer);
+
+    void processTick();
+
+    void onAlarmLocked();
+
+    void fire(Timer *timer);
+
+    void startTicking();
+
+    void stopTicking();
+
+    static void listInit(Link *head);
+
+    static void listPush(Link *head, Link *node);
+
+    static void listUnlink(Link *node);
+
+    Link m_slots[LEVELS][SLOTS];
+    Link m_fired;
+    // Next tick to process; every pending timer expires at or after it.
+    uint64_t m_now;
+    unsigned long m_pending;
+    unsigned long m_nextId;
+    bool m_announced;
+    std::atomic_flag m_lock;
+    std::unordered_map<unsigned long, Timer *> m_timers;
+};
+
+#endif //SMASH__TIMERS_H_
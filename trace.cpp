@@ -0,0 +1,181 @@
+#include "trace.h"
+#include "output.h"
+#include "stats.h"
+
+#include <ostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace {
+
+void writeJsonString(std::ostream &out, const char *str) {
+    out << '"';
+    for (const char *c = str; *c; ++c) {
+        switch (*c) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(*c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+                    out << escaped;
+                } else {
+                    out << *c;
+                }
+        }
+    }
+    out << '"';
+}
+
+}
+
+thread_local Tracer::ThreadBuffer *Tracer::t_buffer = nullptr;
+
+Tracer::ThreadBuffer::ThreadBuffer(long tid) : tid(tid), slots(CAPACITY), head(0), begin(0) {}
+
+Tracer::Tracer() : m_enabled(false), m_atExitRegistered(false) {}
+
+void Tracer::start(const std::string &path) {
+    {
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        for (ThreadBuffer *buffer : m_buffers) {
+            buffer->begin.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+    }
+    m_path = path;
+    if (!m_atExitRegistered) {
+        atexit(flushAtExit);
+        m_atExitRegistered = true;
+    }
+    m_enabled.store(true, std::memory_order_relaxed);
+}
+
+bool Tracer::stop() {
+    if (!enabled()) {
+        return true;
+    }
+    m_enabled.store(false, std::memory_order_relaxed);
+    return writeFile();
+}
+
+void Tracer::flushAtExit() {
+    Tracer &tracer = getInstance();
+    if (tracer.enabled() && !tracer.stop()) {
+        perror("smash error: trace: write failed");
+    }
+}
+
+Tracer::ThreadBuffer *Tracer::threadBuffer() {
+    if (t_buffer == nullptr) {
+        // Buffers are never freed: pool threads live as long as the shell.
+        ThreadBuffer *buffer = new ThreadBuffer(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        m_buffers.push_back(buffer);
+        t_buffer = buffer;
+    }
+    return t_buffer;
+}
+
+void Tracer::complete(const char *name, const char *category, uint64_t startNs, uint64_t endNs,
+                      const char *detail) {
+    if (!enabled()) {
+        return;
+    }
+    ThreadBuffer *buffer = threadBuffer();
+    uint64_t index = buffer->head.load(std::memory_order_relaxed);
+    Slot &slot = buffer->slots[index & (ThreadBuffer::CAPACITY - 1)];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Event &event = slot.event;
+    event.name = name;
+    event.category = category;
+    event.startNs = startNs;
+    event.endNs = endNs;
+    if (detail) {
+        strncpy(event.detail, detail, TRACE_DETAIL_LENGTH);
+        event.detail[TRACE_DETAIL_LENGTH] = '\0';
+    } else {
+        event.detail[0] = '\0';
+    }
+    slot.seq.store(index + 1, std::memory_order_release);
+    buffer->head.store(index + 1, std::memory_order_release);
+}
+
+bool Tracer::writeFile() {
+    int fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok;
+    {
+        FdStreamBuf buf(fd, 1 << 16);
+        std::ostream out(&buf);
+        char number[64];
+        long pid = getpid();
+        bool first = true;
+
+        out << "{\"traceEvents\":[";
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        std::vector<Event> events;
+        for (ThreadBuffer *buffer : m_buffers) {
+            // Copied out, oldest first: other threads may still be recording
+            events.clear();
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t begin = buffer->begin.load(std::memory_order_relaxed);
+            if (head > ThreadBuffer::CAPACITY && head - ThreadBuffer::CAPACITY > begin) {
+                begin = head - ThreadBuffer::CAPACITY;
+            }
+            for (uint64_t i = begin; i < head; ++i) {
+                const Slot &slot = buffer->slots[i & (ThreadBuffer::CAPACITY - 1)];
+                if (slot.seq.load(std::memory_order_acquire) != i + 1) {
+                    continue;
+                }
+                Event event = slot.event;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) == i + 1) {
+                    events.push_back(event);
+                }
+            }
+            for (const Event &event : events) {
+                out << (first ? "\n" : ",\n");
+                first = false;
+                out << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\"";
+                snprintf(number, sizeof(number), ",\"ts\":%.3f,\"dur\":%.3f",
+                         event.startNs / 1e3, (event.endNs - event.startNs) / 1e3);
+                out << number << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid;
+                if (event.detail[0]) {
+                    out << ",\"args\":{\"cmd\":";
+                    writeJsonString(out, event.detail);
+                    out << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        out.flush();
+        ok = out.good();
+    }
+    return close(fd) == 0 && ok;
+}
+
+//-------------------------------------TraceSpan-------------------------------------
+
+TraceSpan::TraceSpan(const char *name, const char *category, const char *detail) :
+    m_name(name), m_category(category), m_detail(detail), m_start(0),
+    m_active(Tracer::getInstance().enabled()) {
+    if (m_active) {
+        m_start = statsNow();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if (m_active) {
+        Tracer::getInstance().complete(m_name, m_category, m_start, statsNow(), m_detail);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef SMASH__TRACE_H_
+#define SMASH__TRACE_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define TRACE_DETAIL_LENGTH (63)
+
+// Records spans of shell activity and writes them out in the Chrome
+// trace-event format (chrome://tracing, ui.perfetto.dev).
+//
+// Every thread appends to its own fixed-size ring buffer; when a buffer
+// wraps the oldest spans are dropped. Recording takes no lock: each slot
+// carries a sequence number, and the thread writing the trace (on "trace
+// off" or at exit) copies a slot and keeps the copy only if the number
+// did not change meanwhile. A span overwritten while the trace is being
+// written is left out.
+class Tracer {
+public:
+    static Tracer &getInstance() {
+        static Tracer instance;
+        return instance;
+    }
+
+    Tracer(Tracer const &) = delete;
+    void operator=(Tracer const &) = delete;
+
+    bool enabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Start recording; the trace is written to path by stop() or at exit.
+    void start(const std::string &path);
+
+    // Stop recording and write the trace file. Returns false if it failed.
+    bool stop();
+
+    // Record a finished span. name and category must be string literals.
+    void complete(const char *name, const char *category, uint64_t startNs, uint64_t endNs,
+                  const char *detail = nullptr);
+
+private:
+    struct Event {
+        const char *name;
+        const char *category;
+        uint64_t startNs;
+        uint64_t endNs;
+        char detail[TRACE_DETAIL_LENGTH + 1];
+    };
+
+    // seq is 0 while the event is being written, and then 1 + the index
+    // of the event in its buffer.
+    struct Slot {
+        Slot() : seq(0) {}
+
+        std::atomic<uint64_t> seq;
+        Event event;
+    };
+
+    struct ThreadBuffer {
+        static const size_t CAPACITY = 1 << 15;
+
+        explicit ThreadBuffer(long tid);
+
+        long tid;
+        std::vector<Slot> slots;
+        // Only the owning thread advances head; begin is where the current
+        // trace started.
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> begin;
+    };
+
+    Tracer();
+
+    ThreadBuffer *threadBuffer();
+
+    static thread_local ThreadBuffer *t_buffer;
+
+    bool writeFile();
+
+    static void flushAtExit();
+
+    std::atomic<bool> m_enabled;
+    std::string m_path;
+    std::mutex m_buffersMutex;
+    std::vector<ThreadBuffer *> m_buffers;
+    bool m_atExitRegistered;
+};
+
+// Records the lifetime of the object as a span when tracing is on.
+class TraceSpan {
+public:
+    TraceSpan(const char *name, const char *category, const char *detail = nullptr);
+
+    ~TraceSpan();
+
+private:
+    const char *m_name;
+    const char *m_category;
+    const char *m_detail;
+    uint64_t m_start;
+    bool m_active;
+};
+
+#endif //SMASH__TRACE_H_
@@ -0,0 +1,134 @@
+#include "vars.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <string.h>
+
+extern char **environ;
+
+//-------------------------------------VariableStore-------------------------------------
+
+VariableStore::VariableStore() : m_envDirty(true) {
+    for (char **entry = environ; entry && *entry; ++entry) {
+        const char *eq = strchr(*entry, '=');
+        if (eq == nullptr) {
+            continue;
+        }
+        Variable &var = m_variables[std::string(*entry, eq - *entry)];
+        var.value = eq + 1;
+        var.exported = true;
+    }
+}
+
+const std::string *VariableStore::find(const std::string &name) const {
+    auto it = m_variables.find(name);
+    return it == m_variables.end() ? nullptr : &it->second.value;
+}
+
+void VariableStore::set(const std::string &name, const std::string &value, bool export_) {
+    auto inserted = m_variables.emplace(name, Variable{value, export_});
+    Variable &var = inserted.first->second;
+    if (!inserted.second) {
+        if (var.value == value && (var.exported || !export_)) {
+            return;
+        }
+        var.value = value;
+        var.exported = var.exported || export_;
+    }
+    if (var.exported) {
+        m_envDirty = true;
+    }
+}
+
+void VariableStore::exportName(const std::string &name) {
+    Variable &var = m_variables[name];
+    if (!var.exported) {
+        var.exported = true;
+        m_envDirty = true;
+    }
+}
+
+bool VariableStore::unset(const std::string &name) {
+    auto it = m_variables.find(name);
+    if (it == m_variables.end()) {
+        return false;
+    }
+    if (it->second.exported) {
+        m_envDirty = true;
+    }
+    m_variables.erase(it);
+    return true;
+}
+
+bool VariableStore::isExported(const std::string &name) const {
+    auto it = m_variables.find(name);
+    return it != m_variables.end() && it->second.exported;
+}
+
+size_t VariableStore::size() const {
+    return m_variables.size();
+}
+
+char **VariableStore::envp() {
+    if (m_envDirty) {
+        m_envStrings.clear();
+        m_envStrings.reserve(m_variables.size());
+        for (const auto &entry : m_variables) {
+            if (entry.second.exported) {
+                m_envStrings.push_back(entry.first + '=' + entry.second.value);
+            }
+        }
+        // Pointers are taken once the strings stop moving
+        m_envp.clear();
+        m_envp.reserve(m_envStrings.size() + 1);
+        for (std::string &s : m_envStrings) {
+            m_envp.push_back(&s[0]);
+        }
+        m_envp.push_back(nullptr);
+        m_envDirty = false;
+    }
+    return m_envp.data();
+}
+
+void VariableStore::print(std::ostream &out, bool exportedOnly) const {
+    std::vector<const std::pair<const std::string, Variable> *> sorted;
+    sorted.reserve(m_variables.size());
+    for (const auto &entry : m_variables) {
+        if (!exportedOnly || entry.second.exported) {
+            sorted.push_back(&entry);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<const std::string, Variable> *a,
+                 const std::pair<const std::string, Variable> *b) { return a->first < b->first; });
+    std::string line;
+    for (const auto *entry : sorted) {
+        line = entry->first;
+        line += "='";
+        for (char c : entry->second.value) {
+            if (c == '\'') {
+                line += "'\\''";
+            } else {
+                line += c;
+            }
+        }
+        line += "'\n";
+        out << line;
+    }
+}
+
+bool VariableStore::isValidName(const char *name, size_t length) {
+    if (length == 0 || !(isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_')) {
+        return false;
+    }
+    for (size_t i = 1; i < length; ++i) {
+        if (!(isalnum(static_cast<unsigned char>(name[i])) || name[i] == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VariableStore::isValidName(const std::string &name) {
+    return isValidName(name.c_str(), name.size());
+}
@@ -0,0 +1,60 @@
+#ifndef SMASH__VARS_H_
+#define SMASH__VARS_H_
+
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shell variables and the environment in one hash table, so lookups, sets and
+// unsets stay O(1) however many there are. Exported variables reach children
+// through an envp array that is cached and only rebuilt after one changes.
+class VariableStore {
+public:
+    // Starts with the process environment, all exported.
+    VariableStore();
+
+    VariableStore(VariableStore const &) = delete;
+    void operator=(VariableStore const &) = delete;
+
+    // Value of name, or nullptr if it is not set.
+    const std::string *find(const std::string &name) const;
+
+    // Sets name, keeping whether it was exported unless export_ asks for it.
+    void set(const std::string &name, const std::string &value, bool export_ = false);
+
+    // Marks name exported; an unset name is created empty.
+    void exportName(const std::string &name);
+
+    // Removes name. Returns false if it was not set.
+    bool unset(const std::string &name);
+
+    bool isExported(const std::string &name) const;
+
+    size_t size() const;
+
+    // NULL-terminated "NAME=VALUE" array of the exported variables. Valid
+    // until the next change to an exported variable.
+    char **envp();
+
+    // "NAME='VALUE'" lines sorted by name; only exported ones if exportedOnly.
+    void print(std::ostream &out, bool exportedOnly) const;
+
+    // [A-Za-z_][A-Za-z0-9_]*
+    static bool isValidName(const char *name, size_t length);
+
+    static bool isValidName(const std::string &name);
+
+private:
+    struct Variable {
+        std::string value;
+        bool exported;
+    };
+
+    std::unordered_map<std::string, Variable> m_variables;
+    std::vector<std::string> m_envStrings;
+    std::vector<char *> m_envp;
+    bool m_envDirty;
+};
+
+#endif //SMASH__VARS_H_
@@ -0,0 +1,317 @@
+#include "wordcount.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SMASH_WORDCOUNT_X86 1
+#endif
+
+namespace {
+
+enum ByteClass {
+    NEUTRAL,
+    SPACE,
+    NEWLINE,
+    WORD
+};
+
+// isspace() and isprint() of the C locale, per byte
+struct ClassTable {
+    unsigned char classes[256];
+
+    ClassTable() {
+        for (int c = 0; c < 256; ++c) {
+            if (c == '\n') {
+                classes[c] = NEWLINE;
+            } else if (c == ' ' || (c >= '\t' && c <= '\r')) {
+                classes[c] = SPACE;
+            } else if (c > ' ' && c < 0x7f) {
+                classes[c] = WORD;
+            } else {
+                classes[c] = NEUTRAL;
+            }
+        }
+    }
+};
+
+const ClassTable CLASSES;
+
+void scalarLines(const unsigned char *p, size_t n, WordCounter::State &state) {
+    uint64_t lines = 0;
+    for (size_t i = 0; i < n; ++i) {
+        lines += p[i] == '\n';
+    }
+    state.lines += lines;
+}
+
+void scalarWords(const unsigned char *p, size_t n, WordCounter::State &state) {
+    uint64_t lines = state.lines;
+    uint64_t words = state.words;
+    bool inWord = state.inWord;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char cls = CLASSES.classes[p[i]];
+        bool word = cls == WORD;
+        lines += cls == NEWLINE;
+        words += word && !inWord;
+        inWord = cls == NEUTRAL ? inWord : word;
+    }
+    state.lines = lines;
+    state.words = words;
+    state.inWord = inWord;
+}
+
+#ifdef SMASH_WORDCOUNT_X86
+
+// Byte counters are summed into 64 bits before any can pass 255
+const size_t MAX_BLOCKS = 255;
+
+uint64_t sum128(__m128i counters) {
+    __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+    return _mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+}
+
+void sse2Lines(const unsigned char *p, size_t n, WordCounter::State &state) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (n >= 16) {
+        size_t blocks = std::min(n / 16, MAX_BLOCKS);
+        __m128i lines = _mm_setzero_si128();
+        for (size_t i = 0; i < blocks; ++i, p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            lines = _mm_sub_epi8(lines, _mm_cmpeq_epi8(v, newline));
+        }
+        n -= blocks * 16;
+        state.lines += sum128(lines);
+    }
+    scalarLines(p, n, state);
+}
+
+// A word starts at a word byte whose previous byte is not one. That only
+// holds in a block without neutral bytes, which is nearly every block of
+// text; the rest go through the scalar loop.
+void sse2Words(const unsigned char *p, size_t n, WordCounter::State &state) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i beforeTab = _mm_set1_epi8('\t' - 1);
+    const __m128i afterReturn = _mm_set1_epi8('\r' + 1);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i allSet = _mm_set1_epi8(-1);
+    // Only its last byte counts: whether a word runs into the next block
+    __m128i previous = state.inWord ? allSet : _mm_setzero_si128();
+    while (n >= 16) {
+        size_t blocks = std::min(n / 16, MAX_BLOCKS);
+        __m128i lines = _mm_setzero_si128();
+        __m128i starts = _mm_setzero_si128();
+        for (size_t i = 0; i < blocks; ++i, p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            // Signed compares: bytes >= 0x80 are negative and fall in neither
+            __m128i word = _mm_and_si128(_mm_cmpgt_epi8(v, space), _mm_cmplt_epi8(v, del));
+            __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                         _mm_and_si128(_mm_cmpgt_epi8(v, beforeTab), _mm_cmplt_epi8(v, afterReturn)));
+            if (_mm_movemask_epi8(_mm_or_si128(word, blank)) != 0xffff) {
+                WordCounter::State block = {0, 0, (_mm_movemask_epi8(previous) & 0x8000) != 0};
+                scalarWords(p, 16, block);
+                state.lines += block.lines;
+                state.words += block.words;
+                previous = block.inWord ? allSet : _mm_setzero_si128();
+                continue;
+            }
+            __m128i shifted = _mm_or_si128(_mm_slli_si128(word, 1), _mm_srli_si128(previous, 15));
+            starts = _mm_sub_epi8(starts, _mm_andnot_si128(shifted, word));
+            lines = _mm_sub_epi8(lines, _mm_cmpeq_epi8(v, newline));
+            previous = word;
+        }
+        n -= blocks * 16;
+        state.lines += sum128(lines);
+        state.words += sum128(starts);
+    }
+    state.inWord = (_mm_movemask_epi8(previous) & 0x8000) != 0;
+    scalarWords(p, n, state);
+}
+
+__attribute__((target("avx2"))) uint64_t sum256(__m256i counters) {
+    __m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+    __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    return _mm_cvtsi128_si64(halves) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(halves, halves));
+}
+
+__attribute__((target("avx2"))) void avx2Lines(const unsigned char *p, size_t n, WordCounter::State &state) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    while (n >= 32) {
+        size_t blocks = std::min(n / 32, MAX_BLOCKS);
+        __m256i lines = _mm256_setzero_si256();
+        for (size_t i = 0; i < blocks; ++i, p += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            lines = _mm256_sub_epi8(lines, _mm256_cmpeq_epi8(v, newline));
+        }
+        n -= blocks * 32;
+        state.lines += sum256(lines);
+    }
+    scalarLines(p, n, state);
+}
+
+// As sse2Words, 32 bytes at a time.
+__attribute__((target("avx2"))) void avx2Words(const unsigned char *p, size_t n, WordCounter::State &state) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i beforeTab = _mm256_set1_epi8('\t' - 1);
+    const __m256i afterReturn = _mm256_set1_epi8('\r' + 1);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i allSet = _mm256_set1_epi8(-1);
+    __m256i previous = state.inWord ? allSet : _mm256_setzero_si256();
+    while (n >= 32) {
+        size_t blocks = std::min(n / 32, MAX_BLOCKS);
+        __m256i lines = _mm256_setzero_si256();
+        __m256i starts = _mm256_setzero_si256();
+        for (size_t i = 0; i < blocks; ++i, p += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            __m256i word = _mm256_and_si256(_mm256_cmpgt_epi8(v, space), _mm256_cmpgt_epi8(del, v));
+            __m256i blank = _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, space),
+                _mm256_and_si256(_mm256_cmpgt_epi8(v, beforeTab), _mm256_cmpgt_epi8(afterReturn, v)));
+            if (_mm256_movemask_epi8(_mm256_or_si256(word, blank)) != -1) {
+                WordCounter::State block = {0, 0, _mm256_movemask_epi8(previous) < 0};
+                scalarWords(p, 32, block);
+                state.lines += block.lines;
+                state.words += block.words;
+                previous = block.inWord ? allSet : _mm256_setzero_si256();
+                continue;
+            }
+            // Shift the block up one byte, across the lanes, with the last
+            // byte of the previous one in front
+            __m256i carried = _mm256_permute2x128_si256(previous, word, 0x21);
+            __m256i shifted = _mm256_alignr_epi8(word, carried, 15);
+            starts = _mm256_sub_epi8(starts, _mm256_andnot_si256(shifted, word));
+            lines = _mm256_sub_epi8(lines, _mm256_cmpeq_epi8(v, newline));
+            previous = word;
+        }
+        n -= blocks * 32;
+        state.lines += sum256(lines);
+        state.words += sum256(starts);
+    }
+    state.inWord = _mm256_movemask_epi8(previous) < 0;
+    scalarWords(p, n, state);
+}
+
+#endif
+
+}
+
+//-------------------------------------WordCounter-------------------------------------
+
+WordCounter::WordCounter(unsigned counts) : WordCounter(counts, best()) {}
+
+WordCounter::WordCounter(unsigned counts, Kernel kernel) :
+    m_counts(counts), m_kernel(supported(kernel) ? kernel : SCALAR), m_bytes(0), m_lineLength(0),
+    m_maxLineLength(0) {
+    m_state.lines = 0;
+    m_state.words = 0;
+    m_state.inWord = false;
+}
+
+void WordCounter::add(const char *data, size_t length) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    m_bytes += length;
+    if (m_counts & WORDS) {
+        switch (m_kernel) {
+#ifdef SMASH_WORDCOUNT_X86
+        case AVX2:
+            avx2Words(p, length, m_state);
+            break;
+        case SSE2:
+            sse2Words(p, length, m_state);
+            break;
+#endif
+        default:
+            scalarWords(p, length, m_state);
+        }
+    } else if (m_counts & LINES) {
+        switch (m_kernel) {
+#ifdef SMASH_WORDCOUNT_X86
+        case AVX2:
+            avx2Lines(p, length, m_state);
+            break;
+        case SSE2:
+            sse2Lines(p, length, m_state);
+            break;
+#endif
+        default:
+            scalarLines(p, length, m_state);
+        }
+    }
+    if (!(m_counts & LINE_LENGTH)) {
+        return;
+    }
+    // Display columns as wc -L counts them: control bytes take none
+    uint64_t column = m_lineLength;
+    uint64_t widest = m_maxLineLength;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = p[i];
+        if (c == '\n' || c == '\r' || c == '\f') {
+            widest = std::max(widest, column);
+            column = 0;
+        } else if (c == '\t') {
+            column += 8 - column % 8;
+        } else if (c >= ' ' && c < 0x7f) {
+            ++column;
+        }
+    }
+    m_lineLength = column;
+    m_maxLineLength = widest;
+}
+
+uint64_t WordCounter::lines() const {
+    return m_state.lines;
+}
+
+uint64_t WordCounter::words() const {
+    return m_state.words;
+}
+
+uint64_t WordCounter::bytes() const {
+    return m_bytes;
+}
+
+uint64_t WordCounter::maxLineLength() const {
+    // A last line without its newline counts too
+    return std::max(m_maxLineLength, m_lineLength);
+}
+
+WordCounter::Kernel WordCounter::kernel() const {
+    return m_kernel;
+}
+
+WordCounter::Kernel WordCounter::best() {
+    if (supported(AVX2)) {
+        return AVX2;
+    }
+    return supported(SSE2) ? SSE2 : SCALAR;
+}
+
+bool WordCounter::supported(Kernel kernel) {
+    switch (kernel) {
+#ifdef SMASH_WORDCOUNT_X86
+    case AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case SSE2:
+        // Part of x86-64 itself
+        return true;
+#endif
+    case SCALAR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char *WordCounter::name(Kernel kernel) {
+    switch (kernel) {
+    case AVX2:
+        return "avx2";
+    case SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SMASH__WORDCOUNT_H_
+#define SMASH__WORDCOUNT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The counting core of the wc built-in. Counts are those of coreutils wc
+// in the C locale: a word is a run of printable non-space bytes, and other
+// non-printable bytes (NUL, control bytes, bytes >= 0x80) neither start
+// nor end one. The input may arrive in any number of pieces.
+//
+// Lines and words are counted 16 (SSE2) or 32 (AVX2) bytes at a time,
+// picked from what the CPU supports at run time; a block holding a
+// non-printable byte, and anything on other architectures, goes through
+// the scalar loop. The longest line (-L) is always counted by the scalar
+// loop.
+class WordCounter {
+public:
+    enum Kernel {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    // What to count beyond bytes; lines alone are the cheapest.
+    enum {
+        LINES = 1,
+        WORDS = 2,
+        LINE_LENGTH = 4
+    };
+
+    explicit WordCounter(unsigned counts);
+
+    // A specific kernel, for benchmarks; falls back to SCALAR if the CPU
+    // does not support it.
+    WordCounter(unsigned counts, Kernel kernel);
+
+    void add(const char *data, size_t length);
+
+    uint64_t lines() const;
+
+    uint64_t words() const;
+
+    uint64_t bytes() const;
+
+    // Widest line in columns, tabs to multiples of 8.
+    uint64_t maxLineLength() const;
+
+    Kernel kernel() const;
+
+    static Kernel best();
+
+    static bool supported(Kernel kernel);
+
+    static const char *name(Kernel kernel);
+
+    // What a kernel carries from one piece of input to the next.
+    struct State {
+        uint64_t lines;
+        uint64_t words;
+        // The last byte that was not neutral was part of a word
+        bool inWord;
+    };
+
+private:
+    unsigned m_counts;
+    Kernel m_kernel;
+    State m_state;
+    uint64_t m_bytes;
+    uint64_t m_lineLength;
+    uint64_t m_maxLineLength;
+};
+
+#endif //SMASH__WORDCOUNT_H_